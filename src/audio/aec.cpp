@@ -0,0 +1,260 @@
+#include "aec.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+using namespace aud;
+
+using cfloat = std::complex<float>;
+
+// NLMS step size, 1 is the fastest and the least robust
+static constexpr float STEP = 0.5f;
+// the far end quieter than this (peak) is not adapted to
+static constexpr float FAR_SILENCE = 1e-4f;
+// per bin regularization of the normalization, about -60 dBFS of white noise in a block
+static constexpr float REGULARIZATION = 2 * EchoCancellerDSP::BLOCK * 1e-6f;
+// the echo is assumed not louder than the far end, a louder near end means double-talk
+static constexpr float GEIGEL_RATIO = 1.f;
+// blocks the adaptation stays frozen after the double-talk
+static constexpr size_t DOUBLE_TALK_HOLD = 30;
+// the output this much louder than the input means the filter diverged
+static constexpr float DIVERGENCE = 4;
+// blocks over which erle() is measured, about a second
+static constexpr size_t ERLE_BLOCKS = SAMPLE_RATE / EchoCancellerDSP::BLOCK;
+static constexpr double PI = 3.14159265358979323846;
+
+// std::complex multiplication checks for the infinities, too slow for the per-bin loops
+static inline cfloat mul(cfloat a, cfloat b) {
+    return {a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real()};
+}
+
+static inline cfloat mulConj(cfloat a, cfloat b) { // conj(a) * b
+    return {a.real() * b.real() + a.imag() * b.imag(), a.real() * b.imag() - a.imag() * b.real()};
+}
+
+Fft::Fft(size_t n) : n(n), rev(n), twiddles(n / 2), buf(n) {
+    assert(n >= 2 && (n & (n - 1)) == 0);
+    size_t bits = 0;
+    while (((size_t)1 << bits) < n) {
+        bits++;
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t r = 0;
+        for (size_t b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        rev[i] = r;
+    }
+    for (size_t k = 0; k < n / 2; k++) {
+        double a = -2 * PI * k / n;
+        twiddles[k] = cfloat((float)std::cos(a), (float)std::sin(a));
+    }
+}
+
+size_t Fft::size() const {
+    return n;
+}
+
+void Fft::transform(bool inv) {
+    for (size_t i = 0; i < n; i++) {
+        if (i < rev[i]) {
+            std::swap(buf[i], buf[rev[i]]);
+        }
+    }
+    for (size_t len = 2; len <= n; len *= 2) {
+        size_t half = len / 2;
+        size_t stride = n / len;
+        for (size_t start = 0; start < n; start += len) {
+            for (size_t k = 0; k < half; k++) {
+                cfloat w = twiddles[k * stride];
+                if (inv) {
+                    w = std::conj(w);
+                }
+                cfloat t = mul(buf[start + k + half], w);
+                buf[start + k + half] = buf[start + k] - t;
+                buf[start + k] += t;
+            }
+        }
+    }
+}
+
+void Fft::forward(const float *in, cfloat *out) {
+    for (size_t i = 0; i < n; i++) {
+        buf[i] = cfloat(in[i], 0);
+    }
+    transform(false);
+    std::copy(buf.begin(), buf.begin() + n / 2 + 1, out);
+}
+
+void Fft::inverse(const cfloat *in, float *out) {
+    buf[0] = in[0];
+    buf[n / 2] = in[n / 2];
+    for (size_t k = 1; k < n / 2; k++) {
+        buf[k] = in[k];
+        buf[n - k] = std::conj(in[k]);
+    }
+    transform(true);
+    float scale = 1.f / n;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = buf[i].real() * scale;
+    }
+}
+
+static constexpr size_t BINS = EchoCancellerDSP::BLOCK + 1;
+
+EchoCancellerDSP::EchoCancellerDSP(size_t tailMs)
+    : parts(std::max<size_t>(1, (tailMs * SAMPLE_RATE / 1000 + BLOCK - 1) / BLOCK)),
+      // the reference may lead the capture by the tail, plus a frame written at once
+      farRing(parts * BLOCK + 2 * MAX_FRAME_SIZE), downmix(MAX_FRAME_SIZE), fft(2 * BLOCK),
+      xs(parts * BINS), ws(parts * BINS), farPeaks(parts), xTime(2 * BLOCK), tmp(2 * BLOCK),
+      spec(BINS), errSpec(BINS), norm(BINS), inBlock(BLOCK), outBlock(BLOCK) {}
+
+void EchoCancellerDSP::farEnd(const float *data, size_t frames, int channels) {
+    if (channels == 1) {
+        farRing.write(data, frames);
+        return;
+    }
+    while (frames > 0) {
+        size_t n = std::min(frames, downmix.size());
+        for (size_t i = 0; i < n; i++) {
+            float sum = 0;
+            for (int c = 0; c < channels; c++) {
+                sum += data[i * channels + c];
+            }
+            downmix[i] = sum / channels;
+        }
+        farRing.write(downmix.data(), n);
+        data += n * channels;
+        frames -= n;
+    }
+}
+
+void EchoCancellerDSP::readFarEnd(float *dst) {
+    // the echo of anything older than the tail is not modelled anyway, catch up
+    size_t maxLead = parts * BLOCK + MAX_FRAME_SIZE;
+    while (farRing.readable() > maxLead) {
+        farRing.read(dst, std::min(BLOCK, farRing.readable() - maxLead));
+    }
+    size_t got = farRing.read(dst, BLOCK);
+    // nothing played
+    std::fill(dst + got, dst + BLOCK, 0.f);
+}
+
+void EchoCancellerDSP::resetFilter() {
+    std::fill(ws.begin(), ws.end(), cfloat(0, 0));
+}
+
+void EchoCancellerDSP::processBlock(const float *mic, float *out) {
+    // the far-end spectrum of the previous and the current block
+    std::copy(xTime.begin() + BLOCK, xTime.end(), xTime.begin());
+    readFarEnd(xTime.data() + BLOCK);
+    xPos = (xPos + parts - 1) % parts;
+    farPeaks[xPos] = simd::peak(xTime.data() + BLOCK, BLOCK);
+    fft.forward(xTime.data(), &xs[xPos * BINS]);
+
+    // echo estimate, the partition p is the far end delayed by p blocks
+    std::fill(spec.begin(), spec.end(), cfloat(0, 0));
+    std::fill(norm.begin(), norm.end(), 0.f);
+    for (size_t p = 0; p < parts; p++) {
+        const cfloat *x = &xs[((xPos + p) % parts) * BINS];
+        const cfloat *w = &ws[p * BINS];
+        for (size_t k = 0; k < BINS; k++) {
+            spec[k] += mul(w[k], x[k]);
+            norm[k] += std::norm(x[k]);
+        }
+    }
+    fft.inverse(spec.data(), tmp.data());
+    for (size_t i = 0; i < BLOCK; i++) {
+        out[i] = mic[i] - tmp[BLOCK + i];
+    }
+
+    float farPeak = *std::max_element(farPeaks.begin(), farPeaks.end());
+    if (farPeak < FAR_SILENCE) {
+        std::copy(mic, mic + BLOCK, out); // nothing to cancel, save the adaptation
+        return;
+    }
+    float micPow = simd::rms(mic, BLOCK);
+    float errPow = simd::rms(out, BLOCK);
+    micPow *= micPow;
+    errPow *= errPow;
+    if (errPow > DIVERGENCE * micPow + 1e-9f) {
+        resetFilter();
+        std::copy(mic, mic + BLOCK, out);
+        errPow = micPow;
+    }
+
+    if (simd::peak(mic, BLOCK) > GEIGEL_RATIO * farPeak) {
+        dtHold = DOUBLE_TALK_HOLD;
+    }
+    if (dtHold > 0) {
+        dtHold--;
+        return;
+    }
+
+    // measured while only the far end talks
+    micEnergy += micPow;
+    errEnergy += errPow;
+    if (++statBlocks == ERLE_BLOCKS) {
+        erleDb = (float)(10 * std::log10((micEnergy + 1e-12) / (errEnergy + 1e-12)));
+        micEnergy = errEnergy = 0;
+        statBlocks = 0;
+    }
+
+    // gradient of the error, the first half of the overlap-save block is the discarded part
+    std::fill(tmp.begin(), tmp.begin() + BLOCK, 0.f);
+    std::copy(out, out + BLOCK, tmp.begin() + BLOCK);
+    fft.forward(tmp.data(), errSpec.data());
+    for (size_t k = 0; k < BINS; k++) {
+        errSpec[k] *= STEP / (norm[k] + REGULARIZATION);
+    }
+    for (size_t p = 0; p < parts; p++) {
+        const cfloat *x = &xs[((xPos + p) % parts) * BINS];
+        cfloat *w = &ws[p * BINS];
+        for (size_t k = 0; k < BINS; k++) {
+            w[k] += mulConj(x[k], errSpec[k]);
+        }
+    }
+
+    // keep one partition a linear (not circular) convolution, in turn
+    cfloat *w = &ws[constrainPart * BINS];
+    fft.inverse(w, tmp.data());
+    std::fill(tmp.begin() + BLOCK, tmp.end(), 0.f);
+    fft.forward(tmp.data(), w);
+    constrainPart = (constrainPart + 1) % parts;
+}
+
+void EchoCancellerDSP::process(Frame &frame) {
+    if (!state) {
+        return;
+    }
+    size_t i = 0;
+    while (i < frame.size()) {
+        size_t n = std::min(BLOCK - blockPos, frame.size() - i);
+        std::memcpy(&inBlock[blockPos], frame.data() + i, n * sizeof(float));
+        std::memcpy(frame.data() + i, &outBlock[blockPos], n * sizeof(float));
+        blockPos += n;
+        i += n;
+        if (blockPos == BLOCK) {
+            blockPos = 0;
+            processBlock(inBlock.data(), outBlock.data());
+        }
+    }
+}
+
+void EchoCancellerDSP::on() {
+    state = true;
+}
+
+void EchoCancellerDSP::off() {
+    state = false;
+}
+
+bool EchoCancellerDSP::getState() {
+    return state;
+}
+
+float EchoCancellerDSP::erle() const {
+    return erleDb;
+}
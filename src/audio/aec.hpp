@@ -0,0 +1,89 @@
+#pragma once
+
+#include "audio.hpp"
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+namespace aud {
+
+// Radix-2 FFT of real signals, the spectra are the n / 2 + 1 non-negative frequency bins.
+class Fft {
+  public:
+    explicit Fft(size_t n); // a power of two
+    void forward(const float *in, std::complex<float> *out);
+    // scaled by 1 / n, so inverse(forward(x)) == x
+    void inverse(const std::complex<float> *in, float *out);
+    size_t size() const;
+
+  private:
+    void transform(bool inv);
+
+    const size_t n;
+    std::vector<size_t> rev;
+    std::vector<std::complex<float>> twiddles;
+    std::vector<std::complex<float>> buf;
+};
+
+// Acoustic echo canceller: subtracts what the speakers play from the captured frames.
+// A partitioned-block frequency-domain adaptive filter (overlap-save, NLMS normalized per bin)
+// models the echo path as long as the tail; the gradient constraint is applied to one partition
+// per block in turn, so a block costs 5 FFTs whatever the tail is.
+// The adaptation freezes while the near end talks louder than the far end could echo (Geigel
+// double-talk detector, the echo path is assumed to attenuate) and the filter is reset if it
+// diverges.
+// farEnd() is fed from the playback thread with what goes to the speakers (PaOutput does it, see
+// PaOutput::setEchoReference), process() runs on the capture frames at SAMPLE_RATE and should be
+// the first of the recorder's dsps. The residual echo is left to RnnoiseDSP.
+// The frames come out delayed by a block (BLOCK samples).
+class EchoCancellerDSP : public DSP {
+  public:
+    static constexpr size_t BLOCK = 128;
+
+    // tail is the longest echo path, including the output and input buffering, in ms
+    EchoCancellerDSP(size_t tailMs = 200);
+    // single producer, downmixes the interleaved frames
+    void farEnd(const float *data, size_t frames, int channels = 1);
+    void process(Frame &frame) override;
+    void on();
+    void off();
+    bool getState();
+    // echo return loss enhancement of the last second the far end talked alone, dB
+    float erle() const;
+
+  private:
+    void processBlock(const float *mic, float *out);
+    void readFarEnd(float *dst);
+    void resetFilter();
+
+    atomic<bool> state = true;
+    const size_t parts; // partitions of the filter
+    SampleRing farRing;
+    std::vector<float> downmix;
+
+    Fft fft;
+    // spectra of the last far-end blocks, the newest at xPos, and the filter, [part][bin]
+    std::vector<std::complex<float>> xs;
+    std::vector<std::complex<float>> ws;
+    size_t xPos = 0;
+    size_t constrainPart = 0;
+    size_t dtHold = 0; // blocks
+    std::vector<float> farPeaks; // per block, for the double-talk detector
+    std::vector<float> xTime;    // the previous and the current far-end block
+    std::vector<float> tmp;
+    std::vector<std::complex<float>> spec;
+    std::vector<std::complex<float>> errSpec;
+    std::vector<float> norm;
+
+    // the delay line
+    std::vector<float> inBlock;
+    std::vector<float> outBlock;
+    size_t blockPos = 0;
+
+    double micEnergy = 0;
+    double errEnergy = 0;
+    size_t statBlocks = 0;
+    atomic<float> erleDb{0};
+};
+
+} // namespace aud
@@ -1,10 +1,11 @@
 #pragma once
 
-#include "opus.h"
+#include "core.hpp"
+#include "frame.hpp"
+#include "ring.hpp"
+#include <algorithm>
 #include <atomic>
-#include <boost/circular_buffer.hpp>
-#include <boost/container/static_vector.hpp>
-#include <boost/core/span.hpp>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
 #include <cstdint>
@@ -15,39 +16,28 @@
 #include <portaudio.h>
 #include <portaudiocpp/BlockingStream.hxx>
 #include <portaudiocpp/Device.hxx>
+#include <portaudiocpp/MemFunCallbackStream.hxx>
 #include <portaudiocpp/PortAudioCpp.hxx>
 #include <rnnoise.h>
+#include <thread>
 #include <vector>
 
 namespace aud {
 
-inline constexpr int SAMPLE_RATE = 48000;
-inline constexpr size_t FRAME_SIZE = 960;
-inline constexpr size_t MAX_ENCODER_BLOCK_SIZE = 128;
-
-using boost::span;
-using boost::container::static_vector;
 using portaudio::Device;
-using std::atomic;
-using std::list;
-using std::shared_ptr;
-using std::unique_ptr;
 using Time = PaTime;
 
-using Frame = std::vector<float>;
+class Resampler;
+class EchoCancellerDSP;
 
 void initialize();
 void terminate();
 Device &getOutputDevice();
 Device &getInputDevice();
+// the rate the device runs at without the host API converting it
+int nativeRate(Device &dev);
 void reconfAll();
 
-enum class State {
-    Active,
-    Stopped,
-    Finalized,
-};
-
 class Reconfigurable {
   public:
     Reconfigurable();
@@ -56,53 +46,108 @@ class Reconfigurable {
     virtual void reconf() = 0;
 };
 
-class Controllable {
-  public:
-    virtual void start() = 0;
-    virtual void stop() = 0;
-    virtual State state() = 0;
-    virtual ~Controllable() = default;
-};
-
-class Source : public Controllable {
-  public:
-    virtual void lockState() = 0;
-    virtual void unlockState() = 0;
-    virtual void waitActive() = 0; // if src stopped, requires a state check
-    virtual int channels() const = 0;
-    virtual ~Source() = default;
-};
-
-class RawSource : public Source {
-  public:
-    virtual void read(Frame &frame) = 0;
-    virtual ~RawSource() = default;
-};
-
 class Output {
   public:
     virtual void stop() = 0;
     virtual void start() = 0;
     virtual int channels() const = 0;
     virtual void write(Frame &frame) = 0;
+    // frames that can be written without waiting
+    virtual size_t writable() const = 0;
+    virtual size_t frameSize() const = 0; // samples per channel
     virtual ~Output() = default;
 };
 
+enum class Latency {
+    Low,  // device's defaultLowOutputLatency
+    High, // device's defaultHighOutputLatency
+};
+
+// Callback-mode output. write() queues the frame into a lock-free ring that is drained by the
+// PortAudio callback. While the ring is full write() waits for the callback to make room; the
+// callback never takes a lock and only signals when a writer is waiting.
+// The device is opened at its native rate, the frames are resampled in write() if it is not
+// SAMPLE_RATE. reconf() takes the rate of the new default device; a write() in progress is
+// dropped.
 class PaOutput : public Output, public Reconfigurable {
   public:
-    PaOutput(int channels);
+    PaOutput(
+        int channels,
+        Latency latency = Latency::Low,
+        FrameDuration dur = FrameDuration::Ms20
+    );
+    ~PaOutput();
     void stop() override;
     void start() override;
     int channels() const override;
     void write(Frame &frame) override;
+    size_t writable() const override;
+    size_t frameSize() const override;
     void reconf() override;
+    uint64_t underruns() const;
+    // the written frames are also fed to the echo canceller as its far end; while stopped
+    void setEchoReference(shared_ptr<EchoCancellerDSP> aec);
 
   private:
-    std::mutex mux;
+    void setRate(int deviceRate);
+    void open();
+    int callback(
+        const void *input,
+        void *output,
+        unsigned long frameCount,
+        const PaStreamCallbackTimeInfo *timeInfo,
+        PaStreamCallbackFlags statusFlags
+    );
+
+    std::mutex mux;              // start/stop/reconf only
+    mutable std::mutex writeMux; // write/writable against a reconf() changing the rate
     const int chans;
-    portaudio::BlockingStream stream;
+    const Latency latency;
+    const size_t frameLen;
+    int rate;              // of the device
+    size_t deviceFrameLen; // a frame at the device rate, at most
+    unique_ptr<Resampler> rs;
+    std::vector<float> converted;
+    shared_ptr<EchoCancellerDSP> echoRef;
+    unique_ptr<SampleRing> ring;
+    atomic<bool> running{false};
+    atomic<bool> primed{false};
+    atomic<uint64_t> underrunCnt{0};
+    std::mutex roomMux;
+    std::condition_variable roomCv;
+    atomic<bool> waiting{false}; // a write() waits for room
+    portaudio::MemFunCallbackStream<PaOutput> stream;
+};
+
+class Player;
+
+// The only thread that moves audio from sources to outputs. It wakes up a few times per frame and
+// tops up every output that has room with frames from the sources that have them ready, so the
+// pace is set by the output devices and nothing waits on a single slow source.
+// The players are serviced outside of the lock of the list, add() and remove() do not wait for
+// the sources. A player whose source throws is skipped for the round, the others go on.
+class AudioEngine {
+  public:
+    static AudioEngine &instance();
+    void start();
+    void stop();
+    void add(Player *player);
+    // the engine does not touch the player after the return, it waits if it is being serviced
+    void remove(Player *player);
+
+  private:
+    void loop();
+    std::chrono::microseconds period();
+
+    std::mutex mux;
+    std::condition_variable serviced;
+    std::vector<Player *> players;
+    Player *current = nullptr; // being serviced
+    std::thread thread;
+    atomic<bool> running{false};
 };
 
+// Serviced by the AudioEngine, endOfSourceCallback is called from its thread.
 class Player : public Controllable {
   public:
     Player(shared_ptr<RawSource> src, shared_ptr<Output> out);
@@ -115,23 +160,23 @@ class Player : public Controllable {
     std::function<void()> endOfSourceCallback;
 
   private:
+    friend class AudioEngine;
+
     struct PlayerData {
-        bool deleteFlag = false;
         atomic<float> volume = 1; // 100%
         shared_ptr<RawSource> src;
         shared_ptr<Output> out;
-        std::mutex waitThreadStart;
+        bool outStarted = false;
+        bool finished = false;
+        Frame buf;
     };
     std::shared_ptr<PlayerData> d;
-    void playerThread();
-};
-
-class DSP {
-  public:
-    virtual void process(Frame &frame) = 0;
-    virtual ~DSP() = default;
+    // returns true when the source has just been finalized
+    bool service();
 };
 
+// Frames shorter than the 10 ms rnnoise block are collected into a block and come out delayed
+// by it.
 class RnnoiseDSP : public DSP {
   public:
     RnnoiseDSP(const char * modelFileName = nullptr);
@@ -143,24 +188,28 @@ class RnnoiseDSP : public DSP {
 
   private:
     atomic<bool> state = true;
+    float processBlock(float *block);
+
     DenoiseState *handler;
     RNNModel *model = nullptr;
     std::vector<uint8_t> model_buf;
+    // the delay line for the short frames
+    std::vector<float> inBlock;
+    std::vector<float> outBlock;
+    size_t blockPos = 0;
+    float blockVad = 0;
 };
 
-class VolumeDSP : public DSP {
-  public:
-    void process(Frame &frame) override;
-    void set(float val); // 0 - 100 or more for amplification
-    float get();
-    
-  private:
-    atomic<float> val{1};
+enum class CaptureMode {
+    Blocking, // read() reads the device directly, at SAMPLE_RATE
+    Callback, // the device callback fills a ring, the DSP thread drains it through the dsps and
+              // read() takes the processed frames; the device runs at its native rate and the
+              // callback resamples it
 };
 
 class Recorder : public RawSource, public Reconfigurable {
   public:
-    Recorder();
+    Recorder(CaptureMode mode = CaptureMode::Callback, FrameDuration dur = FrameDuration::Ms20);
     ~Recorder();
     void lockState() override;
     void unlockState() override;
@@ -169,36 +218,62 @@ class Recorder : public RawSource, public Reconfigurable {
     void read(Frame &frame) override;
     State state() override;
     void waitActive() override;
+    bool ready() override;
     int channels() const override;
     void reconf() override;
+    // samples lost because the DSP thread did not keep up with the device or read() with the DSP
+    // thread, callback mode only
+    uint64_t overflows() const;
+    // while stopped
+    void setFrameDuration(FrameDuration dur);
+    size_t frameSize() const; // samples per channel
     list<shared_ptr<DSP>> dsps;
 
   private:
+    // a frame in the processed ring
+    struct Processed {
+        uint32_t gen; // startGen of the capture
+        uint32_t len;
+        float vad;
+    };
+
     void setState(State state);
+    void open();
+    void dspLoop();
+    void setRate(int deviceRate);
+    portaudio::Stream &stream();
+    int callback(
+        const void *input,
+        void *output,
+        unsigned long frameCount,
+        const PaStreamCallbackTimeInfo *timeInfo,
+        PaStreamCallbackFlags statusFlags
+    );
+
     std::mutex stateMux;
     std::condition_variable cv;
     atomic<State> st;
-    portaudio::BlockingStream stream;
+    const CaptureMode mode;
+    atomic<size_t> frameLen;
+    int rate; // of the device, callback mode follows it on reconf()
+    unique_ptr<Resampler> rs;
+    std::vector<float> converted;
+    SampleRing ring;
+    atomic<uint64_t> overflowCnt{0};
+    atomic<uint32_t> startGen{0};
+    // the DSP stage between the callback and read()
+    std::mutex dspMux;
+    std::condition_variable dspCv;
+    atomic<bool> dspWaiting{false};
+    SampleRing processed;
+    SpscRing<Processed> processedInfo;
+    std::mutex readyMux;
+    std::condition_variable readyCv;
+    std::thread dspThread;
+    portaudio::BlockingStream blockingStream;
+    portaudio::MemFunCallbackStream<Recorder> callbackStream;
 };
 
 extern shared_ptr<Recorder> mic;
 
-class NetBuf {
-  public:
-    NetBuf(size_t depth = 3, int channels = 1);
-    ~NetBuf();
-    void push(span<uint8_t> pack);
-    void read(Frame &frame);
-
-  private:
-    size_t depth;
-    int chans;
-    boost::circular_buffer<static_vector<uint8_t, MAX_ENCODER_BLOCK_SIZE>> buf;
-    OpusDecoder *dec;
-    std::mutex mux;
-    std::condition_variable waitRead;
-    std::condition_variable waitWrite;
-    Frame frameBuf;
-};
-
 } // namespace aud
\ No newline at end of file
@@ -7,8 +7,9 @@
 
 using namespace aud;
 
-BufSrc::BufSrc(float buf[], size_t size, int channels) : buf(buf), size(size), chans(channels) {
-    assert(size % FRAME_SIZE == 0);
+BufSrc::BufSrc(float buf[], size_t size, int channels, FrameDuration dur)
+    : buf(buf), size(size), chans(channels), frameLen(frameSize(dur)) {
+    assert(size % (frameLen * chans) == 0);
 }
 
 void BufSrc::start() {
@@ -48,17 +49,21 @@ void BufSrc::waitActive() {
     }
 }
 
+bool BufSrc::ready() {
+    return true;
+}
+
 int BufSrc::channels() const {
     return chans;
 }
 
 void BufSrc::read(Frame &frame) {
     std::lock_guard<std::mutex> lg(mux);
-    frame.resize(FRAME_SIZE * chans);
+    frame.resize(frameLen * chans);
     if (played < size) {
-        std::memcpy(frame.data(), buf + played, FRAME_SIZE * chans * sizeof(float));
-        played += FRAME_SIZE * chans;
+        std::memcpy(frame.data(), buf + played, frameLen * chans * sizeof(float));
+        played += frameLen * chans;
     } else {
-        memset(frame.data(), 0, sizeof(float) * FRAME_SIZE * chans);
+        memset(frame.data(), 0, sizeof(float) * frameLen * chans);
     }
 }
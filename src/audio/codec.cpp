@@ -1,44 +1,46 @@
 #include "codec.hpp"
-#include "audio.hpp"
+#include "core.hpp"
 #include "opus.h"
 #include "opus_defines.h"
+#include "simd.hpp"
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <tuple>
 
 using namespace aud;
 
-OpusException::OpusException(int error) throw() : err(error) {}
+CodecException::CodecException(int error) throw() : err(error) {}
 
-int OpusException::Error() const {
+int CodecException::Error() const {
     return err;
 }
 
-const char *OpusException::ErrorText() const {
+const char *CodecException::ErrorText() const {
     return opus_strerror(err);
 }
 
-const char *OpusException::what() const throw() {
+const char *CodecException::what() const throw() {
     return ErrorText();
 }
 
-bool OpusException::operator==(const OpusException &rhs) const {
+bool CodecException::operator==(const CodecException &rhs) const {
     return err == rhs.err;
 }
 
-bool OpusException::operator!=(const OpusException &rhs) const {
+bool CodecException::operator!=(const CodecException &rhs) const {
     return err != rhs.err;
 }
 
-OpusEnc::OpusEnc(EncoderPreset ep, int channels) {
+OpusEnc::OpusEnc(EncoderPreset ep, int channels) : chans(channels) {
     int application;
     int bitrate;
     if (ep == EncoderPreset::Voise) {
         application = OPUS_APPLICATION_VOIP;
-        bitrate = 24576; // bit/s
+        bitrate = VOISE_BITRATE;
     } else {
         application = OPUS_APPLICATION_AUDIO;
-        bitrate = 98304;
+        bitrate = SOUNDS_BITRATE;
     }
     int err;
     enc = opus_encoder_create(aud::SAMPLE_RATE, channels, application, &err);
@@ -66,9 +68,36 @@ OpusEnc::~OpusEnc() {
     opus_encoder_destroy(enc);
 }
 
+static void check(int err) {
+    if (err < 0) {
+        throw OpusException(err);
+    }
+}
+
 void OpusEnc::encode(Frame &in, std::vector<uint8_t> &out, size_t max_size) {
+    // the settings from the other threads, -1 if unchanged
+    if (int perc = pendingLossPerc.exchange(-1); perc >= 0) {
+        check(opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(perc)));
+    }
+    if (int dtx = pendingDtx.exchange(-1); dtx >= 0) {
+        check(opus_encoder_ctl(enc, OPUS_SET_DTX(dtx)));
+    }
+    if (int bitrate = pendingBitrate.exchange(-1); bitrate >= 0) {
+        check(opus_encoder_ctl(enc, OPUS_SET_BITRATE(bitrate)));
+    }
+    if (int fec = pendingFec.exchange(-1); fec >= 0) {
+        check(opus_encoder_ctl(enc, OPUS_SET_INBAND_FEC(fec)));
+    }
+    if (int bw = pendingMaxBandwidth.exchange(-1); bw >= 0) {
+        check(opus_encoder_ctl(enc, OPUS_SET_MAX_BANDWIDTH(bw)));
+    }
+    // any of the Opus frame durations
+    int samples = (int)(in.size() / chans);
+    if (!max_size) {
+        max_size = maxEncoderBlockSize(samples);
+    }
     out.resize(max_size);
-    int n_or_err = opus_encode_float(enc, in.data(), FRAME_SIZE, out.data(), (int32_t)max_size);
+    int n_or_err = opus_encode_float(enc, in.data(), samples, out.data(), (int32_t)max_size);
     if (n_or_err < 0) {
         throw OpusException(n_or_err);
     }
@@ -76,55 +105,357 @@ void OpusEnc::encode(Frame &in, std::vector<uint8_t> &out, size_t max_size) {
 }
 
 void OpusEnc::setPacketLossPrec(int perc) {
-    int err = opus_encoder_ctl(enc, OPUS_SET_PACKET_LOSS_PERC(perc));
-    if (err < 0) {
+    assert(0 <= perc && perc <= 100);
+    pendingLossPerc = perc;
+}
+
+void OpusEnc::setDtx(bool on) {
+    pendingDtx = on;
+}
+
+void OpusEnc::setBitrate(int bitrate) {
+    assert(bitrate > 0);
+    pendingBitrate = bitrate;
+}
+
+void OpusEnc::setFec(bool on) {
+    pendingFec = on;
+}
+
+void OpusEnc::setMaxBandwidth(int bandwidth) {
+    assert(OPUS_BANDWIDTH_NARROWBAND <= bandwidth && bandwidth <= OPUS_BANDWIDTH_FULLBAND);
+    pendingMaxBandwidth = bandwidth;
+}
+
+OpusDec::OpusDec(int channels) : chans(channels) {
+    int err;
+    dec = opus_decoder_create(SAMPLE_RATE, channels, &err);
+    if (err != OPUS_OK) {
         throw OpusException(err);
     }
 }
 
-void OpusEncSrc::setPacketLossPrec(int perc) {
+OpusDec::~OpusDec() {
+    opus_decoder_destroy(dec);
+}
+
+void OpusDec::decode(span<const uint8_t> pack, Frame &frame, size_t frameLen, bool fec) {
+    if (!pack.empty()) {
+        int n = opus_packet_get_nb_samples(pack.data(), (int32_t)pack.size(), SAMPLE_RATE);
+        if (n < 0) {
+            throw OpusException(n);
+        }
+        frameLen = n;
+    }
+    if (frameLen > MAX_FRAME_SIZE) {
+        throw OpusException(OPUS_BUFFER_TOO_SMALL);
+    }
+    frame.resize(frameLen * chans);
+    int n_or_err = opus_decode_float(
+        dec,
+        pack.empty() ? nullptr : pack.data(),
+        (int32_t)pack.size(),
+        frame.data(),
+        (int)frameLen,
+        fec
+    );
+    if (n_or_err < 0) {
+        throw OpusException(n_or_err);
+    }
+    frame.resize(n_or_err * chans);
+}
+
+PlainDec::PlainDec(int channels) : chans(channels) {}
+
+void PlainDec::conceal(Frame &frame, size_t frameLen) {
+    frame.resize(frameLen * chans);
+    last.resize(frame.size());
+    gain *= CONCEAL_FADE;
+    for (size_t i = 0; i < frame.size(); i++) {
+        frame[i] = last[i] * gain;
+    }
+}
+
+void PlainDec::keep(const Frame &frame) {
+    last.assign(frame.begin(), frame.end());
+    gain = 1;
+}
+
+Pcm16Enc::Pcm16Enc(EncoderPreset, int channels) : chans(channels) {}
+
+void Pcm16Enc::encode(Frame &in, std::vector<uint8_t> &out, size_t max_size) {
+    if (in.size() * 2 > max_size) {
+        throw CodecException(OPUS_BUFFER_TOO_SMALL);
+    }
+    pcm.resize(in.size());
+    simd::toS16(in.data(), pcm.data(), in.size());
+    out.resize(in.size() * 2);
+    for (size_t i = 0; i < pcm.size(); i++) {
+        out[2 * i] = (uint8_t)pcm[i];
+        out[2 * i + 1] = (uint8_t)((uint16_t)pcm[i] >> 8);
+    }
+}
+
+Pcm16Dec::Pcm16Dec(int channels) : PlainDec(channels) {}
+
+void Pcm16Dec::decode(span<const uint8_t> pack, Frame &frame, size_t frameLen, bool fec) {
+    if (pack.empty() || fec) {
+        conceal(frame, frameLen);
+        return;
+    }
+    size_t samples = pack.size() / 2;
+    if (pack.size() % (2 * chans) || samples / chans > MAX_FRAME_SIZE) {
+        throw CodecException(OPUS_INVALID_PACKET);
+    }
+    pcm.resize(samples);
+    for (size_t i = 0; i < samples; i++) {
+        pcm[i] = (int16_t)(pack[2 * i] | pack[2 * i + 1] << 8);
+    }
+    frame.resize(samples);
+    simd::fromS16(pcm.data(), frame.data(), samples);
+    keep(frame);
+}
+
+AdpcmEnc::AdpcmEnc(EncoderPreset, int channels) : chans(channels) {}
+
+void AdpcmEnc::encode(Frame &in, std::vector<uint8_t> &out, size_t max_size) {
+    size_t samples = in.size();
+    if (samples % simd::ADPCM_LANES) {
+        throw CodecException(OPUS_BAD_ARG);
+    }
+    if (HEADER_SIZE + samples / 2 > max_size) {
+        throw CodecException(OPUS_BUFFER_TOO_SMALL);
+    }
+    size_t frameLen = samples / chans;
+    size_t n = samples / simd::ADPCM_LANES;
+    pcm.resize(samples);
+    simd::toS16(in.data(), pcm.data(), samples);
+    const int16_t *blocks = pcm.data();
+    if (chans > 1) {
+        planar.resize(samples);
+        for (size_t i = 0; i < frameLen; i++) {
+            for (int c = 0; c < chans; c++) {
+                planar[c * frameLen + i] = pcm[i * chans + c];
+            }
+        }
+        blocks = planar.data();
+    }
+    // a lane goes on from its own block of the last frame, that is elsewhere in the signal; the
+    // predictor starts over at the sample before the block, the step is likely the same
+    tail.resize(chans);
+    for (size_t k = 0; k < simd::ADPCM_LANES; k++) {
+        size_t at = k * n;
+        st.pred[k] = at % frameLen ? blocks[at - 1] : tail[at / frameLen];
+    }
+    for (int c = 0; c < chans; c++) {
+        tail[c] = blocks[(c + 1) * frameLen - 1];
+    }
+    out.resize(HEADER_SIZE + samples / 2);
+    for (size_t k = 0; k < simd::ADPCM_LANES; k++) {
+        out[3 * k] = (uint8_t)st.pred[k];
+        out[3 * k + 1] = (uint8_t)((uint32_t)st.pred[k] >> 8);
+        out[3 * k + 2] = (uint8_t)st.index[k];
+    }
+    simd::adpcmEncode(blocks, n, st, out.data() + HEADER_SIZE);
+}
+
+AdpcmDec::AdpcmDec(int channels) : PlainDec(channels) {}
+
+void AdpcmDec::decode(span<const uint8_t> pack, Frame &frame, size_t frameLen, bool fec) {
+    if (pack.empty() || fec) {
+        conceal(frame, frameLen);
+        return;
+    }
+    if (pack.size() <= AdpcmEnc::HEADER_SIZE) {
+        throw CodecException(OPUS_INVALID_PACKET);
+    }
+    size_t samples = (pack.size() - AdpcmEnc::HEADER_SIZE) * 2;
+    frameLen = samples / chans;
+    if (samples % simd::ADPCM_LANES || samples % chans || frameLen > MAX_FRAME_SIZE) {
+        throw CodecException(OPUS_INVALID_PACKET);
+    }
+    simd::AdpcmState st;
+    for (size_t k = 0; k < simd::ADPCM_LANES; k++) {
+        st.pred[k] = (int16_t)(pack[3 * k] | pack[3 * k + 1] << 8);
+        st.index[k] = pack[3 * k + 2];
+        if (st.index[k] > simd::ADPCM_MAX_INDEX) {
+            throw CodecException(OPUS_INVALID_PACKET);
+        }
+    }
+    planar.resize(samples);
+    simd::adpcmDecode(
+        pack.data() + AdpcmEnc::HEADER_SIZE,
+        samples / simd::ADPCM_LANES,
+        st,
+        planar.data()
+    );
+    const int16_t *interleaved = planar.data();
+    if (chans > 1) {
+        pcm.resize(samples);
+        for (size_t i = 0; i < frameLen; i++) {
+            for (int c = 0; c < chans; c++) {
+                pcm[i * chans + c] = planar[c * frameLen + i];
+            }
+        }
+        interleaved = pcm.data();
+    }
+    frame.resize(samples);
+    simd::fromS16(interleaved, frame.data(), samples);
+    keep(frame);
+}
+
+StreamDec::StreamDec(int channels) : decs(channels, channels, channels) {}
+
+void StreamDec::decode(
+    PayloadType type,
+    span<const uint8_t> pack,
+    Frame &frame,
+    size_t frameLen,
+    bool fec
+) {
+    if (fec && !hasFec(type)) {
+        pack = {};
+        fec = false;
+    }
+    if (pack.empty()) {
+        type = last;
+    } else {
+        last = type;
+    }
+    withCodec(type, [&](auto codec) {
+        std::get<typename decltype(codec)::Decoder>(decs).decode(pack, frame, frameLen, fec);
+    });
+}
+
+template <typename Codec> void CodecEncSrc<Codec>::setPacketLossPrec(int perc) {
     enc.setPacketLossPrec(perc);
+    if (low) {
+        low->setPacketLossPrec(perc);
+    }
+}
+
+template <typename Codec> void CodecEncSrc<Codec>::setBitrate(int bitrate) {
+    enc.setBitrate(bitrate);
+}
+
+template <typename Codec> void CodecEncSrc<Codec>::setFec(bool on) {
+    enc.setFec(on);
+    if (low) {
+        low->setFec(on);
+    }
+}
+
+template <typename Codec> void CodecEncSrc<Codec>::setSimulcast(int lowBitrate, int lowBandwidth) {
+    low = std::make_unique<Encoder>(preset, src->channels());
+    low->setBitrate(lowBitrate);
+    low->setMaxBandwidth(lowBandwidth);
+    low->setDtx(gateThreshold > 0);
+}
+
+template <typename Codec> void CodecEncSrc<Codec>::setVadGate(float threshold, size_t hangover) {
+    assert(0 <= threshold && threshold <= 1);
+    gateHangover = hangover;
+    gateThreshold = threshold;
+    enc.setDtx(threshold > 0);
+    if (low) {
+        low->setDtx(threshold > 0);
+    }
 }
 
-OpusEncSrc::OpusEncSrc(shared_ptr<RawSource> src, EncoderPreset ep)
-    : enc(ep, src->channels()), src(src) {
+template <typename Codec> uint64_t CodecEncSrc<Codec>::gated() const {
+    return gatedCnt;
+}
+
+template <typename Codec>
+CodecEncSrc<Codec>::CodecEncSrc(shared_ptr<RawSource> src, EncoderPreset ep)
+    : preset(ep), enc(ep, src->channels()), src(src) {
     assert(src);
 }
 
-void OpusEncSrc::encode(std::vector<uint8_t> &block) {
+template <typename Codec> void CodecEncSrc<Codec>::encode(std::vector<uint8_t> &block) {
+    src->read(buf);
+    if (gate() || !encodeWith(enc, block)) {
+        block.clear();
+        gatedCnt++;
+    }
+}
+
+template <typename Codec>
+void CodecEncSrc<Codec>::encode(std::vector<uint8_t> &block, std::vector<uint8_t> &lowBlock) {
+    assert(low);
     src->read(buf);
-    enc.encode(buf, block);
+    if (gate()) {
+        block.clear();
+        lowBlock.clear();
+        gatedCnt++;
+        return;
+    }
+    // the layers go DTX on their own, the frame is gated if both do
+    bool sent = encodeWith(enc, block);
+    sent |= encodeWith(*low, lowBlock);
+    if (!sent) {
+        gatedCnt++;
+    }
+}
+
+// whether the frame in buf is held back by the gate
+template <typename Codec> bool CodecEncSrc<Codec>::gate() {
+    float threshold = gateThreshold;
+    if (threshold <= 0) {
+        return false;
+    }
+    silentFrames = buf.vad < threshold ? silentFrames + 1 : 0;
+    return silentFrames > gateHangover;
+}
+
+// false if the block is not to be sent
+template <typename Codec>
+bool CodecEncSrc<Codec>::encodeWith(Encoder &e, std::vector<uint8_t> &block) {
+    e.encode(buf, block);
+    if (gateThreshold > 0 && block.size() <= 2) {
+        block.clear(); // DTX frame, it need not be transmitted
+        return false;
+    }
+    return true;
 }
 
-void OpusEncSrc::lockState() {
+template <typename Codec> void CodecEncSrc<Codec>::lockState() {
     src->lockState();
 }
 
-void OpusEncSrc::unlockState() {
+template <typename Codec> void CodecEncSrc<Codec>::unlockState() {
     src->unlockState();
 }
 
-void OpusEncSrc::start() {
+template <typename Codec> void CodecEncSrc<Codec>::start() {
     src->start();
 }
 
-void OpusEncSrc::stop() {
+template <typename Codec> void CodecEncSrc<Codec>::stop() {
     src->stop();
 }
 
-State OpusEncSrc::state() {
+template <typename Codec> State CodecEncSrc<Codec>::state() {
     return src->state();
 }
 
-void OpusEncSrc::waitActive() {
+template <typename Codec> void CodecEncSrc<Codec>::waitActive() {
     src->waitActive();
 }
 
-int OpusEncSrc::channels() const {
+template <typename Codec> bool CodecEncSrc<Codec>::ready() {
+    return src->ready();
+}
+
+template <typename Codec> int CodecEncSrc<Codec>::channels() const {
     int ch = src->channels();
     return ch;
 }
 
+template class aud::CodecEncSrc<Opus>;
+template class aud::CodecEncSrc<Pcm16>;
+template class aud::CodecEncSrc<Adpcm>;
+
 OpusDecSrc::OpusDecSrc(shared_ptr<EncodedSource> src) : src(src) {
     assert(src);
     int err;
@@ -138,43 +469,68 @@ OpusDecSrc::~OpusDecSrc() {
     opus_decoder_destroy(dec);
 }
 
+// the frames follow the durations of the packets, the losses are as long as the last one
+void OpusDecSrc::updateFrameLen(const std::vector<uint8_t> &pack) {
+    int n = opus_packet_get_nb_samples(pack.data(), (int32_t)pack.size(), SAMPLE_RATE);
+    if (n < 0) {
+        throw OpusException(n);
+    }
+    assert((size_t)n <= MAX_FRAME_SIZE);
+    frameLen = n;
+}
+
 void OpusDecSrc::readLoss(Frame &frame) {
-    frame.resize(FRAME_SIZE * src->channels());
-    int n_or_err = opus_decode_float(dec, nullptr, 0, frame.data(), FRAME_SIZE, 0);
+    frame.resize(frameLen * src->channels());
+    int n_or_err = opus_decode_float(dec, nullptr, 0, frame.data(), (int)frameLen, 0);
     if (n_or_err < 0) {
         throw OpusException(n_or_err);
     }
-    assert((size_t)n_or_err == FRAME_SIZE * src->channels() && "decoder must return full frame");
+    assert((size_t)n_or_err == frameLen && "decoder must return full frame");
 }
 
 void OpusDecSrc::readNormal(Frame &frame) {
-    frame.resize(FRAME_SIZE * src->channels());
+    updateFrameLen(buf);
+    frame.resize(frameLen * src->channels());
     int n_or_err =
-        opus_decode_float(dec, buf.data(), (int32_t)buf.size(), frame.data(), FRAME_SIZE, 0);
+        opus_decode_float(dec, buf.data(), (int32_t)buf.size(), frame.data(), (int)frameLen, 0);
     if (n_or_err < 0) {
         throw OpusException(n_or_err);
     }
-    assert((size_t)n_or_err == FRAME_SIZE * src->channels() && "decoder must return full frame");
+    assert((size_t)n_or_err == frameLen && "decoder must return full frame");
 }
 
 void OpusDecSrc::readFeh(Frame &frame) {
-    frame.resize(FRAME_SIZE * src->channels());
-    int n_or_err =
-        opus_decode_float(dec, fehBuf.data(), (int32_t)fehBuf.size(), frame.data(), FRAME_SIZE, 1);
+    updateFrameLen(fehBuf); // the lost frame is as long as the next one
+    frame.resize(frameLen * src->channels());
+    int n_or_err = opus_decode_float(
+        dec,
+        fehBuf.data(),
+        (int32_t)fehBuf.size(),
+        frame.data(),
+        (int)frameLen,
+        1
+    );
     if (n_or_err < 0) {
         throw OpusException(n_or_err);
     }
-    assert((size_t)n_or_err == FRAME_SIZE * src->channels() && "decoder must return full frame");
+    assert((size_t)n_or_err == frameLen && "decoder must return full frame");
 }
 
 void OpusDecSrc::readNoFeh(Frame &frame) {
-    frame.resize(FRAME_SIZE * src->channels());
-    int n_or_err =
-        opus_decode_float(dec, fehBuf.data(), (int32_t)fehBuf.size(), frame.data(), FRAME_SIZE, 0);
+    updateFrameLen(fehBuf);
+    frame.resize(frameLen * src->channels());
+    int n_or_err = opus_decode_float(
+        dec,
+        fehBuf.data(),
+        (int32_t)fehBuf.size(),
+        frame.data(),
+        (int)frameLen,
+        0
+    );
     if (n_or_err < 0) {
         throw OpusException(n_or_err);
     }
-    assert((size_t)n_or_err == FRAME_SIZE * src->channels() && "decoder must return full frame");
+    assert((size_t)n_or_err == frameLen && "decoder must return full frame");
 }
 
 void OpusDecSrc::read(Frame &frame) {
@@ -231,6 +587,10 @@ void OpusDecSrc::waitActive() {
     src->waitActive();
 }
 
+bool OpusDecSrc::ready() {
+    return src->ready();
+}
+
 int OpusDecSrc::channels() const {
     int ch = src->channels();
     return ch;
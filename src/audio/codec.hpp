@@ -1,69 +1,317 @@
 #pragma once
 
-#include "audio.hpp"
+#include "core.hpp"
+#include "packet.hpp"
+#include "simd.hpp"
+#include <algorithm>
 #include <cstdint>
 #include <exception>
 #include <opus/opus.h>
+#include <tuple>
 #include <vector>
 
 namespace aud {
 
-class OpusException : std::exception {
+inline constexpr float VAD_THRESHOLD = 0.5;
+// frames sent after the voice ends, so the word endings are not cut
+inline constexpr size_t VAD_HANGOVER = 15;
+
+// What any of the codecs throws, with an OPUS_* error code; catch this one for all of them.
+class CodecException : public std::exception {
   public:
-    OpusException(int error) throw();
+    CodecException(int error) throw();
     const char *what() const throw();
     int Error() const;
     const char *ErrorText() const;
-    bool operator==(const OpusException &rhs) const;
-    bool operator!=(const OpusException &rhs) const;
+    bool operator==(const CodecException &rhs) const;
+    bool operator!=(const CodecException &rhs) const;
 
   private:
     int err;
 };
 
+// the errors of libopus
+class OpusException : public CodecException {
+  public:
+    using CodecException::CodecException;
+};
+
 enum class EncoderPreset {
     Voise,
     Sounds,
 };
 
+// initial bitrates of the presets, bit/s
+inline constexpr int VOISE_BITRATE = 24576;
+inline constexpr int SOUNDS_BITRATE = 98304;
+// the low layer of a simulcast stream (OpusEncSrc::setSimulcast), bit/s
+inline constexpr int VOISE_LOW_BITRATE = 12000;
+inline constexpr int SOUNDS_LOW_BITRATE = 32000;
+// the gain of every further frame a plain decoder conceals, the repeated frame fades out
+inline constexpr float CONCEAL_FADE = 0.5;
+
+// the bitrate of a 20 ms block of MAX_ENCODER_BLOCK_SIZE holds for the longer frames too
+inline constexpr size_t maxEncoderBlockSize(size_t frameLen) {
+    return std::max(MAX_ENCODER_BLOCK_SIZE, MAX_ENCODER_BLOCK_SIZE * frameLen / FRAME_SIZE);
+}
+
 class OpusEnc {
   public:
     OpusEnc(EncoderPreset ep, int channels);
     ~OpusEnc();
+    // may be called from any thread, applied before the next encode()
     void setPacketLossPrec(int perc);
-    void encode(Frame &in, std::vector<uint8_t> &out, size_t max_size = MAX_ENCODER_BLOCK_SIZE);
+    void setDtx(bool on);
+    void setBitrate(int bitrate); // bit/s
+    void setFec(bool on);
+    void setMaxBandwidth(int bandwidth); // OPUS_BANDWIDTH_*
+    // max_size 0 is maxEncoderBlockSize() of the frame
+    void encode(Frame &in, std::vector<uint8_t> &out, size_t max_size = 0);
 
   private:
     OpusEncoder *enc;
+    const int chans;
+    atomic<int> pendingLossPerc{-1};
+    atomic<int> pendingDtx{-1};
+    atomic<int> pendingBitrate{-1};
+    atomic<int> pendingFec{-1};
+    atomic<int> pendingMaxBandwidth{-1};
+};
+
+// The frames of a packet, concealment of frameLen if pack is empty. fec decodes the frame before
+// pack from the in-band FEC data of pack, as long as the frame of pack. The frame has the samples
+// the packet carries, whatever frameLen is.
+class OpusDec {
+  public:
+    static constexpr bool FEC = true;
+
+    explicit OpusDec(int channels);
+    ~OpusDec();
+    OpusDec(const OpusDec &) = delete;
+    OpusDec &operator=(const OpusDec &) = delete;
+    void decode(span<const uint8_t> pack, Frame &frame, size_t frameLen, bool fec = false);
+
+  private:
+    OpusDecoder *dec;
+    const int chans;
+};
+
+// The codecs without the knobs of Opus: a constant bitrate, no DTX, no FEC, the setters are no-ops.
+// They cost next to no CPU, for the LANs and the devices that have more bandwidth than cycles.
+class PlainEnc {
+  public:
+    void setPacketLossPrec(int) {}
+    void setDtx(bool) {}
+    void setBitrate(int) {}
+    void setFec(bool) {}
+    void setMaxBandwidth(int) {}
+};
+
+// Conceals a loss with the last frame, fading out by CONCEAL_FADE a frame. As with OpusDec the
+// frame has the samples the packet carries, frameLen is only the one of the concealment.
+class PlainDec {
+  public:
+    static constexpr bool FEC = false;
+
+  protected:
+    explicit PlainDec(int channels);
+    void conceal(Frame &frame, size_t frameLen);
+    void keep(const Frame &frame);
+
+    const int chans;
+
+  private:
+    std::vector<float> last;
+    float gain = 1;
+};
+
+// Raw 16-bit little-endian PCM, interleaved. 768 kbit/s a channel, so no more than 10 ms frames of
+// mono fit in MAX_PAYLOAD_SIZE.
+class Pcm16Enc : public PlainEnc {
+  public:
+    Pcm16Enc(EncoderPreset ep, int channels);
+    void encode(Frame &in, std::vector<uint8_t> &out, size_t max_size = MAX_PAYLOAD_SIZE);
+
+  private:
+    const int chans;
+    std::vector<int16_t> pcm;
+};
+
+class Pcm16Dec : public PlainDec {
+  public:
+    explicit Pcm16Dec(int channels);
+    void decode(span<const uint8_t> pack, Frame &frame, size_t frameLen, bool fec = false);
+
+  private:
+    std::vector<int16_t> pcm;
+};
+
+// IMA-ADPCM, 4 bits a sample (192 kbit/s a channel), encoded as simd::ADPCM_LANES independent
+// blocks of the frame:
+//
+//   for every lane: the predictor (int16, little-endian), the step index (u8)
+//   then the nibbles, simd::adpcmEncode()
+//
+// The channels are planar, the samples of a frame are to be a multiple of the lanes. The step
+// indexes run on from frame to frame, the predictors start at the sample before the block; the
+// packet carries both, so every packet decodes on its own.
+class AdpcmEnc : public PlainEnc {
+  public:
+    static constexpr size_t HEADER_SIZE = simd::ADPCM_LANES * 3;
+
+    AdpcmEnc(EncoderPreset ep, int channels);
+    void encode(Frame &in, std::vector<uint8_t> &out, size_t max_size = MAX_PAYLOAD_SIZE);
+
+  private:
+    const int chans;
+    simd::AdpcmState st;
+    std::vector<int16_t> tail; // the last sample of every channel
+    std::vector<int16_t> pcm;
+    std::vector<int16_t> planar;
+};
+
+class AdpcmDec : public PlainDec {
+  public:
+    explicit AdpcmDec(int channels);
+    void decode(span<const uint8_t> pack, Frame &frame, size_t frameLen, bool fec = false);
+
+  private:
+    std::vector<int16_t> pcm;
+    std::vector<int16_t> planar;
+};
+
+// The codecs, by the PayloadType of their packets. The code for any of them is a template over the
+// codec, withCodec() picks the instance of the PayloadType.
+struct Opus {
+    static constexpr PayloadType TYPE = PayloadType::Opus;
+    using Encoder = OpusEnc;
+    using Decoder = OpusDec;
+};
+
+struct Pcm16 {
+    static constexpr PayloadType TYPE = PayloadType::Pcm16;
+    using Encoder = Pcm16Enc;
+    using Decoder = Pcm16Dec;
+};
+
+struct Adpcm {
+    static constexpr PayloadType TYPE = PayloadType::Adpcm;
+    using Encoder = AdpcmEnc;
+    using Decoder = AdpcmDec;
+};
+
+inline bool isCodec(PayloadType type) {
+    return type == PayloadType::Opus || type == PayloadType::Pcm16 || type == PayloadType::Adpcm;
+}
+
+// f(Codec{}) for the codec of type, Opus for an unknown one
+template <typename F> decltype(auto) withCodec(PayloadType type, F &&f) {
+    switch (type) {
+    case PayloadType::Pcm16:
+        return f(Pcm16{});
+    case PayloadType::Adpcm:
+        return f(Adpcm{});
+    default:
+        return f(Opus{});
+    }
+}
+
+// whether the packets of type carry the FEC data of the frame before them
+inline bool hasFec(PayloadType type) {
+    return withCodec(type, [](auto codec) { return decltype(codec)::Decoder::FEC; });
+}
+
+// Decodes the packets of a stream in whatever codec each of them is. A loss is concealed by the
+// codec of the last packet, fec falls back to concealment if the codec has no FEC.
+class StreamDec {
+  public:
+    explicit StreamDec(int channels);
+    // empty pack means packet loss
+    void decode(
+        PayloadType type,
+        span<const uint8_t> pack,
+        Frame &frame,
+        size_t frameLen,
+        bool fec = false
+    );
+
+  private:
+    std::tuple<OpusDec, Pcm16Dec, AdpcmDec> decs;
+    PayloadType last = PayloadType::Opus;
 };
 
 class EncodedSource : public Source {
   public:
-    // empty block means packet loss
+    // empty block means packet loss, or nothing to send during silence if the source gates it
     virtual void encode(std::vector<uint8_t> &block) = 0;
     virtual void setPacketLossPrec(int perc) = 0;
+    virtual void setBitrate(int bitrate) = 0; // bit/s
+    virtual void setFec(bool on) = 0;
+    // of the blocks, to be put in their MediaHeader
+    virtual PayloadType type() const {
+        return PayloadType::Opus;
+    }
     virtual ~EncodedSource() = default;
 };
 
-class OpusEncSrc : public EncodedSource {
+// Encodes the frames of src with the Codec, OpusEncSrc for the default one.
+template <typename Codec> class CodecEncSrc : public EncodedSource {
   public:
-    OpusEncSrc(shared_ptr<RawSource> src, EncoderPreset ep);
+    using Encoder = typename Codec::Encoder;
+
+    CodecEncSrc(shared_ptr<RawSource> src, EncoderPreset ep);
     void lockState() override;
     void unlockState() override;
     void start() override;
     void stop() override;
     State state() override;
     void waitActive() override;
+    bool ready() override;
     int channels() const override;
     void setPacketLossPrec(int perc) override;
+    void setBitrate(int bitrate) override;
+    void setFec(bool on) override;
+    PayloadType type() const override {
+        return Codec::TYPE;
+    }
     void encode(std::vector<uint8_t> &block) override;
+    // Simulcast: a second encoder at the bitrate and the bandwidth of the low layer, over the same
+    // frames after the same DSPs. encode(block, lowBlock) returns both encodings of a frame, which
+    // are sent as the Layer::High and Layer::Low of the stream; the relay picks one of them for
+    // every receiver. setBitrate() is for the high layer only, the loss settings apply to both.
+    // The layers of a plain codec are the same, they are for Opus. To be called before start().
+    void setSimulcast(int lowBitrate, int lowBandwidth = OPUS_BANDWIDTH_WIDEBAND);
+    void encode(std::vector<uint8_t> &block, std::vector<uint8_t> &lowBlock);
+    // Silence gating: once the frame VAD (Frame::vad) stays below the threshold for longer than
+    // the hangover, the frames are not encoded and encode() returns an empty block, which is not
+    // to be sent. Also enables Opus DTX, its 1-2 byte silence packets are not returned either.
+    // 0 turns it off (default).
+    void setVadGate(float threshold, size_t hangover = VAD_HANGOVER);
+    uint64_t gated() const; // frames not sent because of the gate
 
   private:
-    OpusEnc enc;
+    bool gate();
+    bool encodeWith(Encoder &e, std::vector<uint8_t> &block);
+
+    const EncoderPreset preset;
+    Encoder enc;
+    unique_ptr<Encoder> low; // simulcast
     shared_ptr<RawSource> src;
     Frame buf;
+    atomic<float> gateThreshold{0};
+    atomic<size_t> gateHangover{VAD_HANGOVER};
+    size_t silentFrames = 0;
+    atomic<uint64_t> gatedCnt{0};
 };
 
+extern template class CodecEncSrc<Opus>;
+extern template class CodecEncSrc<Pcm16>;
+extern template class CodecEncSrc<Adpcm>;
+
+using OpusEncSrc = CodecEncSrc<Opus>;
+using Pcm16EncSrc = CodecEncSrc<Pcm16>;
+using AdpcmEncSrc = CodecEncSrc<Adpcm>;
+
 class OpusDecSrc : public RawSource {
   public:
     OpusDecSrc(shared_ptr<EncodedSource> src);
@@ -75,6 +323,7 @@ class OpusDecSrc : public RawSource {
     void read(Frame &frame) override;
     State state() override;
     void waitActive() override;
+    bool ready() override;
     int channels() const override;
     std::mutex stateMux;
 
@@ -83,7 +332,9 @@ class OpusDecSrc : public RawSource {
     void readFeh(Frame &frame);
     void readNoFeh(Frame &frame);
     void readNormal(Frame &frame);
+    void updateFrameLen(const std::vector<uint8_t> &pack);
 
+    size_t frameLen = FRAME_SIZE;
     bool fehFlag = 0;
     std::vector<uint8_t> fehBuf;
     OpusDecoder *dec;
@@ -0,0 +1,20 @@
+#include "core.hpp"
+#include "simd.hpp"
+
+void aud::VolumeDSP::set(float val) {
+    this->val = val / 100;
+}
+
+void aud::VolumeDSP::process(Frame &frame) {
+    simd::gain(frame.data(), frame.size(), val);
+}
+
+float aud::VolumeDSP::get() {
+    return val * 100;
+}
+
+void aud::ClipDSP::process(Frame &frame) {
+    for (float &s : frame) {
+        s = sample(s);
+    }
+}
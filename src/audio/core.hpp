@@ -0,0 +1,242 @@
+#pragma once
+
+#include "frame.hpp"
+#include "packet.hpp"
+#include "ring.hpp"
+#include <algorithm>
+#include <atomic>
+#include <boost/container/static_vector.hpp>
+#include <boost/core/span.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// The sources, the DSPs and the jitter buffer, without the audio devices (audio.hpp), so the
+// server can take them without PortAudio.
+
+namespace aud {
+
+// of a 20 ms Opus frame, the longer frames get proportionally more (maxEncoderBlockSize())
+inline constexpr size_t MAX_ENCODER_BLOCK_SIZE = 128;
+// of any codec, what is left of an Ethernet frame after the IPv6, UDP and MediaHeader headers
+inline constexpr size_t MAX_PAYLOAD_SIZE = 1440;
+
+using boost::span;
+using boost::container::static_vector;
+using std::atomic;
+using std::list;
+using std::shared_ptr;
+using std::unique_ptr;
+
+class StreamDec;
+
+enum class State {
+    Active,
+    Stopped,
+    Finalized,
+};
+
+class Controllable {
+  public:
+    virtual void start() = 0;
+    virtual void stop() = 0;
+    virtual State state() = 0;
+    virtual ~Controllable() = default;
+};
+
+class Source : public Controllable {
+  public:
+    virtual void lockState() = 0;
+    virtual void unlockState() = 0;
+    virtual void waitActive() = 0; // if src stopped, requires a state check
+    // true if the next read/encode will not wait for data
+    virtual bool ready() = 0;
+    virtual int channels() const = 0;
+    virtual ~Source() = default;
+};
+
+// lockState() for the scope, the state is unlocked if read() throws
+class StateLock {
+  public:
+    explicit StateLock(Source &src) : src(&src) {
+        src.lockState();
+    }
+    ~StateLock() {
+        unlock();
+    }
+    StateLock(const StateLock &) = delete;
+    StateLock &operator=(const StateLock &) = delete;
+    void unlock() {
+        if (src) {
+            src->unlockState();
+            src = nullptr;
+        }
+    }
+
+  private:
+    Source *src;
+};
+
+class RawSource : public Source {
+  public:
+    virtual void read(Frame &frame) = 0;
+    virtual ~RawSource() = default;
+};
+
+class DSP {
+  public:
+    virtual void process(Frame &frame) = 0;
+    virtual ~DSP() = default;
+};
+
+class VolumeDSP : public DSP {
+  public:
+    void process(Frame &frame) override;
+    void set(float val); // 0 - 100 or more for amplification
+    float get();
+    // per-sample form, fused by DspChain
+    void begin() {
+        cur = val.load(std::memory_order_relaxed);
+    }
+    float sample(float x) const {
+        return x * cur;
+    }
+
+  private:
+    atomic<float> val{1};
+    float cur = 1;
+};
+
+// Hard clip to [-1, 1], e.g. after an amplification
+class ClipDSP : public DSP {
+  public:
+    void process(Frame &frame) override;
+    void begin() {}
+    float sample(float x) const {
+        return std::clamp(x, -1.f, 1.f);
+    }
+};
+
+// Adaptive jitter buffer.
+// push() is called by the network thread, read() by the playback thread.
+// Neither of them blocks: push() drops the oldest packet on overflow,
+// read() conceals the missing packet if nothing has arrived yet.
+// Packets are reordered by sequence number, the target depth follows the inter-arrival jitter
+// and the playout is stretched (concealment) or compressed (crossfade) to meet it.
+// While the stream pauses (the sender gates silence) comfort noise at the level of the last quiet
+// frames is played instead.
+// The frames of the comfort noise and of the silence before the first packet have vad 0, so a mixer
+// can tell them from the sender's audio.
+// Every packet is decoded by the codec of its PayloadType (StreamDec), so the sender picks the
+// codec of a stream and may change it between frames. The frames are as long as the packets are,
+// dur is only the length until the first one. A packet that does not decode is concealed.
+// As a RawSource it is always ready and starts active.
+class NetBuf : public RawSource {
+  public:
+    // maxDepth is in frames
+    NetBuf(size_t maxDepth = 10, int channels = 1, FrameDuration dur = FrameDuration::Ms20);
+    ~NetBuf();
+    // a media datagram (MediaPacket) or a Bundle of them, returns false if there is no packet of
+    // a known codec in it; the packets of a bundle are all taken as the ones of this stream
+    bool push(span<const uint8_t> datagram);
+    bool push(const MediaPacket &mp);
+    // a bare payload, timestamp is in samples
+    void push(
+        span<const uint8_t> pack,
+        uint16_t seq,
+        uint32_t timestamp,
+        PayloadType type = PayloadType::Opus
+    );
+    void read(Frame &frame) override;
+    void lockState() override;
+    void unlockState() override;
+    void start() override;
+    void stop() override;
+    State state() override;
+    void waitActive() override;
+    bool ready() override;
+    int channels() const override;
+    uint64_t dropped() const;
+    size_t targetDepth() const; // in frames
+    float jitter() const;       // in ms
+    int loss() const;           // in percents
+    // lost frames decoded from the in-band FEC of the next packet
+    uint64_t recovered() const;
+    // called from read() about once a second with the observed loss,
+    // to be passed to the encoder of the opposite direction (EncodedSource::setPacketLossPrec)
+    std::function<void(int perc)> lossCallback;
+
+  private:
+    struct Packet {
+        uint16_t seq;
+        uint16_t size;
+        uint32_t timestamp;
+        int64_t arrival; // us
+        PayloadType type;
+        uint8_t data[MAX_PAYLOAD_SIZE];
+
+        // the header and the used part of data, all that is copied of a packet
+        size_t bytes() const {
+            return offsetof(Packet, data) + size;
+        }
+    };
+    struct Slot {
+        bool valid = false;
+        Packet pack;
+    };
+
+    void drain();
+    void insert(const Packet &pack);
+    void updateTarget();
+    size_t bufferedFrames() const;
+    Slot *slotFor(uint16_t seq);
+    void decode(const Packet *pack, Frame &frame, bool fec = false);
+    void play(Frame &frame);
+    void comfortNoise(Frame &frame);
+    void countLoss(bool lost);
+    void setFrameLen(size_t len);
+
+    const size_t maxDepth;
+    const int chans;
+    size_t frameLen; // of the last packet, the concealment and the comfort noise follow it
+    std::mutex stateMux;
+    std::condition_variable cv;
+    atomic<State> st{State::Active};
+    SpscRing<Packet> buf;
+    unique_ptr<StreamDec> dec;
+
+    // consumer side
+    std::vector<Slot> slots;
+    bool started = false;
+    bool buffering = true;
+    bool stretchPending = false;
+    uint16_t nextSeq = 0;
+    uint16_t highestSeq = 0;
+    bool haveLast = false;
+    int64_t lastArrival = 0;
+    uint32_t lastTimestamp = 0;
+    float jitterEst = 0; // in samples
+    size_t underrunBoost = 0;
+    size_t framesSinceUnderrun = 0;
+    size_t consecutiveUnderruns = 0;
+    size_t lossExpected = 0;
+    size_t lossCount = 0;
+    float lossEst = 0;
+    float noiseLevel = 0; // RMS
+    float noiseLp = 0;
+    uint32_t noiseSeed = 1;
+    atomic<size_t> target{1};
+    atomic<float> jitterMs{0};
+    atomic<int> lossPerc{0};
+    atomic<uint64_t> recoveredCnt{0};
+    std::vector<float> fadeIn;
+    Packet packBuf;
+    Frame frameBuf;
+};
+
+} // namespace aud
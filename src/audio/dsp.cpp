@@ -1,5 +1,7 @@
 #include "audio.hpp"
 #include "log.hpp"
+#include "simd.hpp"
+#include <algorithm>
 #include <boost/format.hpp>
 #include <cassert>
 #include <csignal>
@@ -22,6 +24,8 @@ aud::RnnoiseDSP::RnnoiseDSP(const char *modelFileName) {
     }
     handler = rnnoise_create(model);
     assert(handler);
+    inBlock.resize(rnnoise_get_frame_size());
+    outBlock.resize(rnnoise_get_frame_size());
 }
 
 aud::RnnoiseDSP::~RnnoiseDSP() {
@@ -31,27 +35,42 @@ aud::RnnoiseDSP::~RnnoiseDSP() {
     }
 }
 
-void aud::RnnoiseDSP::process(Frame &frame) {
-    int rnnoise_frame_size = rnnoise_get_frame_size();
-    assert(
-        frame.size() % rnnoise_frame_size == 0 && "frame size must be a multiple of rnnoise size"
-    );
+// in place, returns the voice probability
+float aud::RnnoiseDSP::processBlock(float *block) {
+    size_t n = inBlock.size();
+    simd::gain(block, n, INT16_MAX);
+    float vad = rnnoise_process_frame(handler, block, block);
+    simd::gain(block, n, 1.f / INT16_MAX);
+    return vad;
+}
 
-    if (state) {
-        for (float &v : frame) {
-            v *= INT16_MAX;
-        }
-        for (size_t i = 0; i < FRAME_SIZE / rnnoise_frame_size; i++) {
-            rnnoise_process_frame(
-                handler,
-                frame.data() + rnnoise_frame_size * i,
-                frame.data() + rnnoise_frame_size * i
-            );
-        }
-        for (float &v : frame) {
-            v *= 1.f / INT16_MAX;
+void aud::RnnoiseDSP::process(Frame &frame) {
+    if (!state) {
+        return;
+    }
+    size_t block = inBlock.size();
+    if (frame.size() % block == 0) {
+        float vad = 0;
+        for (size_t i = 0; i < frame.size(); i += block) {
+            vad = std::max(vad, processBlock(frame.data() + i));
         }
+        frame.vad = vad;
+        return;
     }
+
+    // a short frame: swap it with the same part of the previous processed block
+    assert(block % frame.size() == 0 && "frame size must divide the rnnoise size");
+    for (size_t i = 0; i < frame.size(); i++) {
+        inBlock[blockPos + i] = frame[i];
+        frame[i] = outBlock[blockPos + i];
+    }
+    blockPos += frame.size();
+    if (blockPos == block) {
+        blockPos = 0;
+        blockVad = processBlock(inBlock.data());
+        std::swap(inBlock, outBlock);
+    }
+    frame.vad = blockVad;
 }
 
 void aud::RnnoiseDSP::on() {
@@ -65,14 +84,3 @@ void aud::RnnoiseDSP::off() {
 bool aud::RnnoiseDSP::getState() {
     return state;
 }
-
-void aud::VolumeDSP::set(float val) {
-    this->val = val / 100;
-}
-
-void aud::VolumeDSP::process(Frame &frame) {
-    float volume = val;
-    for (float &v : frame) {
-        v *= volume;
-    }
-}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "audio.hpp"
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace aud {
+
+// A chain stage is a stateless per-sample one if it has
+//     void begin();          // called once per frame, e.g. to load the parameters
+//     float sample(float x); // the output for the input sample x
+// otherwise it is called through process(Frame &).
+template <typename T, typename = void> struct IsSampleStage : std::false_type {};
+
+template <typename T>
+struct IsSampleStage<
+    T,
+    std::void_t<decltype(std::declval<T &>().begin()), decltype(std::declval<T &>().sample(0.f))>>
+    : std::true_type {};
+
+// DSP pipeline fixed at compile time, e.g. DspChain<RnnoiseDSP, VolumeDSP, ClipDSP>.
+// The stages are held by value and called directly, so they are inlined. Adjacent per-sample stages
+// are fused into one loop that applies all of them to a sample before moving on, so the frame is
+// swept once per run of them instead of once per stage.
+// Plugs into Recorder::dsps as a single DSP.
+template <typename... Stages> class DspChain : public DSP {
+  public:
+    void process(Frame &frame) override {
+        run<0>(frame);
+    }
+
+    template <size_t I> auto &get() {
+        return std::get<I>(stages);
+    }
+
+    template <typename T> T &get() {
+        return std::get<T>(stages);
+    }
+
+  private:
+    static constexpr size_t N = sizeof...(Stages);
+
+    template <size_t I> using Stage = std::tuple_element_t<I, std::tuple<Stages...>>;
+
+    // the end of the run of per-sample stages starting at I
+    template <size_t I> static constexpr size_t runEnd() {
+        if constexpr (I < N) {
+            if constexpr (IsSampleStage<Stage<I>>::value) {
+                return runEnd<I + 1>();
+            }
+        }
+        return I;
+    }
+
+    template <size_t I> void run(Frame &frame) {
+        if constexpr (I < N) {
+            if constexpr (IsSampleStage<Stage<I>>::value) {
+                constexpr size_t end = runEnd<I>();
+                fused(
+                    frame,
+                    std::make_index_sequence<end - I>{},
+                    std::integral_constant<size_t, I>{}
+                );
+                run<end>(frame);
+            } else {
+                // qualified, no virtual dispatch
+                using S = Stage<I>;
+                std::get<I>(stages).S::process(frame);
+                run<I + 1>(frame);
+            }
+        }
+    }
+
+    template <size_t... Is, size_t First>
+    void fused(Frame &frame, std::index_sequence<Is...>, std::integral_constant<size_t, First>) {
+        (std::get<First + Is>(stages).begin(), ...);
+        float *data = frame.data();
+        size_t n = frame.size();
+        for (size_t i = 0; i < n; i++) {
+            float s = data[i];
+            ((s = std::get<First + Is>(stages).sample(s)), ...);
+            data[i] = s;
+        }
+    }
+
+    std::tuple<Stages...> stages;
+};
+
+} // namespace aud
@@ -0,0 +1,116 @@
+#include "audio.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <boost/format.hpp>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef CHAT_BUILD_TARGET_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace aud;
+
+// how often the engine looks at the outputs, in parts of a frame
+static constexpr int WAKEUPS_PER_FRAME = 4;
+
+AudioEngine &AudioEngine::instance() {
+    static AudioEngine engine;
+    return engine;
+}
+
+void AudioEngine::start() {
+    if (running.exchange(true)) {
+        return;
+    }
+    thread = std::thread(&AudioEngine::loop, this);
+#ifdef CHAT_BUILD_TARGET_LINUX
+    sched_param param{};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    if (pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) != 0) {
+        CHAT_LOGV("audio engine: no permission for real-time priority");
+    }
+#endif
+}
+
+void AudioEngine::stop() {
+    if (!running.exchange(false)) {
+        return;
+    }
+    thread.join();
+}
+
+void AudioEngine::add(Player *player) {
+    std::lock_guard<std::mutex> lg(mux);
+    players.push_back(player);
+}
+
+void AudioEngine::remove(Player *player) {
+    std::unique_lock<std::mutex> lk(mux);
+    players.erase(std::remove(players.begin(), players.end(), player), players.end());
+    // from the engine thread (a callback) it is not being serviced
+    if (std::this_thread::get_id() != thread.get_id()) {
+        serviced.wait(lk, [&] { return current != player; });
+    }
+}
+
+// follows the shortest frame among the outputs, under the lock
+std::chrono::microseconds AudioEngine::period() {
+    size_t frame = FRAME_SIZE;
+    for (Player *p : players) {
+        frame = std::min(frame, p->d->out->frameSize());
+    }
+    return std::chrono::microseconds((int64_t)frame * 1000000 / SAMPLE_RATE / WAKEUPS_PER_FRAME);
+}
+
+void AudioEngine::loop() {
+    std::vector<Player *> round;
+    std::vector<std::function<void()>> callbacks;
+    auto next = std::chrono::steady_clock::now();
+    while (running) {
+        std::chrono::microseconds wait;
+        {
+            std::lock_guard<std::mutex> lg(mux);
+            wait = period();
+            round = players;
+        }
+        for (Player *p : round) {
+            {
+                std::lock_guard<std::mutex> lg(mux);
+                if (std::find(players.begin(), players.end(), p) == players.end()) {
+                    continue; // removed in the meantime
+                }
+                current = p;
+            }
+            try {
+                if (p->service() && p->endOfSourceCallback) {
+                    callbacks.push_back(p->endOfSourceCallback);
+                }
+            } catch (const std::exception &ex) {
+                CHAT_LOGE(boost::format("audio engine: player: %1%") % ex.what());
+            } catch (...) {
+                CHAT_LOGE("audio engine: player: unknown exception");
+            }
+            std::lock_guard<std::mutex> lg(mux);
+            current = nullptr;
+            serviced.notify_all();
+        }
+        // outside the lock, so that a callback is free to destroy its player
+        for (auto &cb : callbacks) {
+            cb();
+        }
+        callbacks.clear();
+
+        next += wait;
+        auto now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next = now; // overloaded, do not try to catch up
+        }
+        std::this_thread::sleep_until(next);
+    }
+}
@@ -0,0 +1,211 @@
+#include "audio/aec.hpp"
+#include "audio/audio.hpp"
+#include "audio/resampler.hpp"
+#include "audio/simd.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Offline run of the echo canceller: far.wav is what was played, near.wav what the microphone
+// captured meanwhile (the same start). Prints the cost and the echo reduction, writes the
+// processed capture to out.wav. Without the files a synthetic room echo of white noise is used.
+//
+//   audio_bench_aec [far.wav near.wav [out.wav [tail_ms]]]
+
+using namespace aud;
+
+struct Wav {
+    int rate = SAMPLE_RATE;
+    std::vector<float> samples; // mono
+};
+
+template <typename T> static T le(const uint8_t *p) {
+    T v = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+        v |= (T)p[i] << (8 * i);
+    }
+    return v;
+}
+
+// PCM16 or float32, any channels and rate; downmixed
+static bool readWav(const char *path, Wav &wav) {
+    std::ifstream f(path, std::ios::binary);
+    std::vector<uint8_t> file(
+        (std::istreambuf_iterator<char>(f)),
+        std::istreambuf_iterator<char>()
+    );
+    if (file.size() < 12 ||
+        std::memcmp(file.data(), "RIFF", 4) ||
+        std::memcmp(&file[8], "WAVE", 4)) {
+        std::fprintf(stderr, "%s: not a wav file\n", path);
+        return false;
+    }
+    int format = 0, chans = 0, bits = 0;
+    for (size_t pos = 12; pos + 8 <= file.size();) {
+        const uint8_t *chunk = &file[pos];
+        size_t size = std::min<size_t>(le<uint32_t>(chunk + 4), file.size() - pos - 8);
+        if (!std::memcmp(chunk, "fmt ", 4) && size >= 16) {
+            format = le<uint16_t>(chunk + 8);
+            chans = le<uint16_t>(chunk + 10);
+            wav.rate = le<uint32_t>(chunk + 12);
+            bits = le<uint16_t>(chunk + 22);
+            if (format == 0xFFFE && size >= 26) { // WAVE_FORMAT_EXTENSIBLE
+                format = le<uint16_t>(chunk + 32);
+            }
+        } else if (!std::memcmp(chunk, "data", 4)) {
+            bool pcm16 = format == 1 && bits == 16;
+            bool float32 = format == 3 && bits == 32;
+            if (!(pcm16 || float32) || chans < 1) {
+                std::fprintf(stderr, "%s: only PCM16 and float32 are supported\n", path);
+                return false;
+            }
+            size_t frames = size / (bits / 8) / chans;
+            wav.samples.resize(frames);
+            const uint8_t *data = chunk + 8;
+            for (size_t i = 0; i < frames; i++) {
+                float sum = 0;
+                for (int c = 0; c < chans; c++) {
+                    const uint8_t *s = data + (i * chans + c) * (bits / 8);
+                    if (pcm16) {
+                        sum += (int16_t)le<uint16_t>(s) / 32768.f;
+                    } else {
+                        uint32_t u = le<uint32_t>(s);
+                        float v;
+                        std::memcpy(&v, &u, sizeof(v));
+                        sum += v;
+                    }
+                }
+                wav.samples[i] = sum / chans;
+            }
+            return true;
+        }
+        pos += 8 + size + (size & 1);
+    }
+    std::fprintf(stderr, "%s: no data\n", path);
+    return false;
+}
+
+static void writeWav(const char *path, const std::vector<float> &samples) {
+    std::vector<int16_t> pcm(samples.size());
+    simd::toS16(samples.data(), pcm.data(), samples.size());
+    uint32_t dataSize = pcm.size() * sizeof(int16_t);
+    uint8_t header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ',
+                          16, 0, 0, 0, 1, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 16, 0,
+                          'd', 'a', 't', 'a', 0, 0, 0, 0};
+    auto put32 = [&](size_t at, uint32_t v) {
+        for (size_t i = 0; i < 4; i++) {
+            header[at + i] = v >> (8 * i);
+        }
+    };
+    put32(4, 36 + dataSize);
+    put32(24, SAMPLE_RATE);
+    put32(28, SAMPLE_RATE * 2);
+    put32(40, dataSize);
+    std::ofstream f(path, std::ios::binary);
+    f.write((const char *)header, sizeof(header));
+    f.write((const char *)pcm.data(), dataSize); // little-endian hosts only
+}
+
+static std::vector<float> toSampleRate(const Wav &wav) {
+    if (wav.rate == SAMPLE_RATE) {
+        return wav.samples;
+    }
+    Resampler rs(wav.rate, SAMPLE_RATE);
+    std::vector<float> out(rs.maxOutput(wav.samples.size()));
+    out.resize(rs.process(wav.samples.data(), wav.samples.size(), out.data()));
+    return out;
+}
+
+// 10 s of white noise played in a room with a 30 ms direct path and a few reflections
+static void synthetic(std::vector<float> &far, std::vector<float> &near) {
+    const std::pair<size_t, float> taps[] = {{1440, 0.3f}, {1500, -0.15f}, {1900, 0.08f},
+                                             {2600, 0.05f}, {4000, -0.02f}};
+    far.resize(SAMPLE_RATE * 10);
+    near.assign(far.size(), 0);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < far.size(); i++) {
+        seed = seed * 1664525 + 1013904223;
+        far[i] = 0.3f * ((float)(seed >> 8) / (1 << 24) * 2 - 1);
+        for (auto [delay, gain] : taps) {
+            if (i >= delay) {
+                near[i] += gain * far[i - delay];
+            }
+        }
+    }
+}
+
+static double energyDb(const float *data, size_t n) {
+    double s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += (double)data[i] * data[i];
+    }
+    return 10 * std::log10(s / std::max<size_t>(n, 1) + 1e-12);
+}
+
+int main(int argc, char **argv) {
+    std::vector<float> far, near;
+    if (argc >= 3) {
+        Wav farWav, nearWav;
+        if (!readWav(argv[1], farWav) || !readWav(argv[2], nearWav)) {
+            return 1;
+        }
+        far = toSampleRate(farWav);
+        near = toSampleRate(nearWav);
+        far.resize(near.size()); // silence after the far end ends
+    } else {
+        std::printf("no files given, using a synthetic echo\n");
+        synthetic(far, near);
+    }
+    const char *outPath = argc >= 4 ? argv[3] : "out.wav";
+    size_t tailMs = argc >= 5 ? std::strtoul(argv[4], nullptr, 10) : 200;
+
+    EchoCancellerDSP aec(tailMs);
+    std::vector<float> out;
+    out.reserve(near.size());
+    Frame frame;
+    std::chrono::nanoseconds spent{0};
+    size_t frames = 0;
+    for (size_t i = 0; i + FRAME_SIZE <= near.size(); i += FRAME_SIZE) {
+        frame.resize(FRAME_SIZE);
+        std::copy(near.begin() + i, near.begin() + i + FRAME_SIZE, frame.begin());
+        auto start = std::chrono::steady_clock::now();
+        aec.farEnd(far.data() + i, FRAME_SIZE);
+        aec.process(frame);
+        spent += std::chrono::steady_clock::now() - start;
+        frames++;
+        out.insert(out.end(), frame.begin(), frame.end());
+    }
+    if (frames == 0) {
+        std::fprintf(stderr, "the capture is shorter than a frame\n");
+        return 1;
+    }
+    writeWav(outPath, out);
+
+    double perFrameUs = std::chrono::duration<double, std::micro>(spent).count() / frames;
+    double frameUs = 1e6 * FRAME_SIZE / SAMPLE_RATE;
+    // the output is delayed by a block; out holds a frame at least, which is longer than a block
+    static_assert(FRAME_SIZE >= EchoCancellerDSP::BLOCK);
+    size_t second = std::min<size_t>(SAMPLE_RATE, out.size() - EchoCancellerDSP::BLOCK);
+    const float *lastNear = near.data() + out.size() - EchoCancellerDSP::BLOCK - second;
+    std::printf(
+        "tail %zu ms, %zu frames of %zu samples, simd: %s\n",
+        tailMs,
+        frames,
+        FRAME_SIZE,
+        simd::active().name
+    );
+    std::printf("%.1f us per frame, %.2f%% of a core\n", perFrameUs, 100 * perFrameUs / frameUs);
+    std::printf(
+        "level in %.1f dB, out %.1f dB over the last second\n",
+        energyDb(lastNear, second),
+        energyDb(out.data() + out.size() - second, second)
+    );
+    std::printf("ERLE while the far end talked alone: %.1f dB\n", aec.erle());
+    std::printf("written %s\n", outPath);
+}
@@ -0,0 +1,75 @@
+#include "audio/audio.hpp"
+#include "audio/simd.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+using namespace aud;
+
+static constexpr size_t ITERATIONS = 100000;
+
+volatile float sink;
+
+// ns per frame
+static double measure(const std::function<void()> &fn) {
+    for (size_t i = 0; i < ITERATIONS / 10; i++) {
+        fn();
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ITERATIONS; i++) {
+        fn();
+    }
+    auto dur = std::chrono::steady_clock::now() - start;
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count() / ITERATIONS;
+}
+
+int main() {
+    const size_t n = FRAME_SIZE;
+    std::vector<float> a(n), b(n), ramp(n);
+    std::vector<int16_t> s16(n);
+    for (size_t i = 0; i < n; i++) {
+        a[i] = 0.5f * std::sin(i * 0.01f);
+        b[i] = 0.5f * std::cos(i * 0.03f);
+        ramp[i] = (float)i / n;
+    }
+
+    struct Bench {
+        const char *name;
+        std::function<void(const simd::Kernels &)> run;
+    };
+    std::vector<Bench> benches = {
+        {"gain", [&](const simd::Kernels &k) { k.gain(a.data(), n, -1.f); }},
+        {"mixAcc", [&](const simd::Kernels &k) { k.mixAcc(a.data(), b.data(), n, 0.001f); }},
+        {"crossfade",
+         [&](const simd::Kernels &k) { k.crossfade(a.data(), b.data(), ramp.data(), n); }},
+        {"toS16", [&](const simd::Kernels &k) { k.toS16(b.data(), s16.data(), n); }},
+        {"fromS16", [&](const simd::Kernels &k) { k.fromS16(s16.data(), b.data(), n); }},
+        {"peak", [&](const simd::Kernels &k) { sink = k.peak(b.data(), n); }},
+        {"rms", [&](const simd::Kernels &k) { sink = k.rms(b.data(), n); }},
+        {"dot", [&](const simd::Kernels &k) { sink = k.dot(a.data(), b.data(), n); }},
+    };
+
+    auto variants = simd::supported();
+    std::printf("%zu-sample frames, active variant: %s\n\n", n, simd::active().name);
+    std::printf("%-10s", "kernel");
+    for (auto *k : variants) {
+        std::printf("%18s", k->name);
+    }
+    std::printf("\n");
+
+    for (auto &bench : benches) {
+        std::printf("%-10s", bench.name);
+        double base = 0;
+        for (auto *k : variants) {
+            double ns = measure([&] { bench.run(*k); });
+            if (base == 0) {
+                base = ns;
+            }
+            std::printf("%9.0f ns %5.1fx", ns, base / ns);
+        }
+        std::printf("\n");
+    }
+}
@@ -1,63 +1,27 @@
 #include "audio/audio.hpp"
 #include "audio/codec.hpp"
-#include "opus_defines.h"
-#include <boost/asio.hpp>
-#include <boost/asio/io_service.hpp>
+#include "audio/mixer.hpp"
+#include "audio/packet.hpp"
+#include "audio/transport.hpp"
 #include <boost/asio/ip/udp.hpp>
 #include <cstdint>
-#include <cstring>
 #include <iostream>
 #include <log.hpp>
 #include <memory>
-#include <opus.h>
-#include <ostream>
+#include <random>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
-using namespace boost::asio;
 using namespace chat;
 
-io_service service;
-std::shared_ptr<ip::udp::socket> sock;
-ip::udp::endpoint ep;
-
-void receiver() {
-    sock->bind(ip::udp::endpoint(ip::udp::v4(), 0));
-    std::vector<uint8_t> recv_buffer;
-
-    int err;
-    OpusDecoder *dec = opus_decoder_create(aud::SAMPLE_RATE, 1, &err);
-    if (err < 0) {
-        throw aud::OpusException(err);
-    }
-    aud::Frame frame;
-    frame.resize(aud::FRAME_SIZE);
-
-    aud::PaOutput out(1);
-    out.start();
-    while (1) {
-        recv_buffer.resize(1024);
-        size_t n = sock->receive(buffer(recv_buffer));
-        recv_buffer.resize(n);
-        err = opus_decode_float(
-            dec,
-            recv_buffer.data(),
-            (int32_t)recv_buffer.size(),
-            frame.data(),
-            (int32_t)frame.size(),
-            0
-        );
-        if (err < 0) {
-            CHAT_LOGW(opus_strerror(err));
-        }
-        out.write(frame);
-    }
-    opus_decoder_destroy(dec);
-}
+std::shared_ptr<aud::MediaTransport> net;
 
 void sender() {
     std::vector<uint8_t> send_buffer;
+    aud::MediaHeader header;
+    header.stream = std::random_device()();
     aud::OpusEncSrc es(aud::mic, aud::EncoderPreset::Voise);
     es.start();
     while (1) {
@@ -66,7 +30,12 @@ void sender() {
         } catch (aud::OpusException &ex) {
             CHAT_LOGW(ex.ErrorText());
         }
-        sock->send_to(buffer(send_buffer), ep);
+        if (send_buffer.empty()) {
+            continue;
+        }
+        net->send(header, send_buffer);
+        header.seq++;
+        header.timestamp += (uint32_t)aud::mic->frameSize();
     }
 }
 
@@ -89,11 +58,30 @@ int main() {
     uint16_t port;
     std::cin >> port;
 
-    ep = ip::udp::endpoint(ip::address::from_string(addr), port);
-
-    sock = std::make_shared<ip::udp::socket>(service);
-    sock->open(ip::udp::v4());
-
+    using boost::asio::ip::udp;
+    net = std::make_shared<aud::MediaTransport>(
+        udp::endpoint(boost::asio::ip::make_address(addr), port)
+    );
+    auto mixer = std::make_shared<aud::Mixer>();
+    // the mixer input of a stream, the I/O thread
+    auto inputs = std::make_shared<std::unordered_map<uint32_t, size_t>>();
+    net->onStream = [mixer, inputs](uint32_t stream) {
+        auto nb = std::make_shared<aud::NetBuf>();
+        (*inputs)[stream] = mixer->add(nb);
+        return nb;
+    };
+    net->onStreamEnd = [mixer, inputs](uint32_t stream, std::shared_ptr<aud::NetBuf>) {
+        mixer->remove((*inputs)[stream]);
+        inputs->erase(stream);
+    };
+    net->start();
     std::thread(sender).detach();
-    receiver();
-}
\ No newline at end of file
+
+    aud::PaOutput out(1);
+    out.start();
+    aud::Frame frame;
+    while (1) {
+        mixer->read(frame);
+        out.write(frame);
+    }
+}
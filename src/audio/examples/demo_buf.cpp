@@ -1,52 +1,87 @@
+#include "audio/aec.hpp"
 #include "audio/audio.hpp"
 #include "audio/codec.hpp"
-#include <boost/asio.hpp>
-#include <boost/asio/io_service.hpp>
+#include "audio/feedback.hpp"
+#include "audio/mixer.hpp"
+#include "audio/packet.hpp"
+#include "audio/transport.hpp"
 #include <boost/asio/ip/udp.hpp>
 #include <cstdint>
-#include <cstring>
 #include <iostream>
 #include <log.hpp>
 #include <memory>
-#include <opus.h>
-#include <ostream>
+#include <mutex>
+#include <random>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
-using namespace boost::asio;
 using namespace chat;
 
-io_service service;
-std::shared_ptr<ip::udp::socket> sock;
-ip::udp::endpoint ep;
-
-void receiver(aud::NetBuf *nb) {
-    sock->bind(ip::udp::endpoint(ip::udp::v4(), 0));
-    std::vector<uint8_t> recv_buffer;
-
-    aud::Frame frame;
-    frame.resize(aud::FRAME_SIZE);
+std::shared_ptr<aud::MediaTransport> net;
+std::shared_ptr<aud::OpusEncSrc> es;
+std::shared_ptr<aud::RateController> rc;
+aud::Mixer mixer;
+std::unordered_map<uint32_t, size_t> inputs; // the mixer input of a stream, the I/O thread
+std::mutex reportedMux;
+std::shared_ptr<aud::NetBuf> reported; // the first stream, the peer of a call
 
+void reporter() {
+    std::vector<uint8_t> report;
     while (1) {
-        recv_buffer.resize(1024);
-        size_t n = sock->receive(buffer(recv_buffer));
-        recv_buffer.resize(n);
-        nb->push(recv_buffer);
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        std::shared_ptr<aud::NetBuf> nb;
+        {
+            std::lock_guard lg(reportedMux);
+            nb = reported;
+        }
+        if (!nb) {
+            continue;
+        }
+        rc->makeReport(*nb, report);
+        net->send(report);
+        CHAT_LOGV(
+            boost::format("loss %1%%%, jitter %2% ms, rtt %3% ms, bitrate %4%") % nb->loss() %
+            nb->jitter() % rc->rtt() % rc->bitrate()
+        );
     }
 }
 
+// the capture loop, the transport sends from its own thread
+// both layers of a simulcast go to the relay, which picks one for every listener
 void sender() {
     std::vector<uint8_t> send_buffer;
-    aud::OpusEncSrc es(aud::mic, aud::EncoderPreset::Voise);
-    es.start();
+    std::vector<uint8_t> low_buffer;
+    aud::MediaHeader header;
+    header.stream = std::random_device()();
+    header.type = es->type();
+    bool paused = true;
+    es->start();
     while (1) {
         try {
-            es.encode(send_buffer);
+            es->encode(send_buffer, low_buffer);
         } catch (aud::OpusException &ex) {
             CHAT_LOGW(ex.ErrorText());
         }
-        sock->send_to(buffer(send_buffer), ep);
+        uint32_t frameLen = (uint32_t)aud::mic->frameSize();
+        if (send_buffer.empty() && low_buffer.empty()) {
+            paused = true; // silence
+            header.timestamp += frameLen;
+            continue;
+        }
+        header.marker = paused;
+        paused = false;
+        if (!send_buffer.empty()) {
+            header.layer = aud::Layer::High;
+            net->send(header, send_buffer);
+        }
+        if (!low_buffer.empty()) {
+            header.layer = aud::Layer::Low;
+            net->send(header, low_buffer);
+        }
+        header.seq++;
+        header.timestamp += frameLen;
     }
 }
 
@@ -59,9 +94,13 @@ int main() {
     global_logger.setOutput(&std::cerr);
     aud::initialize();
 
-    aud::NetBuf nb;
-
+    auto aec = std::make_shared<aud::EchoCancellerDSP>();
+    aud::mic->dsps.push_back(aec);
     aud::mic->dsps.push_back(std::make_shared<aud::RnnoiseDSP>());
+    es = std::make_shared<aud::OpusEncSrc>(aud::mic, aud::EncoderPreset::Voise);
+    es->setVadGate(aud::VAD_THRESHOLD);
+    es->setSimulcast(aud::VOISE_LOW_BITRATE);
+    rc = std::make_shared<aud::RateController>(es, aud::EncoderPreset::Voise);
 
     std::cout << "Enter the server address:" << std::endl;
     std::string addr;
@@ -71,19 +110,40 @@ int main() {
     uint16_t port;
     std::cin >> port;
 
-    ep = ip::udp::endpoint(ip::address::from_string(addr), port);
-
-    sock = std::make_shared<ip::udp::socket>(service);
-    sock->open(ip::udp::v4());
+    using boost::asio::ip::udp;
+    net = std::make_shared<aud::MediaTransport>(
+        udp::endpoint(boost::asio::ip::make_address(addr), port)
+    );
+    // every peer (or the mix of the relay) is a stream of its own
+    net->onStream = [](uint32_t stream) {
+        auto nb = std::make_shared<aud::NetBuf>();
+        inputs[stream] = mixer.add(nb);
+        std::lock_guard lg(reportedMux);
+        if (!reported) {
+            reported = nb;
+        }
+        return nb;
+    };
+    net->onStreamEnd = [](uint32_t stream, std::shared_ptr<aud::NetBuf> nb) {
+        mixer.remove(inputs[stream]);
+        inputs.erase(stream);
+        std::lock_guard lg(reportedMux);
+        if (reported == nb) {
+            reported = nullptr;
+        }
+    };
+    net->onControl = [](aud::span<const uint8_t> datagram) { rc->onPacket(datagram); };
+    net->start();
 
     std::thread(sender).detach();
-    std::thread(receiver, &nb).detach();
+    std::thread(reporter).detach();
 
     aud::PaOutput out(1);
+    out.setEchoReference(aec);
     out.start();
     aud::Frame frame;
     while (1) {
-        nb.read(frame);
+        mixer.read(frame);
         out.write(frame);
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,142 @@
+#include "feedback.hpp"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+using namespace aud;
+
+static constexpr uint8_t MAGIC[2] = {0xFF, 0x52};
+// the bitrate backs off when the smoothed RTT exceeds the minimal one by this, ms
+static constexpr float RTT_SLACK = 100;
+// no increase above this jitter, us
+static constexpr uint32_t JITTER_LIMIT = 30000;
+
+static uint32_t nowMs() {
+    uint32_t ms = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch()
+    )
+                      .count();
+    return ms ? ms : 1; // 0 means no echo
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+bool ReceiverReport::isReport(span<const uint8_t> pack) {
+    return pack.size() == SIZE && pack[0] == MAGIC[0] && pack[1] == MAGIC[1];
+}
+
+void ReceiverReport::serialize(std::vector<uint8_t> &out) const {
+    out.resize(SIZE);
+    out[0] = MAGIC[0];
+    out[1] = MAGIC[1];
+    out[2] = loss;
+    out[3] = 0;
+    put32(&out[4], jitterUs);
+    put32(&out[8], sentMs);
+    put32(&out[12], echoMs);
+    put32(&out[16], holdMs);
+}
+
+bool ReceiverReport::parse(span<const uint8_t> pack, ReceiverReport &out) {
+    if (!isReport(pack)) {
+        return false;
+    }
+    out.loss = std::min<uint8_t>(pack[2], 100);
+    out.jitterUs = get32(&pack[4]);
+    out.sentMs = get32(&pack[8]);
+    out.echoMs = get32(&pack[12]);
+    out.holdMs = get32(&pack[16]);
+    return true;
+}
+
+BandwidthEstimator::BandwidthEstimator(int minBitrate, int maxBitrate, int initial)
+    : minBitrate(minBitrate), maxBitrate(maxBitrate), rate(initial) {
+    assert(minBitrate <= initial && initial <= maxBitrate);
+}
+
+void BandwidthEstimator::update(const ReceiverReport &rep, float rttMs, float minRttMs) {
+    float loss = rep.loss / 100.f;
+    if (loss > 0.1f) {
+        rate *= 1 - 0.5f * loss;
+    } else if (rttMs > 0 && rttMs > minRttMs + RTT_SLACK) {
+        rate *= 0.85f;
+    } else if (loss < 0.02f && rep.jitterUs < JITTER_LIMIT) {
+        rate *= 1.08f;
+    }
+    rate = std::clamp(rate, minBitrate, maxBitrate);
+}
+
+int BandwidthEstimator::bitrate() const {
+    return (int)rate;
+}
+
+RateController::RateController(shared_ptr<EncodedSource> enc, EncoderPreset ep)
+    : enc(enc), estimate(
+                    ep == EncoderPreset::Voise ? 8000 : 32000,
+                    ep == EncoderPreset::Voise ? 64000 : 256000,
+                    ep == EncoderPreset::Voise ? VOISE_BITRATE : SOUNDS_BITRATE
+                ) {
+    assert(enc);
+}
+
+void RateController::makeReport(const NetBuf &nb, std::vector<uint8_t> &out) {
+    ReceiverReport rep;
+    rep.loss = (uint8_t)std::clamp(nb.loss(), 0, 100);
+    rep.jitterUs = (uint32_t)std::lround(nb.jitter() * 1000);
+    rep.sentMs = nowMs();
+    {
+        std::lock_guard g(mux);
+        if (peerSentMs) {
+            rep.echoMs = peerSentMs;
+            rep.holdMs = rep.sentMs - peerRecvMs;
+        }
+    }
+    rep.serialize(out);
+}
+
+bool RateController::onPacket(span<const uint8_t> pack) {
+    ReceiverReport rep;
+    if (!ReceiverReport::parse(pack, rep)) {
+        return false;
+    }
+    uint32_t now = nowMs();
+    std::lock_guard g(mux);
+    if (rep.echoMs) {
+        int32_t rtt = (int32_t)(now - rep.echoMs - rep.holdMs);
+        if (rtt >= 0) {
+            srtt = srtt ? srtt + (rtt - srtt) / 8 : (float)rtt;
+            minRtt = minRtt ? std::min(minRtt, (float)rtt) : (float)rtt;
+        }
+    }
+    peerSentMs = rep.sentMs;
+    peerRecvMs = now;
+    adapt(rep, srtt);
+    return true;
+}
+
+void RateController::adapt(const ReceiverReport &rep, float rttMs) {
+    estimate.update(rep, rttMs, minRtt);
+    enc->setBitrate(estimate.bitrate());
+    enc->setPacketLossPrec(rep.loss);
+    enc->setFec(rep.loss > 0);
+}
+
+int RateController::bitrate() const {
+    std::lock_guard g(mux);
+    return estimate.bitrate();
+}
+
+float RateController::rtt() const {
+    std::lock_guard g(mux);
+    return srtt;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "codec.hpp"
+#include "core.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace aud {
+
+// What the receiver of a stream tells its sender, about once a second.
+// It travels over the media socket, the 0xFF 0x52 prefix is not a valid Opus packet
+// (code 3 with 18 frames of 20 ms), so it can not be mistaken for audio.
+// RTT is measured the RTCP way: each side echoes the send time of the last report it got
+// together with the time it held it.
+struct ReceiverReport {
+    static constexpr size_t SIZE = 20;
+
+    uint8_t loss = 0;      // percents
+    uint32_t jitterUs = 0;
+    uint32_t sentMs = 0;   // the reporter's clock
+    uint32_t echoMs = 0;   // sentMs of the last report from the peer, 0 if none yet
+    uint32_t holdMs = 0;   // since that report was received
+
+    static bool isReport(span<const uint8_t> pack);
+    void serialize(std::vector<uint8_t> &out) const;
+    // returns false if pack is not a report
+    static bool parse(span<const uint8_t> pack, ReceiverReport &out);
+};
+
+// The bitrate a path takes, from the reports of its receiver.
+// Loss-based like GCC: it backs off in proportion to the loss above 10% and slowly grows below 2%,
+// it also backs off when the RTT rises far above the minimal one (queues are building).
+class BandwidthEstimator {
+  public:
+    BandwidthEstimator(int minBitrate, int maxBitrate, int initial);
+    // the RTTs are in ms, 0 if not measured
+    void update(const ReceiverReport &rep, float rttMs = 0, float minRttMs = 0);
+    int bitrate() const; // bit/s
+
+  private:
+    const float minBitrate;
+    const float maxBitrate;
+    float rate;
+};
+
+// Adapts the bitrate, FEC and the expected loss of the local encoder to the reports of the peer,
+// the bitrate follows a BandwidthEstimator. FEC is only on while there is loss to protect against.
+class RateController {
+  public:
+    RateController(shared_ptr<EncodedSource> enc, EncoderPreset ep);
+    // the report about the stream received by nb, to be sent to the peer
+    void makeReport(const NetBuf &nb, std::vector<uint8_t> &out);
+    // returns false if pack is not a report, so it is audio
+    bool onPacket(span<const uint8_t> pack);
+    int bitrate() const; // bit/s
+    float rtt() const;   // ms, 0 if not measured yet
+
+  private:
+    void adapt(const ReceiverReport &rep, float rttMs);
+
+    mutable std::mutex mux;
+    shared_ptr<EncodedSource> enc;
+    BandwidthEstimator estimate;
+    float srtt = 0;
+    float minRtt = 0;
+    uint32_t peerSentMs = 0;
+    uint32_t peerRecvMs = 0;
+};
+
+} // namespace aud
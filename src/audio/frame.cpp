@@ -0,0 +1,73 @@
+#include "frame.hpp"
+#include <new>
+
+using namespace aud;
+
+FramePool &FramePool::instance() {
+    // never destroyed, frames may outlive the static destructors
+    static FramePool *pool = new FramePool;
+    return *pool;
+}
+
+std::atomic<uint32_t> &FramePool::next(uint32_t idx) {
+    return chunks[idx / CHUNK_BLOCKS]->next[idx % CHUNK_BLOCKS];
+}
+
+float *FramePool::data(uint32_t idx) {
+    return chunks[idx / CHUNK_BLOCKS]->blocks[idx % CHUNK_BLOCKS];
+}
+
+size_t FramePool::allocated() const {
+    return (size_t)chunkCnt.load(std::memory_order_acquire) * CHUNK_BLOCKS;
+}
+
+uint32_t FramePool::acquire() {
+    while (true) {
+        uint64_t h = head.load(std::memory_order_acquire);
+        while (uint32_t top = (uint32_t)h) {
+            // chunks are never freed, so reading the link of a block taken meanwhile is safe,
+            // the tag makes the CAS fail in that case
+            uint32_t nxt = next(top - 1).load(std::memory_order_relaxed);
+            uint64_t nh = ((h >> 32) + 1) << 32 | nxt;
+            if (head.compare_exchange_weak(
+                    h,
+                    nh,
+                    std::memory_order_acq_rel,
+                    std::memory_order_acquire
+                )) {
+                return top - 1;
+            }
+        }
+        grow();
+    }
+}
+
+void FramePool::release(uint32_t idx) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    uint64_t nh;
+    do {
+        next(idx).store((uint32_t)h, std::memory_order_relaxed);
+        nh = ((h >> 32) + 1) << 32 | (idx + 1);
+    } while (!head.compare_exchange_weak(
+        h,
+        nh,
+        std::memory_order_release,
+        std::memory_order_relaxed
+    ));
+}
+
+void FramePool::grow() {
+    std::lock_guard g(growMux);
+    if ((uint32_t)head.load(std::memory_order_acquire)) {
+        return; // another thread has grown it or a frame was released meanwhile
+    }
+    uint32_t n = chunkCnt.load(std::memory_order_relaxed);
+    if (n == MAX_CHUNKS) {
+        throw std::bad_alloc();
+    }
+    chunks[n] = std::make_unique<Chunk>();
+    chunkCnt.store(n + 1, std::memory_order_release);
+    for (uint32_t i = 0; i < CHUNK_BLOCKS; i++) {
+        release(n * CHUNK_BLOCKS + i);
+    }
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include "ring.hpp"
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace aud {
+
+inline constexpr int SAMPLE_RATE = 48000;
+inline constexpr size_t FRAME_SIZE = 960;     // the default, 20 ms
+inline constexpr size_t MAX_FRAME_SIZE = 2880; // 60 ms
+inline constexpr size_t MAX_CHANNELS = 2;
+
+// Frame durations supported by Opus, set per pipeline: short frames for low-latency LAN sessions,
+// long ones for links limited by the packet rate.
+enum class FrameDuration {
+    Ms2_5,
+    Ms5,
+    Ms10,
+    Ms20,
+    Ms40,
+    Ms60,
+};
+
+// samples per channel
+constexpr size_t frameSize(FrameDuration dur) {
+    switch (dur) {
+    case FrameDuration::Ms2_5:
+        return 120;
+    case FrameDuration::Ms5:
+        return 240;
+    case FrameDuration::Ms10:
+        return 480;
+    case FrameDuration::Ms20:
+        return 960;
+    case FrameDuration::Ms40:
+        return 1920;
+    case FrameDuration::Ms60:
+        return 2880;
+    }
+    return FRAME_SIZE;
+}
+
+// Fixed-size, cache-line-aligned sample blocks shared by all frames of the process.
+// acquire() and release() are lock-free, the pool only takes a lock to grow by a chunk when it
+// runs empty, so once the working set is allocated no frame touches the heap.
+class FramePool {
+  public:
+    static constexpr size_t BLOCK_SIZE = MAX_FRAME_SIZE * MAX_CHANNELS; // in samples
+    // the pool grows by 16 blocks at a time; a block is 60 ms of all channels, so a chunk is
+    // already a few hundred KB
+    static constexpr uint32_t CHUNK_BLOCKS = 16;
+    static constexpr uint32_t MAX_CHUNKS = 1024;
+
+    static FramePool &instance();
+    // returns the block index, throws std::bad_alloc if the pool can not grow anymore
+    uint32_t acquire();
+    void release(uint32_t idx);
+    float *data(uint32_t idx);
+    size_t allocated() const; // in blocks
+
+  private:
+    struct Chunk {
+        alignas(CACHE_LINE_SIZE) float blocks[CHUNK_BLOCKS][BLOCK_SIZE];
+        std::atomic<uint32_t> next[CHUNK_BLOCKS]; // free list links, index + 1
+    };
+    static_assert(BLOCK_SIZE * sizeof(float) % CACHE_LINE_SIZE == 0, "blocks must stay aligned");
+
+    FramePool() = default;
+    std::atomic<uint32_t> &next(uint32_t idx);
+    void grow();
+
+    std::mutex growMux;
+    std::unique_ptr<Chunk> chunks[MAX_CHUNKS];
+    std::atomic<uint32_t> chunkCnt{0};
+    // free list top: ABA tag in the high half, index + 1 in the low one, 0 if empty
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head{0};
+};
+
+// Move-only handle to a pooled block of up to BLOCK_SIZE interleaved samples.
+// It acquires the block on the first resize() and returns it to the pool on destruction,
+// resize() within the capacity never allocates.
+class Frame {
+  public:
+    Frame() = default;
+    explicit Frame(size_t size) {
+        resize(size);
+    }
+    Frame(const Frame &) = delete;
+    Frame &operator=(const Frame &) = delete;
+
+    Frame(Frame &&other) noexcept
+        : vad(other.vad), buf(other.buf), idx(other.idx), len(other.len) {
+        other.buf = nullptr;
+        other.len = 0;
+    }
+
+    Frame &operator=(Frame &&other) noexcept {
+        if (this != &other) {
+            reset();
+            vad = other.vad;
+            buf = other.buf;
+            idx = other.idx;
+            len = other.len;
+            other.buf = nullptr;
+            other.len = 0;
+        }
+        return *this;
+    }
+
+    ~Frame() {
+        reset();
+    }
+
+    // new samples are zeroed, like std::vector
+    void resize(size_t size) {
+        assert(size <= capacity());
+        if (!buf) {
+            idx = FramePool::instance().acquire();
+            buf = FramePool::instance().data(idx);
+        }
+        if (size > len) {
+            std::memset(buf + len, 0, (size - len) * sizeof(float));
+        }
+        len = size;
+    }
+
+    void clear() {
+        len = 0;
+    }
+
+    static constexpr size_t capacity() {
+        return FramePool::BLOCK_SIZE;
+    }
+
+    float *data() {
+        return buf;
+    }
+    const float *data() const {
+        return buf;
+    }
+    size_t size() const {
+        return len;
+    }
+    bool empty() const {
+        return len == 0;
+    }
+    float &operator[](size_t i) {
+        return buf[i];
+    }
+    const float &operator[](size_t i) const {
+        return buf[i];
+    }
+    float *begin() {
+        return buf;
+    }
+    float *end() {
+        return buf + len;
+    }
+    const float *begin() const {
+        return buf;
+    }
+    const float *end() const {
+        return buf + len;
+    }
+    float &front() {
+        return buf[0];
+    }
+    float &back() {
+        return buf[len - 1];
+    }
+
+    // voice probability set by the capture dsps (RnnoiseDSP), 0 for the comfort noise of NetBuf,
+    // 1 if unknown
+    float vad = 1;
+
+  private:
+    void reset() {
+        if (buf) {
+            FramePool::instance().release(idx);
+            buf = nullptr;
+        }
+        len = 0;
+    }
+
+    float *buf = nullptr;
+    uint32_t idx = 0;
+    size_t len = 0;
+};
+
+} // namespace aud
@@ -1,5 +1,6 @@
 #include "audio.hpp"
 #include "portaudiocpp/System.hxx"
+#include <cmath>
 #include <memory>
 #include <mutex>
 #include <portaudiocpp/PortAudioCpp.hxx>
@@ -20,12 +21,19 @@ Device &aud::getInputDevice() {
     return portaudio::System::instance().defaultInputDevice();
 }
 
+int aud::nativeRate(Device &dev) {
+    int rate = (int)std::lround(dev.defaultSampleRate());
+    return rate > 0 ? rate : SAMPLE_RATE;
+}
+
 void aud::initialize() {
     portaudio::System::initialize();
     mic = std::make_shared<Recorder>();
+    AudioEngine::instance().start();
 }
 
 void aud::terminate() {
+    AudioEngine::instance().stop();
     mic = nullptr;
     portaudio::System::terminate();
 }
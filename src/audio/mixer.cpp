@@ -0,0 +1,143 @@
+#include "mixer.hpp"
+#include "audio.hpp"
+#include "log.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <boost/format.hpp>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <mutex>
+
+using namespace aud;
+
+// the limiter is transparent below this level
+static constexpr float LIMITER_KNEE = 0.6f;
+
+// linear below the knee, then bends smoothly towards +-1
+static void softClip(float *data, size_t n) {
+    if (simd::peak(data, n) <= LIMITER_KNEE) {
+        return;
+    }
+    constexpr float range = 1 - LIMITER_KNEE;
+    for (size_t i = 0; i < n; i++) {
+        float a = std::fabs(data[i]);
+        if (a > LIMITER_KNEE) {
+            float over = std::tanh((a - LIMITER_KNEE) / range) * range;
+            data[i] = std::copysign(LIMITER_KNEE + over, data[i]);
+        }
+    }
+}
+
+Mixer::Mixer(int channels, FrameDuration dur) : chans(channels), frameLen(frameSize(dur)) {
+    assert(channels > 0);
+}
+
+size_t Mixer::add(shared_ptr<RawSource> src, float gain) {
+    assert(src);
+    assert(src->channels() == chans);
+    std::lock_guard<std::mutex> lg(inputsMux);
+    auto in = std::make_unique<Input>();
+    in->id = nextId++;
+    in->src = src;
+    in->gain = gain;
+    in->pending.reserve((MAX_FRAME_SIZE + frameLen) * chans);
+    inputs.push_back(std::move(in));
+    return inputs.back()->id;
+}
+
+void Mixer::remove(size_t id) {
+    std::lock_guard<std::mutex> lg(inputsMux);
+    inputs.erase(
+        std::remove_if(
+            inputs.begin(),
+            inputs.end(),
+            [id](const auto &in) { return in->id == id; }
+        ),
+        inputs.end()
+    );
+}
+
+void Mixer::setGain(size_t id, float gain) {
+    assert(gain >= 0);
+    std::lock_guard<std::mutex> lg(inputsMux);
+    for (auto &in : inputs) {
+        if (in->id == id) {
+            in->gain = gain;
+        }
+    }
+}
+
+void Mixer::read(Frame &frame) {
+    frame.resize(frameLen * chans);
+    std::memset(frame.data(), 0, frame.size() * sizeof(float));
+
+    std::lock_guard<std::mutex> lg(inputsMux);
+    for (auto &in : inputs) {
+        float gain = in->gain;
+        RawSource &src = *in->src;
+        auto &pending = in->pending;
+        while (pending.size() < frame.size()) {
+            try {
+                StateLock sl(src);
+                if (gain == 0 || src.state() != State::Active || !src.ready()) {
+                    break;
+                }
+                src.read(buf);
+            } catch (const std::exception &ex) {
+                // one broken input does not silence the others
+                CHAT_LOGV(boost::format("mixer: input %1%: %2%") % in->id % ex.what());
+                break;
+            }
+            if (buf.empty()) {
+                break;
+            }
+            pending.insert(pending.end(), buf.begin(), buf.end());
+        }
+        if (pending.size() < frame.size()) {
+            continue;
+        }
+        simd::mixAcc(frame.data(), pending.data(), frame.size(), gain);
+        pending.erase(pending.begin(), pending.begin() + frame.size());
+    }
+    softClip(frame.data(), frame.size());
+}
+
+void Mixer::lockState() {
+    stateMux.lock();
+}
+
+void Mixer::unlockState() {
+    stateMux.unlock();
+}
+
+void Mixer::start() {
+    std::lock_guard g(stateMux);
+    st = State::Active;
+    cv.notify_all();
+}
+
+void Mixer::stop() {
+    std::lock_guard g(stateMux);
+    st = State::Stopped;
+}
+
+State Mixer::state() {
+    return st;
+}
+
+void Mixer::waitActive() {
+    std::unique_lock lk(stateMux);
+    while (st == State::Stopped) {
+        cv.wait(lk);
+    }
+}
+
+bool Mixer::ready() {
+    return true;
+}
+
+int Mixer::channels() const {
+    return chans;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "audio.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace aud {
+
+// Sums any number of sources into one frame, so a call needs a single output stream per device.
+// Inputs that are not active or not ready are skipped for the frame, as is an input whose read()
+// throws.
+// An input with shorter frames is read until the frame of the mixer is full, what is left of a
+// longer one goes into the next frames.
+// The sum goes through a soft limiter instead of hard clipping.
+class Mixer : public RawSource {
+  public:
+    Mixer(int channels = 1, FrameDuration dur = FrameDuration::Ms20);
+    // returns an id for setGain() and remove()
+    size_t add(shared_ptr<RawSource> src, float gain = 1);
+    void remove(size_t id);
+    void setGain(size_t id, float gain); // 1 is 100%
+    void lockState() override;
+    void unlockState() override;
+    void start() override;
+    void stop() override;
+    void read(Frame &frame) override;
+    State state() override;
+    void waitActive() override;
+    bool ready() override;
+    int channels() const override;
+
+  private:
+    struct Input {
+        size_t id;
+        shared_ptr<RawSource> src;
+        atomic<float> gain;
+        std::vector<float> pending; // read, not mixed yet
+    };
+
+    const int chans;
+    const size_t frameLen;
+    size_t nextId = 0;
+    std::mutex inputsMux;
+    std::vector<std::unique_ptr<Input>> inputs;
+    std::mutex stateMux;
+    std::condition_variable cv;
+    atomic<State> st{State::Active};
+    Frame buf;
+};
+
+} // namespace aud
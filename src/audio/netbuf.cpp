@@ -1,9 +1,14 @@
-#include "audio.hpp"
 #include "codec.hpp"
+#include "core.hpp"
 #include "log.hpp"
 #include "opus.h"
 #include "opus_defines.h"
+#include "packet.hpp"
+#include "simd.hpp"
 #include <algorithm>
+#include <boost/format.hpp>
+#include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdint>
 #include <cstdio>
@@ -12,68 +17,353 @@
 
 using namespace aud;
 
-NetBuf::NetBuf(size_t depth, int channels) : depth(depth), chans(channels), buf(depth * 2) {
-    int err;
-    dec = opus_decoder_create(aud::SAMPLE_RATE, channels, &err);
-    if (err < 0) {
-        CHAT_LOGE(opus_strerror(err));
-        throw OpusException(err);
+// continuous underrun after which the stream is considered paused and is re-buffered, ms
+static constexpr size_t MAX_STRETCH = 100;
+// time without underruns after which one frame of the underrun boost is released, ms
+static constexpr size_t BOOST_DECAY = 5000;
+// frames below this RMS are dropped or stretched without waiting for a larger deviation
+static constexpr float QUIET_RMS = 0.01;
+// between loss reports, ms
+static constexpr size_t LOSS_INTERVAL = 1000;
+// one-pole lowpass coefficient of the comfort noise, softer than the white one
+static constexpr float NOISE_LP = 0.6;
+static constexpr float PI = 3.14159265358979f;
+
+static int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()
+    )
+        .count();
+}
+
+static size_t framesIn(size_t ms, size_t frameLen) {
+    return std::max<size_t>(1, ms * SAMPLE_RATE / 1000 / frameLen);
+}
+
+static bool isQuiet(const Frame &frame) {
+    return simd::rms(frame.data(), frame.size()) < QUIET_RMS;
+}
+
+NetBuf::NetBuf(size_t maxDepth, int channels, FrameDuration dur)
+    : maxDepth(maxDepth), chans(channels), frameLen(frameSize(dur)), buf(maxDepth * 2),
+      dec(std::make_unique<StreamDec>(channels)), slots(maxDepth * 2) {
+    assert(maxDepth > 0);
+    setFrameLen(frameLen);
+}
+
+NetBuf::~NetBuf() = default;
+
+void NetBuf::setFrameLen(size_t len) {
+    frameLen = len;
+    // interleaved, the same weight for all channels of a sample
+    fadeIn.resize(frameLen * chans);
+    for (size_t i = 0; i < fadeIn.size(); i++) {
+        fadeIn[i] = 0.5f - 0.5f * std::cos(PI * (i / chans + 0.5f) / frameLen);
+    }
+}
+
+bool NetBuf::push(boost::span<const uint8_t> datagram) {
+    MediaPacket mp;
+    if (Bundle::isBundle(datagram)) {
+        bool pushed = false;
+        Bundle::Reader reader(datagram);
+        while (reader.next(mp)) {
+            pushed |= push(mp);
+        }
+        return pushed;
+    }
+    return MediaPacket::parse(datagram, mp) && push(mp);
+}
+
+bool NetBuf::push(const MediaPacket &mp) {
+    if (!isCodec(mp.type()) || mp.payload().size() > MAX_PAYLOAD_SIZE) {
+        return false;
+    }
+    push(mp.payload(), mp.seq(), mp.timestamp(), mp.type());
+    return true;
+}
+
+void NetBuf::push(
+    boost::span<const uint8_t> pack,
+    uint16_t seq,
+    uint32_t timestamp,
+    PayloadType type
+) {
+    assert(pack.size() <= MAX_PAYLOAD_SIZE);
+    Packet p;
+    p.seq = seq;
+    p.timestamp = timestamp;
+    p.arrival = nowUs();
+    p.type = type;
+    p.size = (uint16_t)std::min(pack.size(), MAX_PAYLOAD_SIZE);
+    std::memcpy(p.data, pack.data(), p.size);
+    if (!buf.push(p, p.bytes())) {
+        CHAT_LOGV("netbuf: overflow, the oldest packet is dropped");
+    }
+}
+
+void NetBuf::lockState() {
+    stateMux.lock();
+}
+
+void NetBuf::unlockState() {
+    stateMux.unlock();
+}
+
+void NetBuf::start() {
+    std::lock_guard g(stateMux);
+    st = State::Active;
+    cv.notify_all();
+}
+
+void NetBuf::stop() {
+    std::lock_guard g(stateMux);
+    st = State::Stopped;
+}
+
+State NetBuf::state() {
+    return st;
+}
+
+void NetBuf::waitActive() {
+    std::unique_lock lk(stateMux);
+    while (st == State::Stopped) {
+        cv.wait(lk);
+    }
+}
+
+bool NetBuf::ready() {
+    return true;
+}
+
+int NetBuf::channels() const {
+    return chans;
+}
+
+uint64_t NetBuf::dropped() const {
+    return buf.dropped();
+}
+
+size_t NetBuf::targetDepth() const {
+    return target;
+}
+
+float NetBuf::jitter() const {
+    return jitterMs;
+}
+
+int NetBuf::loss() const {
+    return lossPerc;
+}
+
+uint64_t NetBuf::recovered() const {
+    return recoveredCnt.load(std::memory_order_relaxed);
+}
+
+void NetBuf::countLoss(bool lost) {
+    lossExpected++;
+    lossCount += lost;
+    if (lossExpected < framesIn(LOSS_INTERVAL, frameLen)) {
+        return;
+    }
+    float cur = 100.f * lossCount / lossExpected;
+    // react to the rising loss at once, forget it slowly
+    lossEst = cur > lossEst ? cur : lossEst + (cur - lossEst) / 4;
+    lossExpected = 0;
+    lossCount = 0;
+
+    int perc = (int)std::lround(lossEst);
+    if (perc != lossPerc.exchange(perc) && lossCallback) {
+        lossCallback(perc);
     }
 }
 
-NetBuf::~NetBuf() {
-    opus_decoder_destroy(dec);
+void NetBuf::drain() {
+    while (buf.pop(packBuf)) {
+        // RFC 3550 interarrival jitter, computed in the arrival order
+        if (haveLast) {
+            float d = (float)(packBuf.arrival - lastArrival) * SAMPLE_RATE / 1e6f -
+                      (float)(int32_t)(packBuf.timestamp - lastTimestamp);
+            jitterEst += (std::fabs(d) - jitterEst) / 16;
+        }
+        haveLast = true;
+        lastArrival = packBuf.arrival;
+        lastTimestamp = packBuf.timestamp;
+        insert(packBuf);
+    }
+    jitterMs = jitterEst * 1000 / SAMPLE_RATE;
 }
 
-void NetBuf::push(boost::span<uint8_t> pack) {
-    assert(pack.size() <= MAX_ENCODER_BLOCK_SIZE);
-    std::unique_lock lg(mux);
-    while (buf.full()) {
-        waitRead.wait(lg);
+void NetBuf::insert(const Packet &pack) {
+    if (!started) {
+        started = true;
+        nextSeq = pack.seq;
+        highestSeq = pack.seq;
+    }
+
+    int16_t diff = (int16_t)(pack.seq - nextSeq);
+    if (diff < 0) {
+        return; // too late, already concealed
+    }
+    if ((size_t)diff >= slots.size()) {
+        // the sender restarted or we fell too far behind, resync to the new packet
+        CHAT_LOGV("netbuf: sequence jump, resync");
+        for (auto &s : slots) {
+            s.valid = false;
+        }
+        nextSeq = pack.seq;
+        highestSeq = pack.seq;
+        buffering = true;
+    }
+
+    Slot &s = slots[pack.seq % slots.size()];
+    s.valid = true;
+    std::memcpy(&s.pack, &pack, pack.bytes());
+    if ((int16_t)(pack.seq - highestSeq) > 0) {
+        highestSeq = pack.seq;
+    }
+}
+
+void NetBuf::updateTarget() {
+    size_t jitterFrames = (size_t)std::ceil(3 * jitterEst / frameLen);
+    if (underrunBoost && ++framesSinceUnderrun >= framesIn(BOOST_DECAY, frameLen)) {
+        underrunBoost--;
+        framesSinceUnderrun = 0;
+    }
+    target = std::clamp<size_t>(1 + jitterFrames + underrunBoost, 1, maxDepth);
+}
+
+// frames buffered from nextSeq up to the newest received one
+size_t NetBuf::bufferedFrames() const {
+    int16_t diff = (int16_t)(highestSeq - nextSeq);
+    return (started && diff >= 0) ? (size_t)diff + 1 : 0;
+}
+
+NetBuf::Slot *NetBuf::slotFor(uint16_t seq) {
+    Slot &s = slots[seq % slots.size()];
+    return (s.valid && s.pack.seq == seq) ? &s : nullptr;
+}
+
+// nullptr pack means packet loss, fec decodes the previous frame from the in-band FEC of pack
+void NetBuf::decode(const Packet *pack, Frame &frame, bool fec) {
+    if (!pack) {
+        dec->decode(PayloadType::Opus, {}, frame, frameLen);
+        return;
+    }
+    try {
+        dec->decode(pack->type, {pack->data, pack->size}, frame, frameLen, fec);
+    } catch (const CodecException &ex) {
+        // a broken packet is lost, not the end of the stream
+        CHAT_LOGV(boost::format("netbuf: %1%, concealed") % ex.what());
+        dec->decode(pack->type, {}, frame, frameLen);
+        return;
+    }
+    // the sender changed the frame duration
+    if (frame.size() != frameLen * chans) {
+        setFrameLen(frame.size() / chans);
+    }
+}
+
+void NetBuf::play(Frame &frame) {
+    Slot *cur = slotFor(nextSeq);
+    if (!cur) {
+        if (bufferedFrames() == 0) {
+            // underrun: stretch the audio without consuming the sequence number,
+            // so the packet can still be played if it is just late
+            decode(nullptr, frame);
+            if (consecutiveUnderruns == 0) {
+                underrunBoost = std::min(underrunBoost + 1, maxDepth);
+            }
+            framesSinceUnderrun = 0;
+            if (++consecutiveUnderruns > framesIn(MAX_STRETCH, frameLen)) {
+                // paused, the gap is not jitter
+                buffering = true;
+                haveLast = false;
+            }
+            return;
+        }
+        // lost, there are newer packets: rebuild it from the next one's FEC data if we have it
+        Slot *next = slotFor(nextSeq + 1);
+        decode(next ? &next->pack : nullptr, frame, next != nullptr);
+        if (next && hasFec(next->pack.type)) {
+            recoveredCnt.fetch_add(1, std::memory_order_relaxed);
+        }
+        countLoss(true);
+        nextSeq++;
+        return;
+    }
+    consecutiveUnderruns = 0;
+    countLoss(false);
+
+    decode(&cur->pack, frame);
+    cur->valid = false;
+    nextSeq++;
+    float rms = simd::rms(frame.data(), frame.size());
+    if (rms < QUIET_RMS) {
+        noiseLevel += (rms - noiseLevel) / 8;
+    }
+
+    size_t depth = bufferedFrames();
+    if (depth > target) {
+        // compress: drop a quiet frame right away, a loud one only on a larger excess
+        Slot *next = slotFor(nextSeq);
+        if (next && (depth - target >= 2 || isQuiet(frame))) {
+            decode(&next->pack, frameBuf);
+            next->valid = false;
+            countLoss(false);
+            nextSeq++;
+            if (frameBuf.size() == frame.size()) {
+                simd::crossfade(frame.data(), frameBuf.data(), fadeIn.data(), frame.size());
+            } else {
+                // no crossfade across a change of the frame duration, the first one is dropped
+                std::swap(frame, frameBuf);
+                frame.vad = 1;
+            }
+        }
+    } else if (depth + 1 < target && isQuiet(frame)) {
+        stretchPending = true;
+    }
+}
+
+void NetBuf::comfortNoise(Frame &frame) {
+    frame.resize(frameLen * chans);
+    // uniform white noise has RMS 1/sqrt(3), the lowpass takes sqrt((1 - a) / (1 + a)) of it
+    float scale = noiseLevel * std::sqrt(3.f * (1 + NOISE_LP) / (1 - NOISE_LP));
+    for (float &s : frame) {
+        noiseSeed ^= noiseSeed << 13;
+        noiseSeed ^= noiseSeed >> 17;
+        noiseSeed ^= noiseSeed << 5;
+        float white = (float)noiseSeed / UINT32_MAX * 2 - 1;
+        noiseLp = NOISE_LP * noiseLp + (1 - NOISE_LP) * white;
+        s = noiseLp * scale;
     }
-    buf.push_back();
-    std::copy(pack.begin(), pack.end(), std::back_inserter(buf.back()));
-    waitWrite.notify_one();
 }
 
 void NetBuf::read(Frame &frame) {
-    std::unique_lock lg(mux);
-
-    while (buf.empty()) {
-        waitWrite.wait(lg);
-    }
-
-    frame.resize(FRAME_SIZE * chans);
-    int err = opus_decode_float(
-        dec,
-        buf.front().data(),
-        (int)buf.front().size(),
-        frame.data(),
-        (int)frame.size(),
-        0
-    );
-    if (err < 0) {
-        throw OpusException(err);
-    }
-    buf.pop_front();
-
-    if (buf.size() + 1 > depth) {
-        frameBuf.resize(FRAME_SIZE * chans);
-        int err = opus_decode_float(
-            dec,
-            buf.front().data(),
-            (int)buf.front().size(),
-            frameBuf.data(),
-            (int)frameBuf.size(),
-            0
-        );
-        if (err < 0) {
-            throw OpusException(err);
+    drain();
+    updateTarget();
+
+    frame.vad = 1;
+    if (buffering) {
+        if (!started) {
+            decode(nullptr, frame);
+            frame.vad = 0;
+            return;
         }
-        for (size_t i = 0; i < frame.size(); i++) {
-            frame[i] = (frame[i] + frameBuf[i]) / 2;
+        if (bufferedFrames() < target) {
+            comfortNoise(frame);
+            frame.vad = 0;
+            return;
         }
-        buf.pop_front();
+        buffering = false;
+        consecutiveUnderruns = 0;
+    }
+
+    if (stretchPending) {
+        stretchPending = false;
+        decode(nullptr, frame);
+        return;
     }
-    waitRead.notify_one();
-}
\ No newline at end of file
+
+    play(frame);
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <boost/core/span.hpp>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace aud {
+
+using boost::span;
+
+// the codec of the payload, see withCodec()
+enum class PayloadType : uint8_t {
+    Opus = 0,
+    Pcm16 = 1,
+    Adpcm = 2,
+};
+
+// Which encoding of a simulcast stream a packet carries. The layers of a frame have the same seq
+// and timestamp, so a receiver can be switched between them without a gap.
+enum class Layer : uint8_t {
+    Single = 0, // not simulcast
+    High = 1,
+    Low = 2,
+};
+
+// The fixed header in front of every media datagram, big-endian:
+//
+//   0       1       2       3
+//   V M L . type    seq
+//   timestamp (samples at SAMPLE_RATE)
+//   stream
+//
+// V is the 2-bit version (2), so the first byte is 0x80-0xBF and never the 0xFF of the control
+// datagrams (ReceiverReport, RoomJoin). M marks the first packet after a pause (talk spurt), L is
+// the 2-bit Layer, the rest of the bits are reserved and 0.
+// seq counts the packets sent, a gap is a loss; the timestamp counts the audio, gated silence
+// included. stream tells the streams of the senders apart, it is chosen by the sender.
+struct MediaHeader {
+    static constexpr size_t SIZE = 12;
+    static constexpr uint8_t VERSION = 2;
+
+    PayloadType type = PayloadType::Opus;
+    bool marker = false;
+    Layer layer = Layer::Single;
+    uint16_t seq = 0;
+    uint32_t timestamp = 0;
+    uint32_t stream = 0;
+
+    // out has SIZE bytes at least, the payload follows them
+    void write(span<uint8_t> out) const {
+        assert(out.size() >= SIZE);
+        uint8_t *p = out.data();
+        p[0] = (uint8_t)(VERSION << 6 | (marker ? 0x20 : 0) | (uint8_t)layer << 3);
+        p[1] = (uint8_t)type;
+        p[2] = (uint8_t)(seq >> 8);
+        p[3] = (uint8_t)seq;
+        p[4] = (uint8_t)(timestamp >> 24);
+        p[5] = (uint8_t)(timestamp >> 16);
+        p[6] = (uint8_t)(timestamp >> 8);
+        p[7] = (uint8_t)timestamp;
+        p[8] = (uint8_t)(stream >> 24);
+        p[9] = (uint8_t)(stream >> 16);
+        p[10] = (uint8_t)(stream >> 8);
+        p[11] = (uint8_t)stream;
+    }
+};
+
+// Read-only view of a media datagram, the fields are read in place at their offsets.
+// The datagram must outlive it.
+class MediaPacket {
+  public:
+    static bool isMedia(span<const uint8_t> pack) {
+        return pack.size() >= MediaHeader::SIZE && (pack[0] >> 6) == MediaHeader::VERSION;
+    }
+    // returns false if pack is not a media packet
+    static bool parse(span<const uint8_t> pack, MediaPacket &out) {
+        if (!isMedia(pack)) {
+            return false;
+        }
+        out.p = pack.data();
+        out.len = pack.size();
+        return true;
+    }
+
+    PayloadType type() const {
+        return (PayloadType)p[1];
+    }
+    bool marker() const {
+        return p[0] & 0x20;
+    }
+    Layer layer() const {
+        return (Layer)(p[0] >> 3 & 3);
+    }
+    // whether a receiver of the low or the high layer takes it
+    bool forLayer(bool low) const {
+        return layer() == Layer::Single || (layer() == Layer::Low) == low;
+    }
+    uint16_t seq() const {
+        return (uint16_t)(p[2] << 8 | p[3]);
+    }
+    uint32_t timestamp() const {
+        return (uint32_t)p[4] << 24 | (uint32_t)p[5] << 16 | (uint32_t)p[6] << 8 | p[7];
+    }
+    uint32_t stream() const {
+        return (uint32_t)p[8] << 24 | (uint32_t)p[9] << 16 | (uint32_t)p[10] << 8 | p[11];
+    }
+    span<const uint8_t> payload() const {
+        return {p + MediaHeader::SIZE, len - MediaHeader::SIZE};
+    }
+    MediaHeader header() const {
+        MediaHeader h;
+        h.type = type();
+        h.marker = marker();
+        h.layer = layer();
+        h.seq = seq();
+        h.timestamp = timestamp();
+        h.stream = stream();
+        return h;
+    }
+
+  private:
+    const uint8_t *p = nullptr;
+    size_t len = 0;
+};
+
+// Several media packets in one datagram, for the links where the per-datagram overhead or the
+// packet rate matters more than a frame or two of latency:
+//
+//   0xC0, then for every packet: its size (u16, big-endian), the packet (MediaHeader + payload)
+//
+// The packets keep their headers, so consecutive frames of a stream and the frames of several
+// streams to the same destination bundle alike. 0xC0 is version 3, not a MediaPacket.
+class Bundle {
+  public:
+    static constexpr uint8_t MAGIC = 0xC0;
+    static constexpr size_t ENTRY_OVERHEAD = 2;
+
+    static bool isBundle(span<const uint8_t> datagram) {
+        return !datagram.empty() && datagram[0] == MAGIC;
+    }
+
+    // Iterates the packets of a bundle in place, stops at the first malformed one.
+    class Reader {
+      public:
+        explicit Reader(span<const uint8_t> datagram)
+            : p(datagram.data()), end(datagram.data() + datagram.size()) {
+            if (isBundle(datagram)) {
+                p++;
+            } else {
+                p = end;
+            }
+        }
+        // false at the end
+        bool next(MediaPacket &out) {
+            if (end - p < (ptrdiff_t)ENTRY_OVERHEAD) {
+                return false;
+            }
+            size_t size = (size_t)(p[0] << 8 | p[1]);
+            if ((size_t)(end - p) - ENTRY_OVERHEAD < size ||
+                !MediaPacket::parse({p + ENTRY_OVERHEAD, size}, out)) {
+                p = end;
+                return false;
+            }
+            p += ENTRY_OVERHEAD + size;
+            return true;
+        }
+
+      private:
+        const uint8_t *p;
+        const uint8_t *end;
+    };
+
+    // whether any packet of the bundle is a layer of a simulcast stream
+    static bool isLayered(span<const uint8_t> datagram) {
+        Reader reader(datagram);
+        MediaPacket mp;
+        while (reader.next(mp)) {
+            if (mp.layer() != Layer::Single) {
+                return true;
+            }
+        }
+        return false;
+    }
+    // the packets of the bundle a receiver of the low or the high layer takes, bundled again in
+    // out, which is as large as datagram; empty if there are none
+    static span<const uint8_t> selectLayer(
+        span<const uint8_t> datagram,
+        bool low,
+        span<uint8_t> out
+    ) {
+        Bundle b(out);
+        Reader reader(datagram);
+        MediaPacket mp;
+        while (reader.next(mp)) {
+            if (mp.forLayer(low)) {
+                b.add(mp.header(), mp.payload());
+            }
+        }
+        return b.count() ? b.datagram() : span<const uint8_t>();
+    }
+
+    // Builds a bundle in place in out, which is its capacity.
+    explicit Bundle(span<uint8_t> out) : buf(out) {
+        assert(!out.empty());
+        buf[0] = MAGIC;
+    }
+    // false if the packet does not fit
+    bool add(const MediaHeader &header, span<const uint8_t> payload) {
+        size_t size = MediaHeader::SIZE + payload.size();
+        if (len + ENTRY_OVERHEAD + size > buf.size() || size > UINT16_MAX) {
+            return false;
+        }
+        uint8_t *p = buf.data() + len;
+        p[0] = (uint8_t)(size >> 8);
+        p[1] = (uint8_t)size;
+        header.write({p + ENTRY_OVERHEAD, MediaHeader::SIZE});
+        if (!payload.empty()) {
+            std::memcpy(p + ENTRY_OVERHEAD + MediaHeader::SIZE, payload.data(), payload.size());
+        }
+        len += ENTRY_OVERHEAD + size;
+        cnt++;
+        return true;
+    }
+    size_t count() const {
+        return cnt;
+    }
+    span<const uint8_t> datagram() const {
+        return {buf.data(), len};
+    }
+
+  private:
+    span<uint8_t> buf;
+    size_t len = 1;
+    size_t cnt = 0;
+};
+
+} // namespace aud
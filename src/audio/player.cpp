@@ -1,34 +1,41 @@
 #include "audio.hpp"
+#include "aec.hpp"
 #include "log.hpp"
-#include "portaudiocpp/BlockingStream.hxx"
+#include "resampler.hpp"
+#include "simd.hpp"
 #include "portaudiocpp/DirectionSpecificStreamParameters.hxx"
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <memory>
 #include <mutex>
 #include <portaudiocpp/Exception.hxx>
 #include <string>
-#include <thread>
 
 using namespace aud;
 
+// room for a device buffer next to the queued frame, a short frame alone is less than one
+static constexpr size_t DEVICE_SLACK = 480;
+
 Player::Player(std::shared_ptr<RawSource> src, shared_ptr<Output> out) {
     assert(src);
     assert(out);
-    assert(0 < src->channels() && src->channels() <= getOutputDevice().maxOutputChannels());
     assert(src->channels() == out->channels());
     d = std::make_shared<PlayerData>();
     d->src = src;
     d->out = out;
-    d->waitThreadStart.lock();
-    std::thread(&Player::playerThread, this).detach();
-    d->waitThreadStart.lock(); //wait unlock from playerThread()
+    AudioEngine::instance().add(this);
 }
 
 Player::~Player() {
-    d->deleteFlag = true;
+    AudioEngine::instance().remove(this);
+    d->src->stop();
+    if (d->outStarted) {
+        d->out->stop();
+    }
 }
 
 void Player::start() {
@@ -48,121 +55,225 @@ void Player::setVolume(float percentage) {
     d->volume = percentage / 100;
 }
 
-void Player::playerThread() {
-    auto d = this->d;
-    Frame buf;
-    bool onActiveStart = true;
-    d->waitThreadStart.unlock();
-    while (1) {
-        if (d->deleteFlag) {
-            d->src->stop();
-            return;
+float Player::getVolume() {
+    return d->volume * 100;
+}
+
+bool Player::service() {
+    if (d->finished) {
+        return false;
+    }
+    StateLock sl(*d->src);
+    switch (d->src->state()) {
+    case State::Active: {
+        if (!d->outStarted) {
+            d->outStarted = true;
+            d->out->start();
         }
-        d->src->lockState();
-        switch (d->src->state()) {
-        case State::Active: {
-            d->src->read(buf);
-            d->src->unlockState();
-            std::this_thread::sleep_for(std::chrono::microseconds(1));
-            if (buf.empty())
+        while (d->out->writable() && d->src->ready()) {
+            d->src->read(d->buf);
+            if (d->buf.empty()) {
                 break;
+            }
             float vol = d->volume;
             if (vol != 1) {
-                for (float &v : buf) {
-                    v *= vol;
-                }
-            }
-            if (onActiveStart) {
-                onActiveStart = false;
-                d->out->start();
+                simd::gain(d->buf.data(), d->buf.size(), vol);
             }
-            d->out->write(buf);
-
-        } break;
+            d->out->write(d->buf);
+        }
+    } break;
 
-        case State::Stopped: {
-            d->src->unlockState();
-            if (!onActiveStart) {
-                d->out->stop();
-                onActiveStart = true;
-            }
-            d->src->waitActive();
-        } break;
+    case State::Stopped: {
+        sl.unlock();
+        if (d->outStarted) {
+            d->out->stop();
+            d->outStarted = false;
+        }
+    } break;
 
-        case State::Finalized: {
-            d->src->unlockState();
+    case State::Finalized: {
+        sl.unlock();
+        if (d->outStarted) {
             d->out->stop();
-            if (endOfSourceCallback) {
-                endOfSourceCallback();
-            }
-            return;
-        } break;
+            d->outStarted = false;
         }
+        d->finished = true;
+        return true;
+    } break;
     }
+    return false;
+}
+
+static size_t atRate(size_t frames, int rate) {
+    return rate == SAMPLE_RATE ? frames : frames * rate / SAMPLE_RATE + 2;
 }
 
-PaOutput::PaOutput(int channels) : chans(channels) {
+PaOutput::PaOutput(int channels, Latency latency, FrameDuration dur)
+    : chans(channels), latency(latency), frameLen(aud::frameSize(dur)) {
     assert(0 < channels && channels <= getOutputDevice().maxOutputChannels());
+    setRate(nativeRate(getOutputDevice()));
+    open();
+}
+
+// the stream is closed and write() is out
+void PaOutput::setRate(int deviceRate) {
+    rate = deviceRate;
+    deviceFrameLen = atRate(frameLen, rate);
+    ring = std::make_unique<SampleRing>(
+        (deviceFrameLen + std::max(deviceFrameLen, DEVICE_SLACK)) * chans
+    );
+    rs.reset();
+    if (rate != SAMPLE_RATE) {
+        rs = std::make_unique<Resampler>(SAMPLE_RATE, rate, chans);
+        converted.resize(rs->maxOutput(MAX_FRAME_SIZE) * chans);
+    }
+}
+
+PaOutput::~PaOutput() {
+    std::lock_guard<std::mutex> lg(mux);
+    running = false;
+    stream.close();
+}
+
+void PaOutput::open() {
     portaudio::DirectionSpecificStreamParameters outParams;
     outParams.setDevice(getOutputDevice());
-    outParams.setNumChannels(channels);
+    outParams.setNumChannels(chans);
     outParams.setSampleFormat(portaudio::FLOAT32);
     outParams.setHostApiSpecificStreamInfo(nullptr);
-    outParams.setSuggestedLatency(getOutputDevice().defaultHighOutputLatency());
+    outParams.setSuggestedLatency(
+        latency == Latency::Low ? getOutputDevice().defaultLowOutputLatency()
+                                : getOutputDevice().defaultHighOutputLatency()
+    );
     portaudio::StreamParameters params(
         portaudio::DirectionSpecificStreamParameters::null(),
         outParams,
-        SAMPLE_RATE,
-        FRAME_SIZE,
+        rate,
+        paFramesPerBufferUnspecified,
         paNoFlag
     );
-    stream.open(params);
+    stream.open(params, *this, &PaOutput::callback);
+}
+
+int PaOutput::callback(
+    const void *input,
+    void *output,
+    unsigned long frameCount,
+    const PaStreamCallbackTimeInfo *timeInfo,
+    PaStreamCallbackFlags statusFlags
+) {
+    float *out = static_cast<float *>(output);
+    size_t need = frameCount * chans;
+    size_t got = ring->read(out, need);
+    if (got < need) {
+        std::memset(out + got, 0, (need - got) * sizeof(float));
+        if (primed) {
+            underrunCnt.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else if (statusFlags & paOutputUnderflow) {
+        underrunCnt.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (waiting) {
+        roomCv.notify_one();
+    }
+    return paContinue;
+}
+
+size_t PaOutput::writable() const {
+    if (!running) {
+        return 0;
+    }
+    std::lock_guard<std::mutex> lg(writeMux);
+    return ring->writable() / (deviceFrameLen * chans);
+}
+
+size_t PaOutput::frameSize() const {
+    return frameLen;
 }
 
 int PaOutput::channels() const {
     return chans;
 }
 
+uint64_t PaOutput::underruns() const {
+    return underrunCnt;
+}
+
+void PaOutput::setEchoReference(shared_ptr<EchoCancellerDSP> aec) {
+    echoRef = aec;
+}
+
 void PaOutput::stop() {
     std::lock_guard<std::mutex> lg(mux);
+    running = false;
+    primed = false;
+    {
+        std::lock_guard<std::mutex> rlg(roomMux);
+        roomCv.notify_all();
+    }
     stream.stop();
+    ring->clear(); // the callback is not running anymore, so we are the consumer now
 }
 
 void PaOutput::start() {
     std::lock_guard<std::mutex> lg(mux);
     stream.start();
+    running = true;
 }
 
 void PaOutput::write(Frame &frame) {
-    std::lock_guard<std::mutex> lg(mux);
-    try {
-        stream.write(frame.data(), FRAME_SIZE);
-    } catch (portaudio::PaException &ex) {
-        CHAT_LOGV(std::string("portaudio output: ") + ex.what());
+    if (echoRef) {
+        echoRef->farEnd(frame.data(), frame.size() / chans, chans);
+    }
+    std::lock_guard<std::mutex> wlg(writeMux);
+    SampleRing &ring = *this->ring;
+    const float *data = frame.data();
+    size_t n = frame.size();
+    if (rs) {
+        n = rs->process(frame.data(), frame.size() / chans, converted.data()) * chans;
+        data = converted.data();
     }
+    n = std::min(n, ring.capacity());
+    // keep at most one frame queued on top of the device buffer
+    if (ring.writable() < n) {
+        std::unique_lock<std::mutex> lk(roomMux);
+        waiting = true;
+        while (ring.writable() < n && running) {
+            // the timeout covers a wakeup lost between the check and the wait
+            size_t missing = n - ring.writable();
+            roomCv.wait_for(lk, std::chrono::microseconds(missing / chans * 1000000 / rate + 1));
+        }
+        waiting = false;
+        if (!running) {
+            return; // nobody drains the ring
+        }
+    }
+    ring.write(data, n);
+    primed = true;
 }
 
 void PaOutput::reconf() {
     std::lock_guard<std::mutex> lg(mux);
     bool isActive = stream.isActive();
-    if (isActive) {
-        stream.close();
+    bool wasRunning = running.exchange(false);
+    {
+        // a write() waiting for room gives up
+        std::lock_guard<std::mutex> rlg(roomMux);
+        roomCv.notify_all();
     }
-    portaudio::DirectionSpecificStreamParameters outParams;
-    outParams.setDevice(getOutputDevice());
-    outParams.setNumChannels(chans);
-    outParams.setSampleFormat(portaudio::FLOAT32);
-    outParams.setHostApiSpecificStreamInfo(nullptr);
-    outParams.setSuggestedLatency(getOutputDevice().defaultHighOutputLatency());
-    portaudio::StreamParameters params(
-        portaudio::DirectionSpecificStreamParameters::null(),
-        outParams,
-        SAMPLE_RATE,
-        FRAME_SIZE,
-        paNoFlag
-    );
-    stream.open(params);
+    std::lock_guard<std::mutex> wlg(writeMux);
+    stream.close();
+    // the new default device may run at another rate
+    int deviceRate = nativeRate(getOutputDevice());
+    if (deviceRate != rate) {
+        setRate(deviceRate);
+    } else {
+        ring->clear();
+    }
+    primed = false;
+    open();
     if (isActive) {
         stream.start();
     }
+    running = wasRunning;
 }
@@ -1,40 +1,65 @@
 #include "audio.hpp"
+#include "resampler.hpp"
 #include "portaudiocpp/DirectionSpecificStreamParameters.hxx"
 #include "portaudiocpp/SampleDataFormat.hxx"
+#include <chrono>
 #include <cstring>
 #include <mutex>
 #include <portaudio.h>
 #include <rnnoise.h>
+#include <thread>
 
 using namespace aud;
 
-Recorder::Recorder() {
-    portaudio::DirectionSpecificStreamParameters inParams;
-    inParams.setDevice(getInputDevice());
-    inParams.setNumChannels(1);
-    inParams.setSampleFormat(portaudio::FLOAT32);
-    inParams.setHostApiSpecificStreamInfo(nullptr);
-    inParams.setSuggestedLatency(getInputDevice().defaultLowInputLatency());
-    portaudio::StreamParameters params(
-        inParams,
-        portaudio::DirectionSpecificStreamParameters::null(),
-        SAMPLE_RATE,
-        FRAME_SIZE,
-        paNoFlag
-    );
-    stream.open(params);
+// enough to ride out a stalled consumer for a few frames of any duration
+static constexpr size_t CAPTURE_RING_FRAMES = 8;
+// device frames resampled at once in the callback
+static constexpr size_t CALLBACK_CHUNK = 512;
+
+Recorder::Recorder(CaptureMode mode, FrameDuration dur)
+    : mode(mode), frameLen(aud::frameSize(dur)),
+      ring(MAX_FRAME_SIZE * CAPTURE_RING_FRAMES), processed(MAX_FRAME_SIZE * CAPTURE_RING_FRAMES),
+      processedInfo(CAPTURE_RING_FRAMES) {
+    setRate(mode == CaptureMode::Callback ? nativeRate(getInputDevice()) : SAMPLE_RATE);
+    open();
     st = State::Stopped;
+    if (mode == CaptureMode::Callback) {
+        dspThread = std::thread(&Recorder::dspLoop, this);
+    }
 }
 
 Recorder::~Recorder() {
-    st = State::Finalized;
-    stream.close();
+    {
+        std::lock_guard lg(dspMux);
+        st = State::Finalized;
+        dspCv.notify_all();
+    }
+    if (dspThread.joinable()) {
+        dspThread.join();
+    }
+    stream().close();
     cv.notify_all();
+    readyCv.notify_all();
 }
 
-void Recorder::reconf() {
-    bool isActive = stream.isActive();
-    stream.close();
+// the stream is closed, the callback is the only user of the resampler
+void Recorder::setRate(int deviceRate) {
+    rate = deviceRate;
+    rs.reset();
+    if (rate != SAMPLE_RATE) {
+        rs = std::make_unique<Resampler>(rate, SAMPLE_RATE);
+        converted.resize(rs->maxOutput(CALLBACK_CHUNK));
+    }
+}
+
+portaudio::Stream &Recorder::stream() {
+    if (mode == CaptureMode::Callback) {
+        return callbackStream;
+    }
+    return blockingStream;
+}
+
+void Recorder::open() {
     portaudio::DirectionSpecificStreamParameters inParams;
     inParams.setDevice(getInputDevice());
     inParams.setNumChannels(1);
@@ -44,27 +69,125 @@ void Recorder::reconf() {
     portaudio::StreamParameters params(
         inParams,
         portaudio::DirectionSpecificStreamParameters::null(),
-        SAMPLE_RATE,
-        FRAME_SIZE,
+        rate,
+        mode == CaptureMode::Callback ? paFramesPerBufferUnspecified : frameLen.load(),
         paNoFlag
     );
-    stream.open(params);
+    if (mode == CaptureMode::Callback) {
+        callbackStream.open(params, *this, &Recorder::callback);
+    } else {
+        blockingStream.open(params);
+    }
+}
+
+int Recorder::callback(
+    const void *input,
+    void *output,
+    unsigned long frameCount,
+    const PaStreamCallbackTimeInfo *timeInfo,
+    PaStreamCallbackFlags statusFlags
+) {
+    const float *in = static_cast<const float *>(input);
+    while (frameCount > 0) {
+        size_t take = rs ? std::min<size_t>(frameCount, CALLBACK_CHUNK) : frameCount;
+        const float *data = in;
+        size_t n = take;
+        if (rs) {
+            n = rs->process(in, take, converted.data());
+            data = converted.data();
+        }
+        size_t written = ring.write(data, n);
+        if (written < n) {
+            overflowCnt.fetch_add(n - written, std::memory_order_relaxed);
+        }
+        in += take;
+        frameCount -= take;
+    }
+    if (dspWaiting) {
+        dspCv.notify_one();
+    }
+    return paContinue;
+}
+
+// Callback mode: the DSP stage. Drains the capture ring a frame at a time through the dsps into
+// the processed ring, so a slow consumer of read() does not hold the chain back; if it falls
+// behind by the whole processed ring, the frames are dropped here.
+void Recorder::dspLoop() {
+    Frame frame;
+    uint32_t gen = startGen;
+    std::unique_lock lk(dspMux);
+    while (st != State::Finalized) {
+        size_t n = frameLen;
+        if (st != State::Active) {
+            dspCv.wait(lk);
+            continue;
+        }
+        if (gen != startGen) {
+            // drop what was captured before the last stop
+            gen = startGen;
+            ring.clear();
+        }
+        if (ring.readable() < n) {
+            // the timeout covers a wakeup lost between the check and the wait
+            dspWaiting = true;
+            dspCv.wait_for(
+                lk,
+                std::chrono::microseconds((n - ring.readable()) * 1000000 / SAMPLE_RATE + 1)
+            );
+            dspWaiting = false;
+            continue;
+        }
+        lk.unlock();
+        frame.resize(n);
+        frame.vad = 1;
+        ring.read(frame.data(), n);
+        for (auto &dsp : dsps) {
+            dsp->process(frame);
+        }
+        // the only producer, the room does not shrink in between
+        if (processed.writable() >= n && processedInfo.size() < processedInfo.capacity()) {
+            processed.write(frame.data(), n);
+            processedInfo.push({gen, (uint32_t)n, frame.vad});
+            std::lock_guard rlg(readyMux);
+            readyCv.notify_one();
+        } else {
+            overflowCnt.fetch_add(n, std::memory_order_relaxed);
+        }
+        lk.lock();
+    }
+}
+
+void Recorder::reconf() {
+    bool isActive = stream().isActive();
+    stream().close();
+    if (mode == CaptureMode::Callback) {
+        // the new default device may run at another rate
+        setRate(nativeRate(getInputDevice()));
+    }
+    open();
     if (isActive) {
-        stream.start();
+        stream().start();
     }
 }
 
 void Recorder::start() {
     std::lock_guard g(stateMux);
-    st = State::Active;
-    stream.start();
+    {
+        std::lock_guard lg(dspMux);
+        st = State::Active;
+        startGen++;
+        dspCv.notify_all();
+    }
+    stream().start();
     cv.notify_all();
 }
 
 void Recorder::stop() {
     std::lock_guard g(stateMux);
     st = State::Stopped;
-    stream.stop();    
+    stream().stop();
+    std::lock_guard rlg(readyMux);
+    readyCv.notify_all();
 }
 
 int Recorder::channels() const {
@@ -75,11 +198,63 @@ State Recorder::state() {
     return st;
 }
 
+bool Recorder::ready() {
+    if (st != State::Active) {
+        return true; // read() returns silence at once
+    }
+    if (mode == CaptureMode::Callback) {
+        return !processedInfo.empty();
+    }
+    return blockingStream.availableReadSize() >= (signed long)frameLen;
+}
+
+void Recorder::setFrameDuration(FrameDuration dur) {
+    frameLen = aud::frameSize(dur);
+    if (mode == CaptureMode::Blocking) {
+        reconf(); // the device buffer is a frame
+    }
+}
+
+size_t Recorder::frameSize() const {
+    return frameLen;
+}
+
+uint64_t Recorder::overflows() const {
+    return overflowCnt;
+}
+
 void Recorder::read(Frame &frame) {
-    frame.resize(FRAME_SIZE);
-    stream.read(frame.data(), FRAME_SIZE);
-    for (auto &dsp : dsps) {
-        dsp->process(frame);
+    size_t n = frameLen;
+    frame.vad = 1;
+    if (mode == CaptureMode::Blocking) {
+        frame.resize(n);
+        blockingStream.read(frame.data(), n);
+        for (auto &dsp : dsps) {
+            dsp->process(frame);
+        }
+        return;
+    }
+    Processed info;
+    while (1) {
+        if (processedInfo.pop(info)) {
+            frame.resize(info.len);
+            processed.read(frame.data(), info.len);
+            if (info.gen == startGen) {
+                frame.vad = info.vad;
+                return;
+            }
+            continue; // captured before the last stop
+        }
+        if (st != State::Active) {
+            frame.resize(n);
+            std::memset(frame.data(), 0, n * sizeof(float));
+            frame.vad = 0;
+            return;
+        }
+        std::unique_lock lk(readyMux);
+        if (processedInfo.empty() && st == State::Active) {
+            readyCv.wait_for(lk, std::chrono::microseconds(n * 1000000 / SAMPLE_RATE));
+        }
     }
 }
 
@@ -96,4 +271,4 @@ void Recorder::lockState() {
 
 void Recorder::unlockState() {
     stateMux.unlock();
-}
\ No newline at end of file
+}
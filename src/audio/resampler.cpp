@@ -0,0 +1,172 @@
+#include "resampler.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+using namespace aud;
+
+// filter length per phase at the lower of the rates, longer means a sharper cutoff
+static constexpr size_t TAPS = 32;
+// cutoff relative to the lower Nyquist frequency
+static constexpr double ROLLOFF = 0.92;
+static constexpr double KAISER_BETA = 8.6;
+static constexpr double PI = 3.14159265358979323846;
+
+static double besselI0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+Resampler::Resampler(int inRate, int outRate, int channels)
+    : inR(inRate), outR(outRate), chans(channels) {
+    assert(inRate > 0 && outRate > 0 && channels > 0);
+    size_t g = std::gcd(inRate, outRate);
+    up = outRate / g;
+    down = inRate / g;
+    // downsampling needs the filter as long at the output rate
+    taps = TAPS * std::max<size_t>(1, (down + up - 1) / up);
+
+    // prototype at the upsampled rate
+    size_t len = taps * up;
+    double cutoff = ROLLOFF * 0.5 / std::max(up, down); // cycles per upsampled sample
+    double center = (len - 1) / 2.0;
+    std::vector<double> proto(len);
+    for (size_t n = 0; n < len; n++) {
+        double t = n - center;
+        double sinc = t == 0 ? 2 * cutoff : std::sin(2 * PI * cutoff * t) / (PI * t);
+        double r = t / (center + 1);
+        double window = besselI0(KAISER_BETA * std::sqrt(1 - r * r)) / besselI0(KAISER_BETA);
+        proto[n] = sinc * window * up; // the gain lost to the zero stuffing
+    }
+
+    coefs.resize(up * taps);
+    for (size_t phase = 0; phase < up; phase++) {
+        for (size_t i = 0; i < taps; i++) {
+            coefs[phase * taps + i] = (float)proto[phase + (taps - 1 - i) * up];
+        }
+    }
+    hist.assign(chans, std::vector<float>(taps - 1 + CHUNK));
+    reset();
+}
+
+void Resampler::reset() {
+    for (auto &h : hist) {
+        std::fill(h.begin(), h.end(), 0.f);
+    }
+    pos = (taps - 1) * up;
+}
+
+int Resampler::inRate() const {
+    return inR;
+}
+
+int Resampler::outRate() const {
+    return outR;
+}
+
+size_t Resampler::maxOutput(size_t inFrames) const {
+    return inFrames * up / down + 2;
+}
+
+size_t Resampler::process(const float *in, size_t inFrames, float *out) {
+    size_t produced = 0;
+    while (inFrames > 0) {
+        size_t take = std::min(inFrames, CHUNK);
+        size_t fill = taps - 1 + take;
+        for (int c = 0; c < chans; c++) {
+            float *h = hist[c].data() + taps - 1;
+            for (size_t i = 0; i < take; i++) {
+                h[i] = in[i * chans + c];
+            }
+        }
+
+        // an output needs the input it is centered at, base, and taps - 1 before it
+        for (; pos / up < fill; pos += down, produced++) {
+            size_t base = pos / up;
+            const float *phase = coefs.data() + (pos % up) * taps;
+            for (int c = 0; c < chans; c++) {
+                const float *window = hist[c].data() + base + 1 - taps;
+                out[produced * chans + c] = simd::dot(phase, window, taps);
+            }
+        }
+
+        for (auto &h : hist) {
+            std::memmove(h.data(), h.data() + take, (taps - 1) * sizeof(float));
+        }
+        pos -= take * up;
+        in += take * chans;
+        inFrames -= take;
+    }
+    return produced;
+}
+
+ResamplerDSP::ResamplerDSP(int inRate, int outRate, int channels)
+    : rs(inRate, outRate, channels), chans(channels) {}
+
+void ResamplerDSP::process(Frame &frame) {
+    size_t frames = frame.size() / chans;
+    buf.resize(rs.maxOutput(frames) * chans);
+    size_t n = rs.process(frame.data(), frames, buf.data());
+    buf.resize(n * chans);
+    std::swap(frame, buf);
+    frame.vad = buf.vad;
+}
+
+ResampledSource::ResampledSource(shared_ptr<RawSource> src, int srcRate, size_t frameSize)
+    : src(src), rs(srcRate, SAMPLE_RATE, src->channels()), frameLen(frameSize),
+      pending((frameLen + rs.maxOutput(MAX_FRAME_SIZE)) * src->channels()) {
+    assert(src);
+}
+
+void ResampledSource::read(Frame &frame) {
+    size_t ch = src->channels();
+    while (pendingLen < frameLen) {
+        src->read(in);
+        size_t frames = std::min(in.size() / ch, MAX_FRAME_SIZE);
+        pendingLen += rs.process(in.data(), frames, pending.data() + pendingLen * ch);
+    }
+    frame.resize(frameLen * ch);
+    frame.vad = in.vad;
+    std::memcpy(frame.data(), pending.data(), frameLen * ch * sizeof(float));
+    pendingLen -= frameLen;
+    std::memmove(pending.data(), pending.data() + frameLen * ch, pendingLen * ch * sizeof(float));
+}
+
+void ResampledSource::lockState() {
+    src->lockState();
+}
+
+void ResampledSource::unlockState() {
+    src->unlockState();
+}
+
+void ResampledSource::start() {
+    src->start();
+}
+
+void ResampledSource::stop() {
+    src->stop();
+}
+
+State ResampledSource::state() {
+    return src->state();
+}
+
+void ResampledSource::waitActive() {
+    src->waitActive();
+}
+
+bool ResampledSource::ready() {
+    return pendingLen >= frameLen || src->ready();
+}
+
+int ResampledSource::channels() const {
+    return src->channels();
+}
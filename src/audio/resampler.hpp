@@ -0,0 +1,75 @@
+#pragma once
+
+#include "audio.hpp"
+#include <cstddef>
+#include <vector>
+
+namespace aud {
+
+// Streaming rational resampler (L/M after reducing the rates) with a polyphase Kaiser-windowed
+// sinc filter. The filter is split into L phases at construction, every output sample is then one
+// simd::dot of a phase with the last input samples, so no zeros are ever multiplied.
+// Works on interleaved samples, it keeps its state between the calls and never allocates after
+// the construction.
+class Resampler {
+  public:
+    Resampler(int inRate, int outRate, int channels = 1);
+    // converts all of in, out must have room for maxOutput(inFrames) frames;
+    // returns the number of output frames (samples per channel)
+    size_t process(const float *in, size_t inFrames, float *out);
+    size_t maxOutput(size_t inFrames) const;
+    int inRate() const;
+    int outRate() const;
+    void reset();
+
+  private:
+    static constexpr size_t CHUNK = 256; // input frames per pass
+
+    const int inR;
+    const int outR;
+    const int chans;
+    size_t up;   // L
+    size_t down; // M
+    size_t taps; // per phase
+    std::vector<float> coefs; // [phase][tap], the taps reversed
+    std::vector<std::vector<float>> hist; // per channel, taps - 1 old samples and a chunk
+    size_t pos; // of the next output in the upsampled units from the start of hist
+};
+
+// Resamples the frame in place, so its size changes, e.g. 960 samples at 48 kHz become 882 or 883
+// at 44.1 kHz.
+class ResamplerDSP : public DSP {
+  public:
+    ResamplerDSP(int inRate, int outRate, int channels = 1);
+    void process(Frame &frame) override;
+
+  private:
+    Resampler rs;
+    const int chans;
+    Frame buf;
+};
+
+// Adapts a source running at another rate to SAMPLE_RATE, the frames keep their duration.
+class ResampledSource : public RawSource {
+  public:
+    ResampledSource(shared_ptr<RawSource> src, int srcRate, size_t frameSize = FRAME_SIZE);
+    void read(Frame &frame) override;
+    void lockState() override;
+    void unlockState() override;
+    void start() override;
+    void stop() override;
+    State state() override;
+    void waitActive() override;
+    bool ready() override;
+    int channels() const override;
+
+  private:
+    shared_ptr<RawSource> src;
+    Resampler rs;
+    const size_t frameLen;
+    Frame in;
+    std::vector<float> pending; // converted, not returned yet
+    size_t pendingLen = 0;      // in frames
+};
+
+} // namespace aud
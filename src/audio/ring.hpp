@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+namespace aud {
+
+inline constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Single-producer/single-consumer ring for trivially copyable elements.
+// push() is wait-free and never blocks: when the ring is full the oldest element is dropped.
+// pop() never blocks either, it returns false if there is nothing to read yet.
+// Every slot is guarded by a sequence number, so the consumer detects the producer overwriting
+// the slot it is copying and simply retries with the next oldest element.
+template <typename T> class SpscRing {
+    static_assert(std::is_trivially_copyable_v<T>, "ring elements are copied as raw words");
+
+  public:
+    explicit SpscRing(size_t capacity) : cap(capacity), slots(new Slot[capacity]) {
+        assert(capacity > 0);
+        for (size_t i = 0; i < cap; i++) {
+            slots[i].seq.store(0, std::memory_order_relaxed);
+            slots[i].size.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    // producer only, returns false if the oldest element was dropped to make room; only the first
+    // size bytes of val are copied, pop() leaves the rest of its element as it was
+    bool push(const T &val, size_t size = sizeof(T)) {
+        assert(size <= sizeof(T));
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t t = tail.load(std::memory_order_acquire);
+        bool noDrop = true;
+        if (h - t >= cap) {
+            // if CAS fails the consumer has just taken the oldest one, so there is room anyway
+            if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel)) {
+                droppedCnt.fetch_add(1, std::memory_order_relaxed);
+                noDrop = false;
+            }
+        }
+
+        Slot &s = slots[h % cap];
+        size_t n = (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        uint64_t words[WORDS];
+        if (n > 0) {
+            words[n - 1] = 0;
+        }
+        std::memcpy(words, &val, size);
+        s.seq.store(2 * h + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.size.store(size, std::memory_order_relaxed);
+        for (size_t i = 0; i < n; i++) {
+            s.words[i].store(words[i], std::memory_order_relaxed);
+        }
+        s.seq.store(2 * h + 2, std::memory_order_release);
+        head.store(h + 1, std::memory_order_release);
+        return noDrop;
+    }
+
+    // consumer only
+    bool pop(T &out) {
+        uint64_t words[WORDS];
+        while (true) {
+            uint64_t t = tail.load(std::memory_order_acquire);
+            uint64_t h = head.load(std::memory_order_acquire);
+            if (t == h) {
+                return false;
+            }
+            Slot &s = slots[t % cap];
+            uint64_t seq = s.seq.load(std::memory_order_acquire);
+            if (seq != 2 * t + 2) {
+                continue; // producer lapped us, tail has already moved
+            }
+            // a torn size is caught by the seq check below, it only has to stay in bounds
+            size_t size = std::min(s.size.load(std::memory_order_relaxed), sizeof(T));
+            size_t n = (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+            for (size_t i = 0; i < n; i++) {
+                words[i] = s.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) != seq) {
+                continue;
+            }
+            if (tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel)) {
+                std::memcpy(&out, words, size);
+                return true;
+            }
+        }
+    }
+
+    // approximate when called concurrently with push/pop
+    size_t size() const {
+        uint64_t t = tail.load(std::memory_order_acquire);
+        uint64_t h = head.load(std::memory_order_acquire);
+        return h > t ? (size_t)(h - t) : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t capacity() const {
+        return cap;
+    }
+
+    uint64_t dropped() const {
+        return droppedCnt.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<uint64_t> seq;
+        std::atomic<size_t> size; // bytes of words in use
+        std::atomic<uint64_t> words[WORDS];
+    };
+
+    const size_t cap;
+    std::unique_ptr<Slot[]> slots;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> droppedCnt{0};
+};
+
+// Single-producer/single-consumer FIFO of samples for feeding device callbacks.
+// Unlike SpscRing it never overwrites: write() and read() transfer as much as fits/is available.
+class SampleRing {
+  public:
+    explicit SampleRing(size_t capacity) : cap(capacity), data(new float[capacity]) {
+        assert(capacity > 0);
+    }
+
+    SampleRing(const SampleRing &) = delete;
+    SampleRing &operator=(const SampleRing &) = delete;
+
+    // producer only, returns the number of written samples
+    size_t write(const float *src, size_t n) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        uint64_t t = tail.load(std::memory_order_acquire);
+        n = std::min(n, cap - (size_t)(h - t));
+        size_t pos = h % cap;
+        size_t first = std::min(n, cap - pos);
+        std::memcpy(data.get() + pos, src, first * sizeof(float));
+        std::memcpy(data.get(), src + first, (n - first) * sizeof(float));
+        head.store(h + n, std::memory_order_release);
+        return n;
+    }
+
+    // consumer only, returns the number of read samples
+    size_t read(float *dst, size_t n) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        n = std::min(n, (size_t)(h - t));
+        size_t pos = t % cap;
+        size_t first = std::min(n, cap - pos);
+        std::memcpy(dst, data.get() + pos, first * sizeof(float));
+        std::memcpy(dst + first, data.get(), (n - first) * sizeof(float));
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    // consumer only
+    void clear() {
+        tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+
+    size_t readable() const {
+        uint64_t t = tail.load(std::memory_order_acquire);
+        return (size_t)(head.load(std::memory_order_acquire) - t);
+    }
+
+    size_t writable() const {
+        return cap - readable();
+    }
+
+    size_t capacity() const {
+        return cap;
+    }
+
+  private:
+    const size_t cap;
+    std::unique_ptr<float[]> data;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> head{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> tail{0};
+};
+
+} // namespace aud
@@ -0,0 +1,626 @@
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHAT_SIMD_X86
+#include <immintrin.h>
+#endif
+
+using namespace aud;
+
+static constexpr float S16_SCALE = 32767.f;
+
+// scalar, also handles the tails of the vector variants
+
+static void gainScalar(float *data, size_t n, float gain) {
+    for (size_t i = 0; i < n; i++) {
+        data[i] *= gain;
+    }
+}
+
+static void mixAccScalar(float *dst, const float *src, size_t n, float gain) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] += src[i] * gain;
+    }
+}
+
+static void crossfadeScalar(float *dst, const float *src, const float *ramp, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] += (src[i] - dst[i]) * ramp[i];
+    }
+}
+
+static void toS16Scalar(const float *in, int16_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        float v = std::clamp(in[i] * S16_SCALE, -32768.f, 32767.f);
+        out[i] = (int16_t)std::lrint(v);
+    }
+}
+
+static void fromS16Scalar(const int16_t *in, float *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = in[i] * (1 / S16_SCALE);
+    }
+}
+
+static float peakScalar(const float *data, size_t n) {
+    float m = 0;
+    for (size_t i = 0; i < n; i++) {
+        m = std::max(m, std::fabs(data[i]));
+    }
+    return m;
+}
+
+static float sumSqScalar(const float *data, size_t n) {
+    float s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += data[i] * data[i];
+    }
+    return s;
+}
+
+static float rmsScalar(const float *data, size_t n) {
+    return n ? std::sqrt(sumSqScalar(data, n) / n) : 0;
+}
+
+static float dotScalar(const float *a, const float *b, size_t n) {
+    float s = 0;
+    for (size_t i = 0; i < n; i++) {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+
+// the IMA-ADPCM quantizer steps, int32 for the gathers
+static const int32_t ADPCM_STEPS[simd::ADPCM_MAX_INDEX + 1] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,
+    25,    28,    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,
+    88,    97,    107,   118,   130,   143,   157,   173,   190,   209,   230,   253,   279,
+    307,   337,   371,   408,   449,   494,   544,   598,   658,   724,   796,   876,   963,
+    1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,  2272,  2499,  2749,  3024,  3327,
+    3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,  9493,  10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+// the step index moves down by 1 for the small codes, up by 2-8 for the large ones
+static int32_t adpcmIndexDelta(int32_t magnitude) {
+    return magnitude < 4 ? -1 : 2 * (magnitude - 3);
+}
+
+// the step of the decoder, the encoder tracks it to predict the same
+static void adpcmApply(int32_t code, int32_t &pred, int32_t &index) {
+    int32_t step = ADPCM_STEPS[index];
+    int32_t vpdiff = step >> 3;
+    if (code & 4) {
+        vpdiff += step;
+    }
+    if (code & 2) {
+        vpdiff += step >> 1;
+    }
+    if (code & 1) {
+        vpdiff += step >> 2;
+    }
+    pred = std::clamp(code & 8 ? pred - vpdiff : pred + vpdiff, -32768, 32767);
+    index = std::clamp(index + adpcmIndexDelta(code & 7), 0, simd::ADPCM_MAX_INDEX);
+}
+
+static int32_t adpcmQuantize(int32_t sample, int32_t pred, int32_t index) {
+    int32_t step = ADPCM_STEPS[index];
+    int32_t diff = sample - pred;
+    int32_t code = diff < 0 ? 8 : 0;
+    diff = std::abs(diff);
+    for (int32_t bit = 4; bit; bit >>= 1, step >>= 1) {
+        if (diff >= step) {
+            code |= bit;
+            diff -= step;
+        }
+    }
+    return code;
+}
+
+static void adpcmEncodeScalar(const int16_t *in, size_t n, simd::AdpcmState &st, uint8_t *out) {
+    constexpr size_t L = simd::ADPCM_LANES;
+    for (size_t t = 0; t < n; t++) {
+        for (size_t b = 0; b < L; b += 2) {
+            int32_t lo = adpcmQuantize(in[b * n + t], st.pred[b], st.index[b]);
+            adpcmApply(lo, st.pred[b], st.index[b]);
+            int32_t hi = adpcmQuantize(in[(b + 1) * n + t], st.pred[b + 1], st.index[b + 1]);
+            adpcmApply(hi, st.pred[b + 1], st.index[b + 1]);
+            out[t * L / 2 + b / 2] = (uint8_t)(lo | hi << 4);
+        }
+    }
+}
+
+static void adpcmDecodeScalar(const uint8_t *in, size_t n, simd::AdpcmState &st, int16_t *out) {
+    constexpr size_t L = simd::ADPCM_LANES;
+    for (size_t t = 0; t < n; t++) {
+        for (size_t b = 0; b < L; b++) {
+            adpcmApply(in[t * L / 2 + b / 2] >> (b & 1) * 4 & 15, st.pred[b], st.index[b]);
+            out[b * n + t] = (int16_t)st.pred[b];
+        }
+    }
+}
+
+#ifdef CHAT_SIMD_X86
+
+// SSE2
+
+__attribute__((target("sse2"))) static float hsum128(__m128 v) {
+    __m128 sh = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_add_ps(v, sh);
+    sh = _mm_movehl_ps(sh, v);
+    return _mm_cvtss_f32(_mm_add_ss(v, sh));
+}
+
+__attribute__((target("sse2"))) static float hmax128(__m128 v) {
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(v);
+}
+
+__attribute__((target("sse2"))) static void gainSse2(float *data, size_t n, float gain) {
+    size_t i = 0;
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i), g));
+    }
+    gainScalar(data + i, n - i, gain);
+}
+
+__attribute__((target("sse2"))) static void
+mixAccSse2(float *dst, const float *src, size_t n, float gain) {
+    size_t i = 0;
+    __m128 g = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4) {
+        __m128 s = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), s));
+    }
+    mixAccScalar(dst + i, src + i, n - i, gain);
+}
+
+__attribute__((target("sse2"))) static void
+crossfadeSse2(float *dst, const float *src, const float *ramp, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 d = _mm_loadu_ps(dst + i);
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(src + i), d);
+        _mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(diff, _mm_loadu_ps(ramp + i))));
+    }
+    crossfadeScalar(dst + i, src + i, ramp + i, n - i);
+}
+
+__attribute__((target("sse2"))) static void toS16Sse2(const float *in, int16_t *out, size_t n) {
+    size_t i = 0;
+    __m128 scale = _mm_set1_ps(S16_SCALE);
+    __m128 lo = _mm_set1_ps(-32768.f);
+    __m128 hi = _mm_set1_ps(32767.f);
+    for (; i + 8 <= n; i += 8) {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), lo), hi);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), lo), hi);
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+        _mm_storeu_si128((__m128i *)(out + i), packed);
+    }
+    toS16Scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2"))) static void fromS16Sse2(const int16_t *in, float *out, size_t n) {
+    size_t i = 0;
+    __m128 scale = _mm_set1_ps(1 / S16_SCALE);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+    }
+    fromS16Scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("sse2"))) static float peakSse2(const float *data, size_t n) {
+    size_t i = 0;
+    __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 m = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps(data + i), absMask));
+    }
+    return std::max(hmax128(m), peakScalar(data + i, n - i));
+}
+
+__attribute__((target("sse2"))) static float rmsSse2(const float *data, size_t n) {
+    size_t i = 0;
+    __m128 s = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(data + i);
+        s = _mm_add_ps(s, _mm_mul_ps(v, v));
+    }
+    float sum = hsum128(s) + sumSqScalar(data + i, n - i);
+    return n ? std::sqrt(sum / n) : 0;
+}
+
+__attribute__((target("sse2"))) static float dotSse2(const float *a, const float *b, size_t n) {
+    size_t i = 0;
+    __m128 s = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    return hsum128(s) + dotScalar(a + i, b + i, n - i);
+}
+
+// AVX2
+
+__attribute__((target("avx2,fma"))) static void gainAvx2(float *data, size_t n, float gain) {
+    size_t i = 0;
+    __m256 g = _mm256_set1_ps(gain);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(data + i, _mm256_mul_ps(_mm256_loadu_ps(data + i), g));
+    }
+    gainScalar(data + i, n - i, gain);
+}
+
+__attribute__((target("avx2,fma"))) static void
+mixAccAvx2(float *dst, const float *src, size_t n, float gain) {
+    size_t i = 0;
+    __m256 g = _mm256_set1_ps(gain);
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_fmadd_ps(_mm256_loadu_ps(src + i), g, _mm256_loadu_ps(dst + i));
+        _mm256_storeu_ps(dst + i, d);
+    }
+    mixAccScalar(dst + i, src + i, n - i, gain);
+}
+
+__attribute__((target("avx2,fma"))) static void
+crossfadeAvx2(float *dst, const float *src, const float *ramp, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_loadu_ps(dst + i);
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(src + i), d);
+        _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(diff, _mm256_loadu_ps(ramp + i), d));
+    }
+    crossfadeScalar(dst + i, src + i, ramp + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) static void
+toS16Avx2(const float *in, int16_t *out, size_t n) {
+    size_t i = 0;
+    __m256 scale = _mm256_set1_ps(S16_SCALE);
+    __m256 lo = _mm256_set1_ps(-32768.f);
+    __m256 hi = _mm256_set1_ps(32767.f);
+    for (; i + 16 <= n; i += 16) {
+        __m256 a = _mm256_loadu_ps(in + i);
+        __m256 b = _mm256_loadu_ps(in + i + 8);
+        a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(a, scale), lo), hi);
+        b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(b, scale), lo), hi);
+        // packs works within 128-bit lanes, restore the order afterwards
+        __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+        packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(out + i), packed);
+    }
+    toS16Scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) static void
+fromS16Avx2(const int16_t *in, float *out, size_t n) {
+    size_t i = 0;
+    __m256 scale = _mm256_set1_ps(1 / S16_SCALE);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+    }
+    fromS16Scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx2,fma"))) static float peakAvx2(const float *data, size_t n) {
+    size_t i = 0;
+    __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 m = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        m = _mm256_max_ps(m, _mm256_and_ps(_mm256_loadu_ps(data + i), absMask));
+    }
+    __m128 m4 = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+    return std::max(hmax128(m4), peakScalar(data + i, n - i));
+}
+
+__attribute__((target("avx2,fma"))) static float rmsAvx2(const float *data, size_t n) {
+    size_t i = 0;
+    __m256 s = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(data + i);
+        s = _mm256_fmadd_ps(v, v, s);
+    }
+    __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    float sum = hsum128(s4) + sumSqScalar(data + i, n - i);
+    return n ? std::sqrt(sum / n) : 0;
+}
+
+__attribute__((target("avx2,fma"))) static float dotAvx2(const float *a, const float *b, size_t n) {
+    size_t i = 0;
+    __m256 s = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        s = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s);
+    }
+    __m128 s4 = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    return hsum128(s4) + dotScalar(a + i, b + i, n - i);
+}
+
+// the lanes of the format are the 8 int32 of a register, the steps are gathered by index
+
+__attribute__((target("avx2,fma"))) static __m256i
+adpcmClampAvx2(__m256i v, __m256i lo, __m256i hi) {
+    return _mm256_min_epi32(_mm256_max_epi32(v, lo), hi);
+}
+
+// pred and index after the codes, as adpcmApply()
+__attribute__((target("avx2,fma"))) static void
+adpcmApplyAvx2(__m256i code, __m256i &pred, __m256i &index) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i step = _mm256_i32gather_epi32(ADPCM_STEPS, index, 4);
+    __m256i vpdiff = _mm256_srai_epi32(step, 3);
+    for (int bit = 4; bit; bit >>= 1, step = _mm256_srai_epi32(step, 1)) {
+        __m256i set = _mm256_cmpgt_epi32(_mm256_and_si256(code, _mm256_set1_epi32(bit)), zero);
+        vpdiff = _mm256_add_epi32(vpdiff, _mm256_and_si256(set, step));
+    }
+    __m256i neg = _mm256_cmpgt_epi32(_mm256_and_si256(code, _mm256_set1_epi32(8)), zero);
+    pred = _mm256_blendv_epi8(_mm256_add_epi32(pred, vpdiff), _mm256_sub_epi32(pred, vpdiff), neg);
+    pred = adpcmClampAvx2(pred, _mm256_set1_epi32(-32768), _mm256_set1_epi32(32767));
+
+    __m256i magnitude = _mm256_and_si256(code, _mm256_set1_epi32(7));
+    __m256i three = _mm256_set1_epi32(3);
+    __m256i delta = _mm256_blendv_epi8(
+        _mm256_set1_epi32(-1),
+        _mm256_slli_epi32(_mm256_sub_epi32(magnitude, three), 1),
+        _mm256_cmpgt_epi32(magnitude, three)
+    );
+    index = adpcmClampAvx2(
+        _mm256_add_epi32(index, delta),
+        zero,
+        _mm256_set1_epi32(simd::ADPCM_MAX_INDEX)
+    );
+}
+
+__attribute__((target("avx2,fma"))) static void
+adpcmEncodeAvx2(const int16_t *in, size_t n, simd::AdpcmState &st, uint8_t *out) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i pred = _mm256_loadu_si256((const __m256i *)st.pred);
+    __m256i index = _mm256_loadu_si256((const __m256i *)st.index);
+    alignas(32) uint64_t pairs[4];
+    for (size_t t = 0; t < n; t++) {
+        const int16_t *s = in + t;
+        __m256i x = _mm256_setr_epi32(
+            s[0],
+            s[n],
+            s[2 * n],
+            s[3 * n],
+            s[4 * n],
+            s[5 * n],
+            s[6 * n],
+            s[7 * n]
+        );
+        __m256i step = _mm256_i32gather_epi32(ADPCM_STEPS, index, 4);
+        __m256i diff = _mm256_sub_epi32(x, pred);
+        __m256i code = _mm256_and_si256(_mm256_cmpgt_epi32(zero, diff), _mm256_set1_epi32(8));
+        diff = _mm256_abs_epi32(diff);
+        for (int bit = 4; bit; bit >>= 1, step = _mm256_srai_epi32(step, 1)) {
+            // diff >= step
+            __m256i ge = _mm256_xor_si256(_mm256_cmpgt_epi32(step, diff), _mm256_set1_epi32(-1));
+            code = _mm256_or_si256(code, _mm256_and_si256(ge, _mm256_set1_epi32(bit)));
+            diff = _mm256_sub_epi32(diff, _mm256_and_si256(ge, step));
+        }
+        adpcmApplyAvx2(code, pred, index);
+        // the odd lane of every pair into the high nibble of the even one
+        _mm256_store_si256((__m256i *)pairs, _mm256_or_si256(code, _mm256_srli_epi64(code, 28)));
+        for (size_t k = 0; k < 4; k++) {
+            out[t * 4 + k] = (uint8_t)pairs[k];
+        }
+    }
+    _mm256_storeu_si256((__m256i *)st.pred, pred);
+    _mm256_storeu_si256((__m256i *)st.index, index);
+}
+
+__attribute__((target("avx2,fma"))) static void
+adpcmDecodeAvx2(const uint8_t *in, size_t n, simd::AdpcmState &st, int16_t *out) {
+    __m256i pred = _mm256_loadu_si256((const __m256i *)st.pred);
+    __m256i index = _mm256_loadu_si256((const __m256i *)st.index);
+    // lane b takes the nibble at bit 4b of the 4 bytes of a sample
+    const __m256i shifts = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+    alignas(32) int32_t samples[8];
+    for (size_t t = 0; t < n; t++) {
+        const uint8_t *p = in + t * 4;
+        uint32_t word = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+        __m256i code = _mm256_and_si256(
+            _mm256_srlv_epi32(_mm256_set1_epi32((int32_t)word), shifts),
+            _mm256_set1_epi32(15)
+        );
+        adpcmApplyAvx2(code, pred, index);
+        _mm256_store_si256((__m256i *)samples, pred);
+        for (size_t b = 0; b < 8; b++) {
+            out[b * n + t] = (int16_t)samples[b];
+        }
+    }
+    _mm256_storeu_si256((__m256i *)st.pred, pred);
+    _mm256_storeu_si256((__m256i *)st.index, index);
+}
+
+// AVX-512
+
+// GCC's avx512 headers trip -Wuninitialized when enabled with the target attribute
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f"))) static void gainAvx512(float *data, size_t n, float gain) {
+    size_t i = 0;
+    __m512 g = _mm512_set1_ps(gain);
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(data + i, _mm512_mul_ps(_mm512_loadu_ps(data + i), g));
+    }
+    gainScalar(data + i, n - i, gain);
+}
+
+__attribute__((target("avx512f"))) static void
+mixAccAvx512(float *dst, const float *src, size_t n, float gain) {
+    size_t i = 0;
+    __m512 g = _mm512_set1_ps(gain);
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_fmadd_ps(_mm512_loadu_ps(src + i), g, _mm512_loadu_ps(dst + i));
+        _mm512_storeu_ps(dst + i, d);
+    }
+    mixAccScalar(dst + i, src + i, n - i, gain);
+}
+
+__attribute__((target("avx512f"))) static void
+crossfadeAvx512(float *dst, const float *src, const float *ramp, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 d = _mm512_loadu_ps(dst + i);
+        __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(src + i), d);
+        _mm512_storeu_ps(dst + i, _mm512_fmadd_ps(diff, _mm512_loadu_ps(ramp + i), d));
+    }
+    crossfadeScalar(dst + i, src + i, ramp + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static void
+toS16Avx512(const float *in, int16_t *out, size_t n) {
+    size_t i = 0;
+    __m512 scale = _mm512_set1_ps(S16_SCALE);
+    __m512 lo = _mm512_set1_ps(-32768.f);
+    __m512 hi = _mm512_set1_ps(32767.f);
+    for (; i + 16 <= n; i += 16) {
+        __m512 a = _mm512_mul_ps(_mm512_loadu_ps(in + i), scale);
+        __m512i v = _mm512_cvtps_epi32(_mm512_min_ps(_mm512_max_ps(a, lo), hi));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm512_cvtsepi32_epi16(v));
+    }
+    toS16Scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static void
+fromS16Avx512(const int16_t *in, float *out, size_t n) {
+    size_t i = 0;
+    __m512 scale = _mm512_set1_ps(1 / S16_SCALE);
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)(in + i)));
+        _mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_cvtepi32_ps(v), scale));
+    }
+    fromS16Scalar(in + i, out + i, n - i);
+}
+
+__attribute__((target("avx512f"))) static float peakAvx512(const float *data, size_t n) {
+    size_t i = 0;
+    __m512 m = _mm512_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        m = _mm512_max_ps(m, _mm512_abs_ps(_mm512_loadu_ps(data + i)));
+    }
+    return std::max(_mm512_reduce_max_ps(m), peakScalar(data + i, n - i));
+}
+
+__attribute__((target("avx512f"))) static float rmsAvx512(const float *data, size_t n) {
+    size_t i = 0;
+    __m512 s = _mm512_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        __m512 v = _mm512_loadu_ps(data + i);
+        s = _mm512_fmadd_ps(v, v, s);
+    }
+    float sum = _mm512_reduce_add_ps(s) + sumSqScalar(data + i, n - i);
+    return n ? std::sqrt(sum / n) : 0;
+}
+
+__attribute__((target("avx512f"))) static float
+dotAvx512(const float *a, const float *b, size_t n) {
+    size_t i = 0;
+    __m512 s = _mm512_setzero_ps();
+    for (; i + 16 <= n; i += 16) {
+        s = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), s);
+    }
+    return _mm512_reduce_add_ps(s) + dotScalar(a + i, b + i, n - i);
+}
+
+#pragma GCC diagnostic pop
+
+#endif // CHAT_SIMD_X86
+
+static const simd::Kernels scalarKernels = {
+    "scalar",
+    gainScalar,
+    mixAccScalar,
+    crossfadeScalar,
+    toS16Scalar,
+    fromS16Scalar,
+    peakScalar,
+    rmsScalar,
+    dotScalar,
+    adpcmEncodeScalar,
+    adpcmDecodeScalar,
+};
+
+#ifdef CHAT_SIMD_X86
+static const simd::Kernels sse2Kernels = {
+    "sse2",
+    gainSse2,
+    mixAccSse2,
+    crossfadeSse2,
+    toS16Sse2,
+    fromS16Sse2,
+    peakSse2,
+    rmsSse2,
+    dotSse2,
+    // SSE2 has neither the 32-bit min/max nor the gathers the ADPCM lanes need
+    adpcmEncodeScalar,
+    adpcmDecodeScalar,
+};
+
+static const simd::Kernels avx2Kernels = {
+    "avx2",
+    gainAvx2,
+    mixAccAvx2,
+    crossfadeAvx2,
+    toS16Avx2,
+    fromS16Avx2,
+    peakAvx2,
+    rmsAvx2,
+    dotAvx2,
+    adpcmEncodeAvx2,
+    adpcmDecodeAvx2,
+};
+
+static const simd::Kernels avx512Kernels = {
+    "avx512",
+    gainAvx512,
+    mixAccAvx512,
+    crossfadeAvx512,
+    toS16Avx512,
+    fromS16Avx512,
+    peakAvx512,
+    rmsAvx512,
+    dotAvx512,
+    // the 8 lanes of the format fill an AVX2 register
+    adpcmEncodeAvx2,
+    adpcmDecodeAvx2,
+};
+#endif
+
+std::vector<const simd::Kernels *> simd::supported() {
+    std::vector<const Kernels *> res{&scalarKernels};
+#ifdef CHAT_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        res.push_back(&sse2Kernels);
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        res.push_back(&avx2Kernels);
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        res.push_back(&avx512Kernels);
+    }
+#endif
+    return res;
+}
+
+const simd::Kernels &simd::scalar() {
+    return scalarKernels;
+}
+
+const simd::Kernels &simd::active() {
+    static const Kernels &best = *supported().back();
+    return best;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Vectorized kernels for the per-sample loops. Every kernel has a scalar, SSE2, AVX2 and
+// AVX-512 variant, the best one supported by the CPU is chosen on the first use.
+namespace aud::simd {
+
+// IMA-ADPCM runs this many independent blocks at once, a vector lane each
+inline constexpr size_t ADPCM_LANES = 8;
+inline constexpr int32_t ADPCM_MAX_INDEX = 88; // of the step table
+
+// the predictor and the step index of every lane, carried from frame to frame
+struct AdpcmState {
+    int32_t pred[ADPCM_LANES] = {};
+    int32_t index[ADPCM_LANES] = {};
+};
+
+struct Kernels {
+    const char *name;
+    // data *= gain
+    void (*gain)(float *data, size_t n, float gain);
+    // dst += src * gain
+    void (*mixAcc)(float *dst, const float *src, size_t n, float gain);
+    // dst += (src - dst) * ramp
+    void (*crossfade)(float *dst, const float *src, const float *ramp, size_t n);
+    // [-1, 1] <-> int16, saturating
+    void (*toS16)(const float *in, int16_t *out, size_t n);
+    void (*fromS16)(const int16_t *in, float *out, size_t n);
+    float (*peak)(const float *data, size_t n);
+    float (*rms)(const float *data, size_t n);
+    float (*dot)(const float *a, const float *b, size_t n);
+    // IMA-ADPCM of ADPCM_LANES blocks of n samples, block b is in[b * n, (b + 1) * n); out gets
+    // n * ADPCM_LANES / 2 bytes, sample by sample, lane 2k in the low nibble of a byte and 2k + 1
+    // in the high one
+    void (*adpcmEncode)(const int16_t *in, size_t n, AdpcmState &st, uint8_t *out);
+    void (*adpcmDecode)(const uint8_t *in, size_t n, AdpcmState &st, int16_t *out);
+};
+
+const Kernels &scalar();
+const Kernels &active();
+// all variants the CPU can run, scalar first
+std::vector<const Kernels *> supported();
+
+inline void gain(float *data, size_t n, float g) {
+    active().gain(data, n, g);
+}
+
+inline void mixAcc(float *dst, const float *src, size_t n, float g) {
+    active().mixAcc(dst, src, n, g);
+}
+
+inline void crossfade(float *dst, const float *src, const float *ramp, size_t n) {
+    active().crossfade(dst, src, ramp, n);
+}
+
+inline void toS16(const float *in, int16_t *out, size_t n) {
+    active().toS16(in, out, n);
+}
+
+inline void fromS16(const int16_t *in, float *out, size_t n) {
+    active().fromS16(in, out, n);
+}
+
+inline float peak(const float *data, size_t n) {
+    return active().peak(data, n);
+}
+
+inline float rms(const float *data, size_t n) {
+    return active().rms(data, n);
+}
+
+inline float dot(const float *a, const float *b, size_t n) {
+    return active().dot(a, b, n);
+}
+
+inline void adpcmEncode(const int16_t *in, size_t n, AdpcmState &st, uint8_t *out) {
+    active().adpcmEncode(in, n, st, out);
+}
+
+inline void adpcmDecode(const uint8_t *in, size_t n, AdpcmState &st, int16_t *out) {
+    active().adpcmDecode(in, n, st, out);
+}
+
+} // namespace aud::simd
@@ -8,13 +8,14 @@ namespace aud {
 
 class BufSrc : public RawSource {
   public:
-    BufSrc(float buf[], size_t size, int channels = 1);
+    BufSrc(float buf[], size_t size, int channels = 1, FrameDuration dur = FrameDuration::Ms20);
     void start() override;
     void stop() override;
     State state() override;
     void lockState() override;
     void unlockState() override;
     void waitActive() override; // if src stopped, requires a state check
+    bool ready() override;
     int channels() const override;
     void read(Frame &frame) override;
 
@@ -23,6 +24,7 @@ class BufSrc : public RawSource {
     float *buf;
     size_t size;
     const int chans;
+    const size_t frameLen;
     size_t played = 0;
     std::mutex mux;
     std::mutex stateMux;
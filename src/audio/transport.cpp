@@ -0,0 +1,360 @@
+#include "transport.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <boost/format.hpp>
+#include <cstring>
+#include <utility>
+
+using namespace aud;
+using boost::asio::ip::udp;
+
+// kernel socket buffer, holds a few hundred ms of all the streams of a room
+static constexpr int SOCKET_BUFFER = 1 << 20;
+
+MediaTransport::MediaTransport(const udp::endpoint &remote)
+    : sock(io), remote(remote), expireTimer(io), sendQueue(SEND_QUEUE_SIZE), flushTimer(io) {
+    sock.open(remote.protocol());
+    sock.bind(udp::endpoint(remote.protocol(), 0));
+    sock.set_option(boost::asio::socket_base::receive_buffer_size(SOCKET_BUFFER));
+    // the I/O thread reads what is queued after each completion and never waits in send_to
+    sock.non_blocking(true);
+}
+
+MediaTransport::~MediaTransport() {
+    stop();
+}
+
+void MediaTransport::start() {
+    if (thread.joinable()) {
+        return;
+    }
+    io.restart();
+    work = std::make_unique<decltype(work)::element_type>(io.get_executor());
+    receive();
+    expire();
+    thread = std::thread([this] { io.run(); });
+}
+
+void MediaTransport::stop() {
+    if (!thread.joinable()) {
+        return;
+    }
+    // run() returns once the receive is cancelled and the queue is sent, the open bundle included
+    boost::asio::post(io, [this] {
+        sock.cancel();
+        flushTimer.cancel();
+        expireTimer.cancel();
+        bool post = false;
+        {
+            std::lock_guard lg(sendMux);
+            commitBundleLocked(post);
+        }
+        if (post) {
+            boost::asio::post(io, [this] { drain(); });
+        }
+    });
+    work.reset();
+    thread.join();
+}
+
+uint16_t MediaTransport::localPort() const {
+    return sock.local_endpoint().port();
+}
+
+void MediaTransport::addStream(uint32_t stream, shared_ptr<NetBuf> nb) {
+    std::lock_guard lg(streamsMux);
+    streams[stream] = {std::move(nb)};
+}
+
+void MediaTransport::removeStream(uint32_t stream) {
+    std::lock_guard lg(streamsMux);
+    streams.erase(stream);
+}
+
+uint64_t MediaTransport::received() const {
+    return receivedCnt.load(std::memory_order_relaxed);
+}
+
+uint64_t MediaTransport::dropped() const {
+    return droppedCnt.load(std::memory_order_relaxed);
+}
+
+void MediaTransport::setStreamTimeout(std::chrono::milliseconds timeout) {
+    streamTimeout = timeout;
+}
+
+void MediaTransport::receive() {
+    sock.async_receive_from(
+        boost::asio::buffer(recvBuf),
+        from,
+        [this](const boost::system::error_code &ec, size_t size) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            if (!ec) {
+                dispatch(size);
+            }
+            // take what else is queued in the socket before waiting again
+            boost::system::error_code err;
+            while (1) {
+                size = sock.receive_from(boost::asio::buffer(recvBuf), from, 0, err);
+                if (err) {
+                    break;
+                }
+                dispatch(size);
+            }
+            receive();
+        }
+    );
+}
+
+void MediaTransport::dispatch(size_t size) {
+    receivedCnt.fetch_add(1, std::memory_order_relaxed);
+    if (size > MAX_DATAGRAM_SIZE || from != remote) {
+        droppedCnt.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    span<const uint8_t> datagram(recvBuf, size);
+    MediaPacket mp;
+    if (Bundle::isBundle(datagram)) {
+        // the packets may be of different streams
+        Bundle::Reader reader(datagram);
+        while (reader.next(mp)) {
+            dispatch(mp, {});
+        }
+        return;
+    }
+    if (!MediaPacket::parse(datagram, mp)) {
+        if (onControl) {
+            onControl(datagram);
+        }
+        return;
+    }
+    dispatch(mp, datagram);
+}
+
+// datagram is the one of mp, or empty if it came in a bundle
+void MediaTransport::dispatch(const MediaPacket &mp, span<const uint8_t> datagram) {
+    auto push = [&](NetBuf &nb) {
+        if (datagram.empty()) {
+            nb.push(mp);
+        } else {
+            nb.push(datagram);
+        }
+    };
+    {
+        std::lock_guard lg(streamsMux);
+        auto it = streams.find(mp.stream());
+        if (it != streams.end()) {
+            it->second.seen = true;
+            push(*it->second.nb);
+            return;
+        }
+    }
+    auto nb = onStream ? onStream(mp.stream()) : nullptr;
+    if (!nb) {
+        droppedCnt.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    CHAT_LOGI(boost::format("transport: new stream %1%") % mp.stream());
+    push(*nb);
+    std::lock_guard lg(streamsMux);
+    streams[mp.stream()] = {std::move(nb), true};
+}
+
+// the I/O thread, every streamTimeout drops the streams of onStream not seen since the last time
+void MediaTransport::expire() {
+    std::vector<std::pair<uint32_t, shared_ptr<NetBuf>>> ended;
+    {
+        std::lock_guard lg(streamsMux);
+        for (auto it = streams.begin(); it != streams.end();) {
+            if (it->second.learned && !it->second.seen) {
+                ended.emplace_back(it->first, std::move(it->second.nb));
+                it = streams.erase(it);
+            } else {
+                it->second.seen = false;
+                ++it;
+            }
+        }
+    }
+    for (auto &[stream, nb] : ended) {
+        CHAT_LOGI(boost::format("transport: stream %1% ended") % stream);
+        if (onStreamEnd) {
+            onStreamEnd(stream, std::move(nb));
+        }
+    }
+    expireTimer.expires_after(streamTimeout);
+    expireTimer.async_wait([this](const boost::system::error_code &ec) {
+        if (!ec) {
+            expire();
+        }
+    });
+}
+
+bool MediaTransport::send(const MediaHeader &header, span<const uint8_t> payload) {
+    bool ok;
+    bool post = false;
+    uint64_t opened = 0;
+    std::chrono::milliseconds wait;
+    {
+        std::lock_guard lg(sendMux);
+        if (aggregation > 1) {
+            uint64_t gen = bundleGen;
+            ok = bundleLocked(header, payload, post);
+            if (bundleGen != gen) {
+                opened = bundleGen;
+                wait = window;
+            }
+        } else {
+            uint8_t head[MediaHeader::SIZE];
+            header.write(head);
+            ok = enqueueLocked(head, payload, post);
+        }
+    }
+    if (post) {
+        boost::asio::post(io, [this] { drain(); });
+    }
+    if (opened) {
+        boost::asio::post(io, [this, opened, wait] { arm(opened, wait); });
+    }
+    return ok;
+}
+
+bool MediaTransport::send(span<const uint8_t> datagram) {
+    bool ok;
+    bool post = false;
+    {
+        std::lock_guard lg(sendMux);
+        ok = enqueueLocked({}, datagram, post);
+    }
+    if (post) {
+        boost::asio::post(io, [this] { drain(); });
+    }
+    return ok;
+}
+
+void MediaTransport::setAggregation(size_t frames, FrameDuration dur) {
+    bool post = false;
+    {
+        std::lock_guard lg(sendMux);
+        commitBundleLocked(post);
+        aggregation = std::max<size_t>(frames, 1);
+        window = std::chrono::milliseconds(frames * frameSize(dur) * 1000 / SAMPLE_RATE);
+    }
+    if (post) {
+        boost::asio::post(io, [this] { drain(); });
+    }
+}
+
+// post is set if the I/O thread is to be woken up
+bool MediaTransport::enqueueLocked(
+    span<const uint8_t> header,
+    span<const uint8_t> payload,
+    bool &post
+) {
+    size_t size = header.size() + payload.size();
+    if (sendCnt == sendQueue.size() || size > MAX_DATAGRAM_SIZE) {
+        droppedCnt.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    Datagram &d = sendQueue[(sendHead + sendCnt) % sendQueue.size()];
+    if (!header.empty()) {
+        std::memcpy(d.data, header.data(), header.size());
+    }
+    std::memcpy(d.data + header.size(), payload.data(), payload.size());
+    d.size = size;
+    sendCnt++;
+    post |= !drainPosted;
+    drainPosted = true;
+    return true;
+}
+
+// a new bundle gets the next bundleGen
+bool MediaTransport::bundleLocked(
+    const MediaHeader &header,
+    span<const uint8_t> payload,
+    bool &post
+) {
+    if (bundle && !bundle->add(header, payload)) {
+        commitBundleLocked(post); // full, the packet opens the next one
+    }
+    if (!bundle) {
+        bundle.emplace(span<uint8_t>(pending.data, MAX_DATAGRAM_SIZE));
+        bundleStream = header.stream;
+        bundled = 0;
+        bundleGen++;
+        if (!bundle->add(header, payload)) {
+            bundle.reset();
+            droppedCnt.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    // the low layer of a simulcast stream is a copy of a frame, not one more
+    if (header.stream == bundleStream && header.layer != Layer::Low && ++bundled == aggregation) {
+        commitBundleLocked(post);
+    }
+    return true;
+}
+
+void MediaTransport::commitBundleLocked(bool &post) {
+    if (!bundle) {
+        return;
+    }
+    auto datagram = bundle->datagram();
+    if (bundle->count() == 1) {
+        // a lone packet goes as it is
+        datagram = datagram.subspan(1 + Bundle::ENTRY_OVERHEAD);
+    }
+    enqueueLocked({}, datagram, post);
+    bundle.reset();
+}
+
+// the I/O thread
+void MediaTransport::arm(uint64_t gen, std::chrono::milliseconds wait) {
+    flushTimer.expires_after(wait);
+    flushTimer.async_wait([this, gen](const boost::system::error_code &ec) {
+        if (!ec) {
+            flush(gen);
+        }
+    });
+}
+
+// the I/O thread, the bundle gen is sent if it is still open
+void MediaTransport::flush(uint64_t gen) {
+    bool post = false;
+    {
+        std::lock_guard lg(sendMux);
+        if (bundleGen == gen) {
+            commitBundleLocked(post);
+        }
+    }
+    if (post) {
+        drain();
+    }
+}
+
+// the I/O thread; the head of the queue is not touched by enqueue() until it is popped
+void MediaTransport::drain() {
+    while (1) {
+        Datagram *d;
+        {
+            std::lock_guard lg(sendMux);
+            if (sendCnt == 0) {
+                drainPosted = false;
+                return;
+            }
+            d = &sendQueue[sendHead];
+        }
+        boost::system::error_code ec;
+        sock.send_to(boost::asio::buffer(d->data, d->size), remote, 0, ec);
+        if (ec) {
+            // would block, or the remote is unreachable for now; real time data is not retried
+            CHAT_LOGV(boost::format("transport: send: %1%") % ec.message());
+            droppedCnt.fetch_add(1, std::memory_order_relaxed);
+        }
+        std::lock_guard lg(sendMux);
+        sendHead = (sendHead + 1) % sendQueue.size();
+        sendCnt--;
+    }
+}
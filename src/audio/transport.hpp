@@ -0,0 +1,126 @@
+#pragma once
+
+#include "audio.hpp"
+#include "packet.hpp"
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace aud {
+
+// larger datagrams are dropped, nothing the peers send comes close
+inline constexpr size_t MAX_DATAGRAM_SIZE = 1500;
+// datagrams waiting for the I/O thread, the newer ones are dropped when it is full
+inline constexpr size_t SEND_QUEUE_SIZE = 64;
+// a stream of onStream without a datagram for this long is dropped, see onStreamEnd
+inline constexpr auto STREAM_TIMEOUT = std::chrono::seconds(3);
+
+// The UDP transport of a client, one I/O thread (an io_context) for all of its streams.
+// Only the datagrams from the remote are taken, the others are dropped.
+// The media datagrams (MediaPacket) are pushed into the NetBuf of their stream, the packets of a
+// Bundle each into their own, the rest (the receiver reports) go to onControl. send() only queues
+// the datagram for the I/O thread, so the capture thread never waits for the socket.
+// With setAggregation() the media packets are sent in bundles, for the links that pay more for a
+// datagram than for a few frames of latency.
+// The buffers are preallocated, nothing is allocated per datagram.
+// The callbacks are set before start() and are called from the I/O thread.
+class MediaTransport {
+  public:
+    // the datagrams go to remote, a local port is picked
+    explicit MediaTransport(const boost::asio::ip::udp::endpoint &remote);
+    ~MediaTransport();
+    MediaTransport(const MediaTransport &) = delete;
+    MediaTransport &operator=(const MediaTransport &) = delete;
+    void start();
+    void stop();
+    uint16_t localPort() const;
+    // may be called from any thread
+    void addStream(uint32_t stream, shared_ptr<NetBuf> nb);
+    void removeStream(uint32_t stream);
+    // queue a datagram, from any thread; false if it was dropped as the queue is full
+    bool send(const MediaHeader &header, span<const uint8_t> payload);
+    bool send(span<const uint8_t> datagram);
+    // bundle the media packets until frames of the stream of the first one are in, or the
+    // bundle is full; 1 turns it off. A bundle is sent at most frames * dur after its first
+    // packet, so a pause does not hold the last frames back.
+    void setAggregation(size_t frames, FrameDuration dur = FrameDuration::Ms20);
+    // STREAM_TIMEOUT by default, before start()
+    void setStreamTimeout(std::chrono::milliseconds timeout);
+    uint64_t received() const; // datagrams
+    uint64_t dropped() const;  // received for no stream, or not sent
+
+    // the first datagram of a stream without a NetBuf, returns the one to add or nullptr to
+    // drop the datagram
+    std::function<shared_ptr<NetBuf>(uint32_t stream)> onStream;
+    // a stream of onStream is dropped after a timeout to twice it without a datagram, the ones
+    // of addStream stay until removeStream
+    std::function<void(uint32_t stream, shared_ptr<NetBuf> nb)> onStreamEnd;
+    std::function<void(span<const uint8_t> datagram)> onControl;
+
+  private:
+    struct Datagram {
+        size_t size;
+        uint8_t data[MAX_DATAGRAM_SIZE];
+    };
+    struct Stream {
+        shared_ptr<NetBuf> nb;
+        bool learned = false; // of onStream, it expires
+        bool seen = true;     // a datagram since the last expire()
+    };
+
+    void receive();
+    void dispatch(size_t size);
+    void dispatch(const MediaPacket &mp, span<const uint8_t> datagram);
+    bool enqueueLocked(span<const uint8_t> header, span<const uint8_t> payload, bool &post);
+    bool bundleLocked(const MediaHeader &header, span<const uint8_t> payload, bool &post);
+    void commitBundleLocked(bool &post);
+    void flush(uint64_t gen);
+    void arm(uint64_t gen, std::chrono::milliseconds window);
+    void drain();
+    void expire();
+
+    boost::asio::io_context io;
+    boost::asio::ip::udp::socket sock;
+    const boost::asio::ip::udp::endpoint remote;
+    boost::asio::ip::udp::endpoint from;
+    std::unique_ptr<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work;
+    std::thread thread;
+    // one more byte than a datagram may have, to tell the truncated ones
+    uint8_t recvBuf[MAX_DATAGRAM_SIZE + 1];
+
+    std::mutex streamsMux;
+    std::unordered_map<uint32_t, Stream> streams;
+    std::chrono::milliseconds streamTimeout = STREAM_TIMEOUT;
+    boost::asio::steady_timer expireTimer; // the I/O thread
+
+    std::mutex sendMux;
+    std::vector<Datagram> sendQueue;
+    size_t sendHead = 0;
+    size_t sendCnt = 0;
+    bool drainPosted = false;
+
+    // the bundle being filled, guarded by sendMux too
+    size_t aggregation = 1;
+    std::chrono::milliseconds window{0};
+    Datagram pending;
+    std::optional<Bundle> bundle;
+    uint32_t bundleStream = 0;
+    size_t bundled = 0;  // packets of bundleStream
+    uint64_t bundleGen = 0;
+    boost::asio::steady_timer flushTimer; // the I/O thread
+
+    atomic<uint64_t> receivedCnt{0};
+    atomic<uint64_t> droppedCnt{0};
+};
+
+} // namespace aud
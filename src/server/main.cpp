@@ -0,0 +1,85 @@
+#include "log.hpp"
+#include "relay.hpp"
+#include <boost/format.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace chat;
+
+static constexpr auto REPORT_PERIOD = std::chrono::seconds(10);
+
+static void report(const char *who, const server::RelayStats &cur, const server::RelayStats &last) {
+    double secs = std::chrono::duration<double>(REPORT_PERIOD).count();
+    double cpu = cur.cpuSeconds - last.cpuSeconds;
+    uint64_t in = cur.received - last.received;
+    uint64_t out = cur.sent - last.sent;
+    uint64_t calls = cur.recvCalls - last.recvCalls + cur.sendCalls - last.sendCalls;
+    double perCall = (double)(in + out) / std::max<uint64_t>(1, calls);
+    CHAT_LOGI(
+        boost::format(
+            "%1%: %2% users, %3% rooms, in %4% pps, out %5% pps, handed off %6% pps, "
+            "%7% packets per core-second, %8% packets per syscall, %9% frames encoded per second"
+        ) %
+        who % cur.users % cur.rooms % (uint64_t)(in / secs) % (uint64_t)(out / secs) %
+        (uint64_t)((cur.handedOff - last.handedOff) / secs) %
+        (uint64_t)(cpu > 0 ? (in + out) / cpu : 0) % perCall %
+        (uint64_t)((cur.encoded - last.encoded) / secs)
+    );
+}
+
+int main(int argc, char **argv) {
+    global_logger.setFilter(
+        [](Logger::Severity severity, const char *file, long line, const std::string &msg) {
+            return severity <= Logger::Severity::INFO;
+        }
+    );
+    global_logger.setOutput(&std::cerr);
+    auto mode = server::RelayMode::Forward;
+    size_t speakers = server::DEFAULT_SPEAKERS;
+    std::vector<const char *> args;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--mix") == 0) {
+            mode = server::RelayMode::Mix;
+        } else if (std::strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            mode = server::RelayMode::TopK;
+            speakers = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    if (args.empty()) {
+        std::cerr << "usage: " << argv[0]
+                  << " [--mix | --top <k>] <port> [workers, a core each by default]" << std::endl
+                  << "  --mix      mix the rooms on the server, the clients get a single stream"
+                  << std::endl
+                  << "  --top <k>  forward only the k loudest speakers of a room" << std::endl;
+        return 1;
+    }
+    size_t workers = args.size() >= 2 ? std::strtoul(args[1], nullptr, 10)
+                                      : std::max(1u, std::thread::hardware_concurrency());
+
+    server::Relay relay(std::atoi(args[0]), workers, true, mode, speakers);
+    std::thread loop([&] { relay.run(); });
+    const char *what = mode == server::RelayMode::Mix    ? "mixing"
+                       : mode == server::RelayMode::TopK ? "relaying the loudest speakers"
+                                                         : "relaying";
+    CHAT_LOGI(boost::format("%1% on port %2%, %3% workers") % what % relay.port() % workers);
+
+    std::vector<server::RelayStats> last(relay.workers());
+    while (1) {
+        std::this_thread::sleep_for(REPORT_PERIOD);
+        server::RelayStats total, lastTotal;
+        for (size_t i = 0; i < relay.workers(); i++) {
+            auto cur = relay.stats(i);
+            report(("worker " + std::to_string(i)).c_str(), cur, last[i]);
+            total += cur;
+            lastTotal += last[i];
+            last[i] = cur;
+        }
+        report("total", total, lastTotal);
+    }
+}
@@ -0,0 +1,137 @@
+#include "mcu.hpp"
+#include "audio/simd.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace chat::server;
+
+RoomMix::RoomMix() : shared(aud::EncoderPreset::Voise, 1) {}
+
+void RoomMix::add() {
+    channels.push_back(std::make_unique<Channel>());
+    channels.back()->pending.reserve(aud::MAX_FRAME_SIZE + aud::FRAME_SIZE);
+    outputs.emplace_back();
+}
+
+void RoomMix::remove(size_t slot) {
+    if (channels[slot]->talking) {
+        talkerCnt--;
+    }
+    channels[slot] = std::move(channels.back());
+    channels.pop_back();
+    outputs.pop_back();
+}
+
+void RoomMix::push(size_t slot, const uint8_t *data, size_t size) {
+    aud::span<const uint8_t> datagram(data, size);
+    auto &in = channels[slot]->in;
+    // the high layer of a simulcast sender, the mix is encoded again anyway
+    aud::MediaPacket mp;
+    if (aud::Bundle::isBundle(datagram)) {
+        aud::Bundle::Reader reader(datagram);
+        while (reader.next(mp)) {
+            if (mp.forLayer(false)) {
+                in.push(mp);
+            }
+        }
+    } else if (aud::MediaPacket::parse(datagram, mp) && mp.forLayer(false)) {
+        in.push(mp);
+    }
+}
+
+size_t RoomMix::talkers() const {
+    return talkerCnt;
+}
+
+uint64_t RoomMix::encoded() const {
+    return encodedCnt;
+}
+
+// the next FRAME_SIZE of the member into its frame, the vad is the highest of the frames in it
+void RoomMix::read(Channel &c) {
+    float vad = c.pending.empty() ? 0 : c.pendingVad;
+    while (c.pending.size() < aud::FRAME_SIZE) {
+        c.in.read(c.frame); // a packet it cannot decode is concealed
+        if (c.frame.empty()) {
+            break;
+        }
+        vad = std::max(vad, c.frame.vad);
+        c.pendingVad = c.frame.vad;
+        c.pending.insert(c.pending.end(), c.frame.begin(), c.frame.end());
+    }
+    size_t n = std::min(c.pending.size(), aud::FRAME_SIZE);
+    c.frame.resize(n);
+    std::memcpy(c.frame.data(), c.pending.data(), n * sizeof(float));
+    c.frame.vad = vad;
+    c.pending.erase(c.pending.begin(), c.pending.begin() + n);
+}
+
+void RoomMix::encode(aud::OpusEnc &enc, const aud::Frame &src, std::vector<uint8_t> &packet) {
+    out.resize(src.size());
+    std::memcpy(out.data(), src.data(), src.size() * sizeof(float));
+    clip.process(out);
+    enc.encode(out, packet);
+    encodedCnt++;
+}
+
+const std::vector<RoomMix::Output> &RoomMix::mix() {
+    sum.resize(aud::FRAME_SIZE);
+    std::memset(sum.data(), 0, sum.size() * sizeof(float));
+    size_t activeCnt = 0;
+    for (auto &c : channels) {
+        read(*c);
+        c->active = c->frame.size() == sum.size() && c->frame.vad > 0 &&
+                    aud::simd::rms(c->frame.data(), c->frame.size()) >= TALK_RMS;
+        if (c->active) {
+            aud::simd::mixAcc(sum.data(), c->frame.data(), sum.size(), 1);
+            activeCnt++;
+            if (!c->talking) {
+                talkerCnt++;
+            }
+            c->talking = TALK_HANGOVER;
+        } else if (c->talking && --c->talking == 0) {
+            talkerCnt--;
+        }
+    }
+
+    bool sharedDone = false;
+    for (size_t i = 0; i < channels.size(); i++) {
+        Channel &c = *channels[i];
+        Output &o = outputs[i];
+        o.payload = nullptr;
+        if (activeCnt == 0 || (c.active && activeCnt == 1)) {
+            c.paused = true; // silence, the client plays its comfort noise
+            continue;
+        }
+        if (!c.talking) {
+            if (!sharedDone) {
+                encode(shared, sum, packet);
+                sharedDone = true;
+            }
+            o.payload = &packet;
+        } else {
+            if (!c.enc) {
+                c.enc = std::make_unique<aud::OpusEnc>(aud::EncoderPreset::Voise, 1);
+            }
+            if (c.active) {
+                // the sum less the talker, into its own frame, which is not needed anymore
+                aud::simd::gain(c.frame.data(), sum.size(), -1);
+                aud::simd::mixAcc(c.frame.data(), sum.data(), sum.size(), 1);
+                encode(*c.enc, c.frame, c.packet);
+            } else {
+                encode(*c.enc, sum, c.packet);
+            }
+            o.payload = &c.packet;
+        }
+        aud::MediaHeader h;
+        h.marker = c.paused;
+        h.seq = c.seq++;
+        h.timestamp = timestamp;
+        h.stream = MIX_STREAM;
+        h.write(c.header);
+        o.header = c.header;
+        c.paused = false;
+    }
+    timestamp += (uint32_t)aud::FRAME_SIZE;
+    return outputs;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "audio/core.hpp"
+#include "audio/codec.hpp"
+#include "audio/packet.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace chat::server {
+
+// a member is a talker while its audio is above this RMS and for TALK_HANGOVER frames after
+inline constexpr float TALK_RMS = 0.01;
+inline constexpr size_t TALK_HANGOVER = 25;
+// the stream id of the mix in the media headers
+inline constexpr uint32_t MIX_STREAM = 0;
+
+// The server side mix of a room, RelayMode::Mix.
+// The datagrams of every member go into its own jitter buffer (NetBuf, which also decodes and
+// conceals), every FRAME_SIZE the room is mixed: the listeners share one mix of all the talkers,
+// encoded once; a talker gets the mix without itself (minus-one) from its own encoder. So a room
+// of N members with K talkers costs N decodes and at most K + 1 encodes, and every client
+// decodes a single stream.
+// A member switching between the shared and its own encoder continues in another Opus stream,
+// its decoder takes it with a short glitch; the talker's encoder is kept for the next time.
+// The media header is per member, so every member sees one stream (MIX_STREAM) with contiguous
+// sequence numbers whichever encoder it comes from.
+// A member may send other frame durations than FRAME_SIZE: its jitter buffer is read until the
+// frame is full, what is left of a longer frame goes into the next mix.
+// The slots are the ones of the room's members, not thread-safe.
+class RoomMix {
+  public:
+    // a datagram for a member in two pieces, its own header and the payload the listeners share
+    struct Output {
+        const uint8_t *header = nullptr;               // MediaHeader::SIZE bytes
+        const std::vector<uint8_t> *payload = nullptr; // nullptr when there is nothing to hear
+    };
+
+    RoomMix();
+    // the new member takes the next slot
+    void add();
+    // the last member moves to slot
+    void remove(size_t slot);
+    // a media datagram (MediaPacket) or a Bundle of the slot's, anything else is ignored
+    void push(size_t slot, const uint8_t *data, size_t size);
+    // mixes the next frame; the result is the datagram for every slot, valid until the next mix()
+    const std::vector<Output> &mix();
+    size_t talkers() const;
+    uint64_t encoded() const; // frames
+
+  private:
+    struct Channel {
+        aud::NetBuf in;
+        std::unique_ptr<aud::OpusEnc> enc; // its minus-one, since it first talked
+        size_t talking = 0;                // frames of the hangover left
+        bool active = false;               // in the current mix
+        aud::Frame frame;
+        std::vector<float> pending; // decoded, not mixed yet
+        float pendingVad = 0;       // of the frame pending is from
+        std::vector<uint8_t> packet;
+        uint16_t seq = 0;   // of its stream
+        bool paused = true; // nothing was sent in the last frame
+        uint8_t header[aud::MediaHeader::SIZE];
+    };
+
+    void read(Channel &c);
+    void encode(aud::OpusEnc &enc, const aud::Frame &src, std::vector<uint8_t> &packet);
+
+    std::vector<std::unique_ptr<Channel>> channels;
+    aud::OpusEnc shared;
+    aud::ClipDSP clip;
+    aud::Frame sum; // of the active members
+    aud::Frame out;
+    std::vector<uint8_t> packet;
+    std::vector<Output> outputs;
+    uint32_t timestamp = 0;
+    size_t talkerCnt = 0;
+    uint64_t encodedCnt = 0;
+};
+
+} // namespace chat::server
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <boost/core/span.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Control datagrams the clients send to the relay over the media socket.
+// Like the receiver reports they start with 0xFF and a letter, which is not a valid Opus packet
+// (code 3 with more than 120 ms of frames), so they can not be mistaken for audio.
+namespace chat::server {
+
+// Moves the sender to a room. Users that never joined are in room 0, as are the users the relay
+// forgot after USER_TIMEOUT of silence, so a client repeats the join now and then.
+struct RoomJoin {
+    static constexpr size_t SIZE = 6;
+    static constexpr uint8_t MAGIC[2] = {0xFF, 'J'};
+
+    uint32_t room = 0;
+
+    static bool isJoin(boost::span<const uint8_t> pack) {
+        return pack.size() == SIZE && pack[0] == MAGIC[0] && pack[1] == MAGIC[1];
+    }
+
+    void serialize(std::vector<uint8_t> &out) const {
+        out = {MAGIC[0], MAGIC[1], (uint8_t)(room >> 24), (uint8_t)(room >> 16),
+               (uint8_t)(room >> 8), (uint8_t)room};
+    }
+
+    // returns false if pack is not a join
+    static bool parse(boost::span<const uint8_t> pack, RoomJoin &out) {
+        if (!isJoin(pack)) {
+            return false;
+        }
+        out.room = (uint32_t)pack[2] << 24 | (uint32_t)pack[3] << 16 | (uint32_t)pack[4] << 8 |
+                   pack[5];
+        return true;
+    }
+};
+
+} // namespace chat::server
@@ -0,0 +1,98 @@
+#include "relay.hpp"
+#include "shard.hpp"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+using namespace chat::server;
+
+bool Peer::operator==(const Peer &rhs) const {
+    return addr.sin6_port == rhs.addr.sin6_port &&
+           std::memcmp(&addr.sin6_addr, &rhs.addr.sin6_addr, sizeof(addr.sin6_addr)) == 0;
+}
+
+bool Peer::operator!=(const Peer &rhs) const {
+    return !(*this == rhs);
+}
+
+size_t PeerHash::operator()(const Peer &peer) const {
+    uint64_t words[2];
+    std::memcpy(words, &peer.addr.sin6_addr, sizeof(words));
+    size_t h = std::hash<uint64_t>()(words[0] ^ (words[1] * 0x9E3779B97F4A7C15ull));
+    return h ^ (peer.addr.sin6_port * 0x9E3779B9u);
+}
+
+RelayStats &RelayStats::operator+=(const RelayStats &rhs) {
+    received += rhs.received;
+    sent += rhs.sent;
+    handedOff += rhs.handedOff;
+    recvCalls += rhs.recvCalls;
+    sendCalls += rhs.sendCalls;
+    cpuSeconds += rhs.cpuSeconds;
+    users += rhs.users;
+    rooms += rhs.rooms;
+    members += rhs.members;
+    encoded += rhs.encoded;
+    lowLayer += rhs.lowLayer;
+    return *this;
+}
+
+Relay::Relay(uint16_t port, size_t workers, bool pin, RelayMode mode, size_t speakers)
+    : pin(pin), mode(mode), speakers(speakers) {
+    workers = std::max<size_t>(1, workers);
+    for (size_t i = 0; i < workers; i++) {
+        // the first one picks the port if asked to
+        shards.push_back(std::make_unique<Shard>(*this, i, workers, i == 0 ? port : this->port()));
+    }
+}
+
+Relay::~Relay() = default;
+
+uint16_t Relay::port() const {
+    return shards[0]->port();
+}
+
+size_t Relay::workers() const {
+    return shards.size();
+}
+
+size_t Relay::ownerOf(uint32_t room) const {
+    // rooms are often numbered in a row, spread them
+    return (size_t)((room * 0x9E3779B97F4A7C15ull) >> 32) % shards.size();
+}
+
+void Relay::run() {
+    std::vector<std::thread> threads;
+    unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < shards.size(); i++) {
+        threads.emplace_back([this, i] { shards[i]->run(); });
+        if (pin) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(i % cpus, &set);
+            pthread_setaffinity_np(threads.back().native_handle(), sizeof(set), &set);
+        }
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+void Relay::stop() {
+    running = false;
+}
+
+RelayStats Relay::stats() const {
+    RelayStats total;
+    for (auto &s : shards) {
+        total += s->stats();
+    }
+    return total;
+}
+
+RelayStats Relay::stats(size_t worker) const {
+    return shards[worker]->stats();
+}
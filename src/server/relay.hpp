@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <vector>
+
+namespace chat::server {
+
+// larger datagrams are dropped, nothing the clients send comes close
+inline constexpr size_t MAX_DATAGRAM = 1500;
+// datagrams taken by one recvmmsg
+inline constexpr size_t RECV_BATCH = 64;
+// datagrams given to one sendmmsg, UIO_MAXIOV
+inline constexpr size_t SEND_BATCH = 1024;
+// a user that sent nothing for so long is forgotten
+inline constexpr auto USER_TIMEOUT = std::chrono::seconds(3);
+// speakers forwarded in RelayMode::TopK by default
+inline constexpr size_t DEFAULT_SPEAKERS = 3;
+
+using Clock = std::chrono::steady_clock;
+
+// Address of a user, IPv4 users come IPv4-mapped through the dual-stack sockets.
+struct Peer {
+    sockaddr_in6 addr;
+
+    bool operator==(const Peer &rhs) const;
+    bool operator!=(const Peer &rhs) const;
+};
+
+struct PeerHash {
+    size_t operator()(const Peer &peer) const;
+};
+
+struct RelayStats {
+    uint64_t received = 0;  // datagrams
+    uint64_t sent = 0;      // datagrams
+    uint64_t handedOff = 0; // datagrams passed to the shard of their room
+    uint64_t recvCalls = 0; // syscalls
+    uint64_t sendCalls = 0; // syscalls
+    double cpuSeconds = 0;  // spent by the worker threads
+    size_t users = 0;
+    size_t rooms = 0;
+    size_t members = 0; // of all rooms, they learn about the users a bit later than the users
+    uint64_t encoded = 0; // frames, by the mixing
+    size_t lowLayer = 0;  // members given the low layer of the simulcast senders
+
+    RelayStats &operator+=(const RelayStats &rhs);
+};
+
+enum class RelayMode {
+    Forward, // every datagram goes to the other members of the room
+    Mix,     // the room is decoded, mixed and encoded again for each member, see RoomMix
+    TopK,    // only the loudest speakers are forwarded, see SpeakerSelector
+};
+
+class Shard;
+
+// UDP relay, every datagram is forwarded to the other users of the sender's room (see RoomJoin),
+// a user is there while it sent something in the last USER_TIMEOUT. In RelayMode::Mix the room
+// is mixed instead and every user gets a single stream, in RelayMode::TopK only the datagrams of
+// the loudest speakers are forwarded.
+// The senders may simulcast (see aud::Layer): the relay estimates the downlink of every member from
+// its receiver reports and forwards it the high or the low layer, so a constrained listener does
+// not pull the room down to its quality. The reports of the members on the low layer are not
+// forwarded, the senders' high layer need not follow them.
+// Runs a worker (shard) per core, each with its own SO_REUSEPORT socket on the same port, so the
+// kernel spreads the users over them by their address. A room belongs to one shard, which does
+// all of its fan-out; the other shards hand the datagrams of its users over through lock-free
+// SPSC mailboxes, one per pair of shards, so no lock is shared between the cores.
+// run() blocks until stop(), at once if it was stopped before; stop() and stats() may be called
+// from any thread.
+// Linux only.
+class Relay {
+  public:
+    // port 0 binds any free port, see port(); with pin the workers are bound to a CPU each;
+    // speakers is the K of RelayMode::TopK
+    explicit Relay(
+        uint16_t port,
+        size_t workers = 1,
+        bool pin = false,
+        RelayMode mode = RelayMode::Forward,
+        size_t speakers = DEFAULT_SPEAKERS
+    );
+    ~Relay();
+    Relay(const Relay &) = delete;
+    Relay &operator=(const Relay &) = delete;
+    uint16_t port() const;
+    size_t workers() const;
+    void run();
+    void stop();
+    RelayStats stats() const; // all workers
+    RelayStats stats(size_t worker) const;
+
+  private:
+    friend class Shard;
+
+    size_t ownerOf(uint32_t room) const;
+
+    const bool pin;
+    const RelayMode mode;
+    const size_t speakers;
+    std::atomic<bool> running{true};
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+} // namespace chat::server
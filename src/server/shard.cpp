@@ -0,0 +1,505 @@
+#include "shard.hpp"
+#include "log.hpp"
+#include "protocol.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <boost/format.hpp>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <system_error>
+#include <unistd.h>
+
+using namespace chat::server;
+
+// how long a worker waits for datagrams or mail, bounds the reaction to stop()
+static constexpr auto WAIT_TIMEOUT = std::chrono::milliseconds(100);
+// how often the CPU time is sampled
+static constexpr auto CPU_SAMPLE_PERIOD = std::chrono::seconds(1);
+// the precision of the expiry
+static constexpr auto TIMER_TICK = std::chrono::milliseconds(50);
+// kernel socket buffers, a burst of thousands of streams must not overflow them
+static constexpr int SOCKET_BUFFER = 8 << 20;
+// envelopes in flight from one shard to another
+static constexpr size_t MAILBOX_SIZE = 256;
+// a frame of the mixing
+static constexpr auto MIX_PERIOD =
+    std::chrono::microseconds(1000000 * aud::FRAME_SIZE / aud::SAMPLE_RATE);
+// a member whose downlink is estimated below this gets the low layers, bit/s
+static constexpr int LOW_LAYER_BELOW = aud::VOISE_BITRATE;
+
+static std::system_error sysError(const char *what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+static int64_t threadCpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+Shard::Shard(Relay &relay, size_t id, size_t workers, uint16_t port)
+    : relay(relay), id(id), letters(RECV_BATCH), posted(workers), bufs(RECV_BATCH * MAX_DATAGRAM),
+      recvMsgs(RECV_BATCH), recvIovs(RECV_BATCH), recvAddrs(RECV_BATCH), sendMsgs(SEND_BATCH),
+      sendIovs(2 * SEND_BATCH), sendAddrs(SEND_BATCH), layerBufs(2 * MAX_DATAGRAM),
+      timers(TIMER_TICK, Clock::now()) {
+    fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        throw sysError("socket");
+    }
+    int off = 0, on = 1;
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER, sizeof(SOCKET_BUFFER));
+
+    sockaddr_in6 addr{};
+    addr.sin6_family = AF_INET6;
+    addr.sin6_addr = in6addr_any;
+    addr.sin6_port = htons(port);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+        auto err = sysError("bind");
+        close(fd);
+        throw err;
+    }
+    wakeFd = eventfd(0, EFD_NONBLOCK);
+    if (wakeFd < 0) {
+        auto err = sysError("eventfd");
+        close(fd);
+        throw err;
+    }
+
+    for (size_t i = 0; i < workers; i++) {
+        mail.push_back(std::make_unique<aud::SpscRing<Envelope>>(MAILBOX_SIZE));
+    }
+    for (size_t i = 0; i < RECV_BATCH; i++) {
+        recvIovs[i] = {&bufs[i * MAX_DATAGRAM], MAX_DATAGRAM};
+    }
+}
+
+Shard::~Shard() {
+    close(wakeFd);
+    close(fd);
+}
+
+uint16_t Shard::port() const {
+    sockaddr_in6 addr{};
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr *)&addr, &len);
+    return ntohs(addr.sin6_port);
+}
+
+RelayStats Shard::stats() const {
+    RelayStats s;
+    s.received = received.load(std::memory_order_relaxed);
+    s.sent = sent.load(std::memory_order_relaxed);
+    s.handedOff = handedOff.load(std::memory_order_relaxed);
+    s.recvCalls = recvCalls.load(std::memory_order_relaxed);
+    s.sendCalls = sendCalls.load(std::memory_order_relaxed);
+    s.cpuSeconds = cpuNs.load(std::memory_order_relaxed) / 1e9;
+    s.users = userCnt.load(std::memory_order_relaxed);
+    s.rooms = roomCnt.load(std::memory_order_relaxed);
+    s.members = memberCnt.load(std::memory_order_relaxed);
+    s.encoded = encoded.load(std::memory_order_relaxed);
+    s.lowLayer = lowCnt.load(std::memory_order_relaxed);
+    return s;
+}
+
+void Shard::run() {
+    int64_t cpuStart = threadCpuNs();
+    auto nextCpuSample = Clock::now() + CPU_SAMPLE_PERIOD;
+    pollfd fds[2] = {{fd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+    bool busy = false;
+    bool mixing = relay.mode == RelayMode::Mix;
+    nextMix = Clock::now() + MIX_PERIOD;
+    while (relay.running) {
+        // under load there is always something to do, no need to ask
+        if (!busy) {
+            auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                mixing ? std::clamp<Clock::duration>(nextMix - Clock::now(), {}, WAIT_TIMEOUT)
+                       : WAIT_TIMEOUT
+            );
+            timespec ts{(time_t)(wait.count() / 1000000000), (long)(wait.count() % 1000000000)};
+            ppoll(fds, 2, &ts, nullptr);
+            if (fds[1].revents & POLLIN) {
+                uint64_t cnt;
+                (void)!read(wakeFd, &cnt, sizeof(cnt));
+            }
+        }
+        auto now = Clock::now();
+        size_t count = receive();
+        if (count > 0) {
+            route(count, now);
+        }
+        size_t letterCnt = drainMail(now);
+        busy = count == RECV_BATCH || letterCnt == RECV_BATCH;
+        timers.advance(now, [&](const Expiry &timer) { expire(timer, now); });
+        if (mixing && now >= nextMix) {
+            mixRooms();
+            // after a stall the lost frames are not caught up
+            nextMix = std::max(nextMix + MIX_PERIOD, now);
+        }
+        if (now >= nextCpuSample) {
+            cpuNs.store(threadCpuNs() - cpuStart, std::memory_order_relaxed);
+            nextCpuSample = now + CPU_SAMPLE_PERIOD;
+        }
+    }
+    cpuNs.store(threadCpuNs() - cpuStart, std::memory_order_relaxed);
+}
+
+// takes what is queued, without waiting
+size_t Shard::receive() {
+    for (size_t i = 0; i < RECV_BATCH; i++) {
+        msghdr &h = recvMsgs[i].msg_hdr;
+        h = {};
+        h.msg_name = &recvAddrs[i];
+        h.msg_namelen = sizeof(sockaddr_in6);
+        h.msg_iov = &recvIovs[i];
+        h.msg_iovlen = 1;
+    }
+    int n = recvmmsg(fd, recvMsgs.data(), RECV_BATCH, MSG_DONTWAIT, nullptr);
+    recvCalls.fetch_add(1, std::memory_order_relaxed);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            CHAT_LOGE(boost::format("recvmmsg: %1%") % std::strerror(errno));
+        }
+        return 0;
+    }
+    received.fetch_add(n, std::memory_order_relaxed);
+    return n;
+}
+
+void Shard::route(size_t count, Clock::time_point now) {
+    for (size_t i = 0; i < count; i++) {
+        if (recvAddrs[i].sin6_family != AF_INET6 || (recvMsgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+            continue;
+        }
+        Peer from{recvAddrs[i]};
+        const uint8_t *data = (const uint8_t *)recvIovs[i].iov_base;
+        size_t size = recvMsgs[i].msg_len;
+
+        auto [it, added] = users.try_emplace(from);
+        Ingress &user = it->second;
+        user.lastSeen = now;
+        if (added) {
+            user.gen = nextGen++;
+            timers.schedule(now + USER_TIMEOUT, {from, user.gen, false});
+            userCnt.store(users.size(), std::memory_order_relaxed);
+            char host[INET6_ADDRSTRLEN];
+            inet_ntop(AF_INET6, &from.addr.sin6_addr, host, sizeof(host));
+            CHAT_LOGI(boost::format("user %1% port %2%") % host % ntohs(from.addr.sin6_port));
+        }
+
+        Envelope::Kind kind = Envelope::Media;
+        RoomJoin join;
+        if (RoomJoin::parse({data, size}, join)) {
+            if (join.room != user.room) {
+                post(relay.ownerOf(user.room), from, user.room, Envelope::Leave, nullptr, 0, now);
+                user.room = join.room;
+            }
+            kind = Envelope::Join;
+            size = 0;
+        }
+        post(relay.ownerOf(user.room), from, user.room, kind, data, size, now);
+    }
+    // the receive buffers are reused by the next recvmmsg
+    flush();
+    wake();
+}
+
+void Shard::post(
+    size_t owner,
+    const Peer &from,
+    uint32_t room,
+    Envelope::Kind kind,
+    const uint8_t *data,
+    size_t size,
+    Clock::time_point now
+) {
+    if (owner == id) {
+        deliver(from, room, kind, data, size, now);
+        return;
+    }
+    Envelope env;
+    env.from = from;
+    env.room = room;
+    env.kind = kind;
+    env.size = size;
+    if (size > 0) {
+        std::memcpy(env.data, data, size);
+    }
+    relay.shards[owner]->mail[id]->push(env, env.bytes());
+    posted[owner] = true;
+    handedOff.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Shard::wake() {
+    for (size_t i = 0; i < posted.size(); i++) {
+        if (posted[i]) {
+            posted[i] = false;
+            uint64_t one = 1;
+            (void)!write(relay.shards[i]->wakeFd, &one, sizeof(one));
+        }
+    }
+}
+
+// returns the number of the letters taken
+size_t Shard::drainMail(Clock::time_point now) {
+    size_t cnt = 0;
+    for (size_t from = 0; from < mail.size() && cnt < letters.size(); from++) {
+        while (cnt < letters.size() && mail[from]->pop(letters[cnt])) {
+            cnt++;
+        }
+    }
+    for (size_t i = 0; i < cnt; i++) {
+        Envelope &env = letters[i];
+        deliver(env.from, env.room, env.kind, env.data, env.size, now);
+    }
+    // the letters are reused by the next drain
+    flush();
+    return cnt;
+}
+
+// the room is ours
+void Shard::deliver(
+    const Peer &from,
+    uint32_t room,
+    Envelope::Kind kind,
+    const uint8_t *data,
+    size_t size,
+    Clock::time_point now
+) {
+    auto it = memberships.find(from);
+    if (kind == Envelope::Leave) {
+        if (it != memberships.end() && it->second.room == room) {
+            leave(it);
+        }
+        return;
+    }
+    if (it == memberships.end() || it->second.room != room) {
+        if (it != memberships.end()) {
+            leave(it); // the leave got lost with the user the ingress forgot
+        }
+        it = join(from, room, now);
+    } else {
+        it->second.lastSeen = now;
+    }
+    if (kind != Envelope::Media) {
+        return;
+    }
+    auto &r = rooms.find(room)->second;
+    if (r.mix) {
+        // the receiver reports are about the mix, which has no say in them
+        r.mix->push(it->second.slot, data, size);
+        return;
+    }
+    aud::ReceiverReport report;
+    if (aud::ReceiverReport::parse({data, size}, report) && !onReport(it->second, r, report)) {
+        return;
+    }
+    if (r.speakers && !r.speakers->admit(it->second.slot, data, size, now)) {
+        return;
+    }
+    aud::span<const uint8_t> datagram(data, size);
+    aud::MediaPacket mp;
+    if (aud::MediaPacket::parse(datagram, mp) ? mp.layer() != aud::Layer::Single
+                                              : aud::Bundle::isLayered(datagram)) {
+        forwardLayers(r, it->second.slot, data, size);
+        return;
+    }
+    auto &members = r.members;
+    for (size_t i = 0; i < members.size(); i++) {
+        if (i != it->second.slot) {
+            queue(data, size, members[i]);
+        }
+    }
+}
+
+// the report of a member tells how its downlink fares
+bool Shard::onReport(Membership &m, Room &r, const aud::ReceiverReport &report) {
+    m.downlink.update(report);
+    bool low = m.downlink.bitrate() < LOW_LAYER_BELOW;
+    if (r.low[m.slot] != low) {
+        r.low[m.slot] = low;
+        if (low) {
+            lowCnt.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            lowCnt.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    return !(low && r.simulcast);
+}
+
+// a datagram of a simulcast sender, each member gets the layer of its downlink
+void Shard::forwardLayers(Room &r, uint32_t from, const uint8_t *data, size_t size) {
+    r.simulcast = true;
+    auto &members = r.members;
+    aud::span<const uint8_t> datagram(data, size);
+    aud::MediaPacket mp;
+    if (aud::MediaPacket::parse(datagram, mp)) {
+        for (size_t i = 0; i < members.size(); i++) {
+            if (i != from && mp.forLayer(r.low[i])) {
+                queue(data, size, members[i]);
+            }
+        }
+        return;
+    }
+    aud::span<const uint8_t> layers[2] = {
+        aud::Bundle::selectLayer(datagram, false, {layerBufs.data(), MAX_DATAGRAM}),
+        aud::Bundle::selectLayer(datagram, true, {layerBufs.data() + MAX_DATAGRAM, MAX_DATAGRAM}),
+    };
+    for (size_t i = 0; i < members.size(); i++) {
+        auto &layer = layers[r.low[i]];
+        if (i != from && !layer.empty()) {
+            queue(layer.data(), layer.size(), members[i]);
+        }
+    }
+    // the bundles are rebuilt by the next one
+    flush();
+}
+
+Shard::Memberships::iterator Shard::join(const Peer &peer, uint32_t room, Clock::time_point now) {
+    auto &r = rooms[room];
+    Membership m{room, (uint32_t)r.members.size(), nextGen++, now};
+    r.members.push_back(peer);
+    r.low.push_back(false);
+    if (relay.mode == RelayMode::Mix) {
+        if (!r.mix) {
+            r.mix = std::make_unique<RoomMix>();
+        }
+        r.mix->add();
+    }
+    if (relay.mode == RelayMode::TopK) {
+        if (!r.speakers) {
+            r.speakers = std::make_unique<SpeakerSelector>(relay.speakers);
+        }
+        r.speakers->add();
+    }
+    timers.schedule(now + USER_TIMEOUT, {peer, m.gen, true});
+    memberCnt.store(memberships.size() + 1, std::memory_order_relaxed);
+    roomCnt.store(rooms.size(), std::memory_order_relaxed);
+    return memberships.emplace(peer, m).first;
+}
+
+void Shard::leave(Memberships::iterator it) {
+    auto room = rooms.find(it->second.room);
+    auto &members = room->second.members;
+    auto &low = room->second.low;
+    uint32_t slot = it->second.slot;
+    if (low[slot]) {
+        lowCnt.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if (slot + 1 != members.size()) {
+        members[slot] = members.back();
+        low[slot] = low.back();
+        memberships.find(members[slot])->second.slot = slot;
+    }
+    members.pop_back();
+    low.pop_back();
+    if (room->second.mix) {
+        room->second.mix->remove(slot);
+    }
+    if (room->second.speakers) {
+        room->second.speakers->remove(slot);
+    }
+    if (members.empty()) {
+        rooms.erase(room);
+    }
+    memberships.erase(it);
+    memberCnt.store(memberships.size(), std::memory_order_relaxed);
+    roomCnt.store(rooms.size(), std::memory_order_relaxed);
+}
+
+void Shard::queue(
+    const uint8_t *data,
+    size_t size,
+    const Peer &to,
+    const uint8_t *header,
+    size_t headerSize
+) {
+    if (pending == SEND_BATCH) {
+        flush();
+    }
+    // the members may move before the flush, the address is copied
+    sendAddrs[pending] = to.addr;
+    iovec *iov = &sendIovs[2 * pending];
+    msghdr &h = sendMsgs[pending].msg_hdr;
+    h = {};
+    h.msg_name = &sendAddrs[pending];
+    h.msg_namelen = sizeof(sockaddr_in6);
+    h.msg_iov = iov;
+    if (header) {
+        *iov++ = {const_cast<uint8_t *>(header), headerSize};
+    }
+    *iov = {const_cast<uint8_t *>(data), size};
+    h.msg_iovlen = header ? 2 : 1;
+    pending++;
+}
+
+void Shard::flush() {
+    size_t done = 0;
+    while (done < pending) {
+        int n = sendmmsg(fd, &sendMsgs[done], pending - done, 0);
+        sendCalls.fetch_add(1, std::memory_order_relaxed);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // the first message failed, e.g. an unreachable address; the rest may still go
+            CHAT_LOGV(boost::format("sendmmsg: %1%") % std::strerror(errno));
+            n = 1;
+        } else {
+            sent.fetch_add(n, std::memory_order_relaxed);
+        }
+        done += n;
+    }
+    pending = 0;
+}
+
+void Shard::mixRooms() {
+    for (auto &[num, room] : rooms) {
+        uint64_t before = room.mix->encoded();
+        auto &outputs = room.mix->mix();
+        for (size_t i = 0; i < outputs.size(); i++) {
+            auto &o = outputs[i];
+            if (o.payload) {
+                queue(
+                    o.payload->data(),
+                    o.payload->size(),
+                    room.members[i],
+                    o.header,
+                    aud::MediaHeader::SIZE
+                );
+            }
+        }
+        encoded.fetch_add(room.mix->encoded() - before, std::memory_order_relaxed);
+    }
+    flush();
+}
+
+void Shard::expire(const Expiry &timer, Clock::time_point now) {
+    if (timer.membership) {
+        auto it = memberships.find(timer.peer);
+        if (it == memberships.end() || it->second.gen != timer.gen) {
+            return; // left meanwhile
+        }
+        if (now - it->second.lastSeen < USER_TIMEOUT) {
+            timers.schedule(it->second.lastSeen + USER_TIMEOUT, timer);
+            return;
+        }
+        leave(it);
+        return;
+    }
+    auto it = users.find(timer.peer);
+    if (it == users.end() || it->second.gen != timer.gen) {
+        return;
+    }
+    if (now - it->second.lastSeen < USER_TIMEOUT) {
+        timers.schedule(it->second.lastSeen + USER_TIMEOUT, timer);
+        return;
+    }
+    users.erase(it);
+    userCnt.store(users.size(), std::memory_order_relaxed);
+}
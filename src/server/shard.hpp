@@ -0,0 +1,168 @@
+#pragma once
+
+#include "audio/feedback.hpp"
+#include "audio/ring.hpp"
+#include "mcu.hpp"
+#include "relay.hpp"
+#include "speakers.hpp"
+#include "timerwheel.hpp"
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+namespace chat::server {
+
+// A datagram on its way to the shard of its room.
+struct Envelope {
+    enum Kind : uint16_t {
+        Media, // forwarded to the room
+        Join,  // only refreshes the membership
+        Leave,
+    };
+
+    Peer from;
+    uint32_t room;
+    Kind kind;
+    uint16_t size;
+    uint8_t data[MAX_DATAGRAM];
+
+    // the header and the used part of data, all that the mail ring copies
+    size_t bytes() const {
+        return offsetof(Envelope, data) + size;
+    }
+};
+
+// One worker of the Relay. The users whose datagrams the kernel steers to its socket are its
+// ingress users, it knows their rooms; the rooms hashed to it are its own, it knows their members
+// and sends their fan-out.
+// Per datagram it does a few hash lookups and the fan-out over the members of the room, nothing
+// depends on the number of the users; they expire through a timer wheel.
+// In RelayMode::Mix the datagrams go to the RoomMix of the room instead, which the shard mixes
+// and sends every FRAME_SIZE; in RelayMode::TopK the SpeakerSelector of the room drops the ones
+// of the senders that are not among the loudest.
+// The layers of the simulcast senders are picked per member by its downlink, see Relay.
+class Shard {
+  public:
+    Shard(Relay &relay, size_t id, size_t workers, uint16_t port);
+    ~Shard();
+    uint16_t port() const;
+    void run();
+    RelayStats stats() const;
+
+  private:
+    // the range of the downlink estimate, it starts a bit above the high layer, bit/s
+    static constexpr int DOWNLINK_MIN = aud::VOISE_LOW_BITRATE;
+    static constexpr int DOWNLINK_MAX = 64000;
+    static constexpr int DOWNLINK_START = 32000;
+
+    // a user whose datagrams come to our socket
+    struct Ingress {
+        uint32_t room = 0;
+        uint32_t gen; // of its timer
+        Clock::time_point lastSeen;
+    };
+    // a user in one of our rooms
+    struct Membership {
+        uint32_t room;
+        uint32_t slot; // in the members of the room
+        uint32_t gen;  // of its timer
+        Clock::time_point lastSeen;
+        aud::BandwidthEstimator downlink{DOWNLINK_MIN, DOWNLINK_MAX, DOWNLINK_START};
+    };
+    struct Room {
+        std::vector<Peer> members; // contiguous for the fan-out
+        std::vector<bool> low;     // per slot, the member gets the low layers
+        bool simulcast = false;    // some sender sent layers
+        std::unique_ptr<RoomMix> mix; // in RelayMode::Mix, its slots are the ones of the members
+        std::unique_ptr<SpeakerSelector> speakers; // in RelayMode::TopK, likewise
+    };
+    // the expiry timer of an ingress user or a membership, stale if the generation does not match
+    struct Expiry {
+        Peer peer;
+        uint32_t gen;
+        bool membership;
+    };
+    using Memberships = std::unordered_map<Peer, Membership, PeerHash>;
+
+    size_t receive();
+    void route(size_t count, Clock::time_point now);
+    void post(
+        size_t owner,
+        const Peer &from,
+        uint32_t room,
+        Envelope::Kind kind,
+        const uint8_t *data,
+        size_t size,
+        Clock::time_point now
+    );
+    size_t drainMail(Clock::time_point now);
+    void deliver(
+        const Peer &from,
+        uint32_t room,
+        Envelope::Kind kind,
+        const uint8_t *data,
+        size_t size,
+        Clock::time_point now
+    );
+    // returns false if the report is not to be forwarded
+    bool onReport(Membership &m, Room &r, const aud::ReceiverReport &report);
+    void forwardLayers(Room &r, uint32_t from, const uint8_t *data, size_t size);
+    // header, if any, goes in front of data
+    void queue(
+        const uint8_t *data,
+        size_t size,
+        const Peer &to,
+        const uint8_t *header = nullptr,
+        size_t headerSize = 0
+    );
+    void flush();
+    void wake();
+    void mixRooms();
+    Memberships::iterator join(const Peer &peer, uint32_t room, Clock::time_point now);
+    void leave(Memberships::iterator it);
+    void expire(const Expiry &timer, Clock::time_point now);
+
+    Relay &relay;
+    const size_t id;
+    int fd;
+    int wakeFd; // eventfd, signalled when there is mail
+
+    // inbound mailboxes, one per shard that posts here
+    std::vector<std::unique_ptr<aud::SpscRing<Envelope>>> mail;
+    std::vector<Envelope> letters; // taken from the mailboxes, RECV_BATCH
+    std::vector<bool> posted;      // per shard, since the last wake()
+
+    // receive side, RECV_BATCH of each
+    std::vector<uint8_t> bufs;
+    std::vector<mmsghdr> recvMsgs;
+    std::vector<iovec> recvIovs;
+    std::vector<sockaddr_in6> recvAddrs;
+    // send side, the iovecs point into bufs, letters or the mixes; two per message
+    std::vector<mmsghdr> sendMsgs;
+    std::vector<iovec> sendIovs;
+    std::vector<sockaddr_in6> sendAddrs;
+    size_t pending = 0;
+    // the bundles of the two layers, 2 * MAX_DATAGRAM
+    std::vector<uint8_t> layerBufs;
+
+    std::unordered_map<Peer, Ingress, PeerHash> users;
+    Memberships memberships;
+    std::unordered_map<uint32_t, Room> rooms;
+    TimerWheel<Expiry> timers;
+    uint32_t nextGen = 0;
+    Clock::time_point nextMix;
+
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> handedOff{0};
+    std::atomic<uint64_t> recvCalls{0};
+    std::atomic<uint64_t> sendCalls{0};
+    std::atomic<int64_t> cpuNs{0};
+    std::atomic<size_t> userCnt{0};
+    std::atomic<size_t> roomCnt{0};
+    std::atomic<size_t> memberCnt{0};
+    std::atomic<uint64_t> encoded{0};
+    std::atomic<size_t> lowCnt{0};
+};
+
+} // namespace chat::server
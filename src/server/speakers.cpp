@@ -0,0 +1,123 @@
+#include "speakers.hpp"
+#include <algorithm>
+
+using namespace chat::server;
+
+// the level follows a rise at once and a fall slowly, a word does not lose the seat on a pause
+static constexpr float LEVEL_ATTACK = 0.5;
+static constexpr float LEVEL_RELEASE = 0.1;
+
+uint32_t chat::server::opusDurationUs(const uint8_t *data, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    // RFC 6716 3.1
+    static constexpr uint32_t SILK[] = {10000, 20000, 40000, 60000};
+    static constexpr uint32_t HYBRID[] = {10000, 20000};
+    static constexpr uint32_t CELT[] = {2500, 5000, 10000, 20000};
+    uint8_t config = data[0] >> 3;
+    uint32_t frame = config < 12 ? SILK[config % 4] : config < 16 ? HYBRID[config % 2]
+                                                                  : CELT[config % 4];
+    uint32_t frames;
+    switch (data[0] & 3) {
+    case 0:
+        frames = 1;
+        break;
+    case 1:
+    case 2:
+        frames = 2;
+        break;
+    default:
+        frames = size > 1 ? data[1] & 0x3F : 0;
+    }
+    uint32_t duration = frame * frames;
+    return duration <= 120000 ? duration : 0;
+}
+
+SpeakerSelector::SpeakerSelector(size_t seats) : maxSeats(seats) {}
+
+void SpeakerSelector::add() {
+    senders.emplace_back();
+}
+
+void SpeakerSelector::remove(size_t slot) {
+    uint32_t last = (uint32_t)senders.size() - 1;
+    if (senders[slot].seated) {
+        seats.erase(std::find(seats.begin(), seats.end(), (uint32_t)slot));
+    }
+    if (slot != last && senders[last].seated) {
+        *std::find(seats.begin(), seats.end(), last) = (uint32_t)slot;
+    }
+    senders[slot] = senders[last];
+    senders.pop_back();
+}
+
+bool SpeakerSelector::isSpeaker(size_t slot) const {
+    return senders[slot].seated;
+}
+
+size_t SpeakerSelector::speakers() const {
+    return seats.size();
+}
+
+float SpeakerSelector::levelOf(const Sender &s, Clock::time_point now) const {
+    return now - s.last > IDLE ? 0 : s.level;
+}
+
+void SpeakerSelector::measure(Sender &s, const aud::MediaPacket &mp) {
+    if (mp.layer() == aud::Layer::Low) {
+        return; // a copy of the high one
+    }
+    auto payload = mp.payload();
+    uint32_t duration =
+        mp.type() == aud::PayloadType::Opus ? opusDurationUs(payload.data(), payload.size()) : 0;
+    float rate = duration ? payload.size() * 1000.f / duration : 0;
+    s.level += (rate - s.level) * (rate > s.level ? LEVEL_ATTACK : LEVEL_RELEASE);
+}
+
+bool SpeakerSelector::admit(size_t slot, const uint8_t *data, size_t size, Clock::time_point now) {
+    aud::span<const uint8_t> datagram(data, size);
+    aud::MediaPacket mp;
+    bool bundle = aud::Bundle::isBundle(datagram);
+    if (!bundle && !aud::MediaPacket::parse(datagram, mp)) {
+        return size > 0 && data[0] == 0xFF; // control, see protocol.hpp
+    }
+    Sender &s = senders[slot];
+    if (now - s.last > IDLE) {
+        s.level = 0;
+    }
+    if (bundle) {
+        // every frame counts, as if they came one by one
+        aud::Bundle::Reader reader(datagram);
+        while (reader.next(mp)) {
+            measure(s, mp);
+        }
+    } else {
+        measure(s, mp);
+    }
+    s.last = now;
+    if (s.seated) {
+        return true;
+    }
+    if (s.level < SPEECH_LEVEL) {
+        return false;
+    }
+    if (seats.size() < maxSeats) {
+        s.seated = true;
+        seats.push_back(slot);
+        return true;
+    }
+    if (seats.empty()) {
+        return false; // no seats at all
+    }
+    auto quietest = std::min_element(seats.begin(), seats.end(), [&](uint32_t a, uint32_t b) {
+        return levelOf(senders[a], now) < levelOf(senders[b], now);
+    });
+    if (s.level <= levelOf(senders[*quietest], now) * SWITCH_RATIO) {
+        return false;
+    }
+    senders[*quietest].seated = false;
+    *quietest = (uint32_t)slot;
+    s.seated = true;
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "audio/packet.hpp"
+#include "relay.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chat::server {
+
+// Picks the loudest speakers of a room for RelayMode::TopK without decoding anything.
+// The level of a sender is its Opus bitrate, read from the payload size and the TOC byte: VBR
+// spends the bits on the speech and drops to a few bytes a frame in the silence (or to nothing,
+// if the sender gates it). A sender takes a seat while there is a free one or when it is
+// SWITCH_RATIO louder than the quietest speaker, so two similar voices do not flap.
+// The slots are the ones of the room's members, not thread-safe.
+class SpeakerSelector {
+  public:
+    // a sender below this is not speaking, bytes per ms
+    static constexpr float SPEECH_LEVEL = 1.2;
+    static constexpr float SWITCH_RATIO = 1.5;
+    // a speaker that sent nothing for so long is silent
+    static constexpr auto IDLE = std::chrono::milliseconds(200);
+
+    explicit SpeakerSelector(size_t seats);
+    // the new member takes the next slot
+    void add();
+    // the last member moves to slot
+    void remove(size_t slot);
+    // updates the level of the sender from a media datagram (MediaPacket) or a Bundle of its
+    // frames, returns whether it is forwarded; the control datagrams always are, anything else
+    // never
+    bool admit(size_t slot, const uint8_t *data, size_t size, Clock::time_point now);
+    bool isSpeaker(size_t slot) const;
+    size_t speakers() const;
+
+  private:
+    struct Sender {
+        float level = 0; // bytes per ms
+        Clock::time_point last;
+        bool seated = false;
+    };
+
+    static void measure(Sender &s, const aud::MediaPacket &mp);
+    float levelOf(const Sender &s, Clock::time_point now) const;
+
+    const size_t maxSeats;
+    std::vector<Sender> senders;
+    std::vector<uint32_t> seats; // slots of the speakers
+};
+
+// duration of the audio in an Opus packet from its TOC byte, 0 if it is not valid, us
+uint32_t opusDurationUs(const uint8_t *data, size_t size);
+
+} // namespace chat::server
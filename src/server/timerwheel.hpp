@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace chat::server {
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS slots, a slot of a level spans a whole turn of
+// the level below. A timer is put into the lowest level whose current turn contains its deadline
+// and falls to the lower levels as the time comes closer, so scheduling is O(1) and advance()
+// touches only the timers that are due (and, once per turn, the ones falling down a level).
+// There is no cancellation: the owner of a timer checks on firing whether it is still wanted,
+// keeping a timer up to date on every event costs nothing that way.
+template <typename T> class TimerWheel {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t SLOT_BITS = 6;
+    static constexpr size_t SLOTS = 1 << SLOT_BITS;
+    static constexpr size_t LEVELS = 4;
+
+    TimerWheel(Clock::duration tick, Clock::time_point start) : tick(tick), start(start) {}
+
+    // a deadline in the past fires on the next advance(); the ones beyond the range of the wheel
+    // (SLOTS^LEVELS ticks) fire early, at its end
+    void schedule(Clock::time_point when, const T &value) {
+        uint64_t due =
+            when <= start ? 0 : (uint64_t)((when - start + tick - Clock::duration(1)) / tick);
+        due = std::clamp(due, current + 1, current + MAX_TICKS);
+        place(due, value, current);
+        cnt++;
+    }
+
+    // fires, in the order of the deadlines (to a tick), every timer due by now;
+    // fire may schedule new timers
+    template <typename F> void advance(Clock::time_point now, F &&fire) {
+        if (now < start) {
+            return;
+        }
+        uint64_t target = (uint64_t)((now - start) / tick);
+        while (current < target) {
+            current++;
+            for (size_t level = LEVELS - 1; level > 0; level--) {
+                if ((current & ((1ull << (SLOT_BITS * level)) - 1)) == 0) {
+                    cascade(level);
+                }
+            }
+            auto &slot = slots[0][current & (SLOTS - 1)];
+            if (slot.empty()) {
+                continue;
+            }
+            firing.swap(slot);
+            cnt -= firing.size();
+            for (auto &e : firing) {
+                fire(e.value);
+            }
+            firing.clear();
+        }
+    }
+
+    size_t size() const {
+        return cnt;
+    }
+
+  private:
+    static constexpr uint64_t MAX_TICKS = (1ull << (SLOT_BITS * LEVELS)) - 1;
+
+    struct Entry {
+        uint64_t due; // in ticks
+        T value;
+    };
+
+    // into the lowest level whose turn, as seen from ref, contains due
+    void place(uint64_t due, const T &value, uint64_t ref) {
+        size_t level = 0;
+        while (level + 1 < LEVELS) {
+            size_t above = SLOT_BITS * (level + 1);
+            if ((due >> above) == (ref >> above)) {
+                break;
+            }
+            level++;
+        }
+        slots[level][(due >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back({due, value});
+    }
+
+    // the slot of the level that starts now falls to the lower levels
+    void cascade(size_t level) {
+        auto &slot = slots[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+        falling.swap(slot);
+        for (auto &e : falling) {
+            place(e.due, e.value, current);
+        }
+        falling.clear();
+    }
+
+    const Clock::duration tick;
+    const Clock::time_point start;
+    uint64_t current = 0; // the last advanced tick
+    size_t cnt = 0;
+    std::vector<Entry> slots[LEVELS][SLOTS];
+    std::vector<Entry> firing;
+    std::vector<Entry> falling;
+};
+
+} // namespace chat::server
@@ -0,0 +1,139 @@
+#include "audio/aec.hpp"
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace aud;
+
+static std::vector<float> noise(size_t n, float amp, uint32_t seed = 1) {
+    std::vector<float> v(n);
+    for (auto &x : v) {
+        seed = seed * 1664525 + 1013904223;
+        x = amp * ((float)(seed >> 8) / (1 << 24) * 2 - 1);
+    }
+    return v;
+}
+
+// a room: the direct path after 30 ms and a few decaying reflections
+static std::vector<float> echoOf(const std::vector<float> &far) {
+    const std::pair<size_t, float> taps[] = {{1440, 0.3f}, {1500, -0.15f}, {1900, 0.08f},
+                                             {2600, 0.05f}, {4000, -0.02f}};
+    std::vector<float> out(far.size());
+    for (size_t i = 0; i < far.size(); i++) {
+        for (auto [delay, gain] : taps) {
+            if (i >= delay) {
+                out[i] += gain * far[i - delay];
+            }
+        }
+    }
+    return out;
+}
+
+// plays far and captures mic frame by frame, returns the processed capture
+static std::vector<float> run(
+    EchoCancellerDSP &aec,
+    const std::vector<float> &far,
+    const std::vector<float> &mic,
+    size_t frameLen = FRAME_SIZE
+) {
+    std::vector<float> out;
+    Frame frame;
+    for (size_t i = 0; i + frameLen <= mic.size(); i += frameLen) {
+        aec.farEnd(far.data() + i, frameLen);
+        frame.resize(frameLen);
+        std::copy(mic.begin() + i, mic.begin() + i + frameLen, frame.begin());
+        aec.process(frame);
+        out.insert(out.end(), frame.begin(), frame.end());
+    }
+    return out;
+}
+
+static double energy(const std::vector<float> &v, size_t from, size_t to) {
+    double s = 0;
+    for (size_t i = from; i < to; i++) {
+        s += (double)v[i] * v[i];
+    }
+    return s;
+}
+
+TEST(aec, fft_round_trip) {
+    Fft fft(256);
+    auto x = noise(256, 1);
+    std::vector<std::complex<float>> spec(129);
+    std::vector<float> y(256);
+    fft.forward(x.data(), spec.data());
+    fft.inverse(spec.data(), y.data());
+    for (size_t i = 0; i < x.size(); i++) {
+        ASSERT_NEAR(x[i], y[i], 1e-5) << i;
+    }
+
+    std::vector<float> tone(256);
+    for (size_t i = 0; i < tone.size(); i++) {
+        tone[i] = std::cos(2 * (float)M_PI * 8 * i / 256);
+    }
+    fft.forward(tone.data(), spec.data());
+    EXPECT_NEAR(std::abs(spec[8]), 128, 1e-3);
+    EXPECT_NEAR(std::abs(spec[7]), 0, 1e-3);
+}
+
+TEST(aec, cancels_echo) {
+    const size_t n = SAMPLE_RATE * 8;
+    auto far = noise(n, 0.3f);
+    auto mic = echoOf(far);
+    EchoCancellerDSP aec;
+    auto out = run(aec, far, mic);
+
+    // the last two seconds, after the convergence
+    double erle = 10 * std::log10(energy(mic, n - 2 * SAMPLE_RATE, n) /
+                                  energy(out, n - 2 * SAMPLE_RATE, n));
+    EXPECT_GT(erle, 25);
+    EXPECT_GT(aec.erle(), 20);
+}
+
+TEST(aec, passes_near_end_without_far_end) {
+    auto mic = noise(SAMPLE_RATE, 0.2f);
+    std::vector<float> far(mic.size());
+    EchoCancellerDSP aec;
+    auto out = run(aec, far, mic);
+    for (size_t i = EchoCancellerDSP::BLOCK; i < out.size(); i++) {
+        ASSERT_EQ(out[i], mic[i - EchoCancellerDSP::BLOCK]) << i;
+    }
+}
+
+TEST(aec, keeps_near_end_in_double_talk) {
+    const size_t n = SAMPLE_RATE * 8;
+    auto far = noise(n, 0.3f);
+    auto mic = echoOf(far);
+    std::vector<float> near(n);
+    for (size_t i = n / 2; i < n; i++) {
+        near[i] = 0.4f * std::sin(2 * (float)M_PI * 300 * i / SAMPLE_RATE);
+        mic[i] += near[i];
+    }
+    EchoCancellerDSP aec;
+    auto out = run(aec, far, mic);
+
+    // what is left besides the delayed near end
+    const size_t delay = EchoCancellerDSP::BLOCK;
+    std::vector<float> residual(n);
+    for (size_t i = delay; i < out.size(); i++) {
+        residual[i] = out[i] - near[i - delay];
+    }
+    double nearEnergy = energy(near, n - 2 * SAMPLE_RATE, n - delay);
+    double resEnergy = energy(residual, n - 2 * SAMPLE_RATE + delay, n);
+    EXPECT_GT(10 * std::log10(nearEnergy / resEnergy), 20);
+}
+
+TEST(aec, any_frame_size) {
+    const size_t n = SAMPLE_RATE * 2;
+    auto far = noise(n, 0.3f);
+    auto mic = echoOf(far);
+    EchoCancellerDSP a, b;
+    auto out20 = run(a, far, mic, frameSize(FrameDuration::Ms20));
+    auto out2_5 = run(b, far, mic, frameSize(FrameDuration::Ms2_5));
+    ASSERT_EQ(out20.size(), out2_5.size());
+    for (size_t i = 0; i < out20.size(); i++) {
+        ASSERT_EQ(out20[i], out2_5[i]) << i;
+    }
+}
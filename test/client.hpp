@@ -0,0 +1,56 @@
+#pragma once
+
+#include "server/protocol.hpp"
+#include "server/relay.hpp"
+#include <arpa/inet.h>
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace test {
+
+// A UDP client of a relay on the loopback, receive() gives up after 200 ms.
+class Client {
+  public:
+    explicit Client(uint16_t relayPort) {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        timeval tv{0, 200000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        relay.sin_family = AF_INET;
+        relay.sin_port = htons(relayPort);
+        relay.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+    Client(const Client &) = delete;
+    Client &operator=(const Client &) = delete;
+    ~Client() {
+        close(fd);
+    }
+    void send(const void *data, size_t size) {
+        sendto(fd, data, size, 0, (sockaddr *)&relay, sizeof(relay));
+    }
+    void send(const std::string &msg) {
+        send(msg.data(), msg.size());
+    }
+    void send(const std::vector<uint8_t> &pack) {
+        send(pack.data(), pack.size());
+    }
+    void join(uint32_t room) {
+        std::vector<uint8_t> pack;
+        chat::server::RoomJoin{room}.serialize(pack);
+        send(pack);
+    }
+    // empty on the timeout
+    std::string receive() {
+        char buf[chat::server::MAX_DATAGRAM];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        return n > 0 ? std::string(buf, n) : std::string();
+    }
+
+  private:
+    int fd;
+    sockaddr_in relay{};
+};
+
+} // namespace test
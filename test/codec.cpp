@@ -0,0 +1,148 @@
+#include "audio/codec.hpp"
+#include "tone.hpp"
+#include <cmath>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+using namespace aud;
+using test::ToneSrc;
+
+TEST(codec, frame_durations) {
+    for (auto dur :
+         {FrameDuration::Ms2_5,
+          FrameDuration::Ms5,
+          FrameDuration::Ms10,
+          FrameDuration::Ms20,
+          FrameDuration::Ms40,
+          FrameDuration::Ms60}) {
+        size_t len = frameSize(dur);
+        SCOPED_TRACE(len);
+        ASSERT_LE(len * MAX_CHANNELS, Frame::capacity());
+
+        auto src = std::make_shared<ToneSrc>(len);
+        auto enc = std::make_shared<OpusEncSrc>(src, EncoderPreset::Voise);
+        OpusDecSrc dec(enc);
+        Frame frame;
+        for (int i = 0; i < 5; i++) {
+            dec.read(frame);
+            ASSERT_EQ(frame.size(), len);
+        }
+    }
+}
+
+TEST(codec, encoder_block_follows_the_frame_duration) {
+    EXPECT_EQ(maxEncoderBlockSize(frameSize(FrameDuration::Ms10)), MAX_ENCODER_BLOCK_SIZE);
+    EXPECT_EQ(maxEncoderBlockSize(FRAME_SIZE), MAX_ENCODER_BLOCK_SIZE);
+    EXPECT_EQ(maxEncoderBlockSize(frameSize(FrameDuration::Ms60)), 3 * MAX_ENCODER_BLOCK_SIZE);
+}
+
+namespace {
+
+// of the frame against the tone it was encoded from, dB
+float snr(const Frame &frame, size_t t0) {
+    float sig = 0, err = 0;
+    for (size_t i = 0; i < frame.size(); i++) {
+        float ref = ToneSrc::at(t0 + i);
+        sig += ref * ref;
+        err += (frame[i] - ref) * (frame[i] - ref);
+    }
+    return 10 * std::log10(sig / err);
+}
+
+template <typename Codec> void roundTrip(FrameDuration dur, float minSnr) {
+    size_t len = frameSize(dur);
+    CodecEncSrc<Codec> enc(std::make_shared<ToneSrc>(len), EncoderPreset::Voise);
+    EXPECT_EQ(enc.type(), Codec::TYPE);
+    StreamDec dec(1);
+    std::vector<uint8_t> block;
+    Frame frame;
+    for (size_t i = 0; i < 5; i++) {
+        enc.encode(block);
+        ASSERT_LE(block.size(), MAX_PAYLOAD_SIZE);
+        dec.decode(Codec::TYPE, block, frame, len);
+        ASSERT_EQ(frame.size(), len);
+        if (i > 0) { // the ADPCM steps adapt during the first one
+            EXPECT_GT(snr(frame, i * len), minSnr) << i;
+        }
+    }
+}
+
+} // namespace
+
+TEST(codec, pcm16_round_trip) {
+    roundTrip<Pcm16>(FrameDuration::Ms10, 80);
+}
+
+TEST(codec, adpcm_round_trip) {
+    roundTrip<Adpcm>(FrameDuration::Ms20, 20);
+}
+
+TEST(codec, adpcm_packets_decode_alone) {
+    size_t len = FRAME_SIZE;
+    AdpcmEncSrc enc(std::make_shared<ToneSrc>(len), EncoderPreset::Voise);
+    std::vector<uint8_t> block;
+    for (int i = 0; i < 3; i++) {
+        enc.encode(block);
+    }
+    EXPECT_EQ(block.size(), AdpcmEnc::HEADER_SIZE + len / 2);
+    // a decoder that has not seen the first ones
+    AdpcmDec dec(1);
+    Frame frame;
+    dec.decode(block, frame, len);
+    EXPECT_GT(snr(frame, 2 * len), 20);
+
+    std::vector<uint8_t> truncated(block.begin(), block.end() - 1);
+    EXPECT_THROW(dec.decode(truncated, frame, len), CodecException);
+    // the frame length is the one of the packet
+    dec.decode(block, frame, len / 2);
+    EXPECT_EQ(frame.size(), len);
+}
+
+TEST(codec, pcm16_frame_follows_the_packet) {
+    size_t len = frameSize(FrameDuration::Ms10);
+    Pcm16EncSrc enc(std::make_shared<ToneSrc>(len), EncoderPreset::Voise);
+    std::vector<uint8_t> block;
+    enc.encode(block);
+    Pcm16Dec dec(1);
+    Frame frame;
+    dec.decode(block, frame, FRAME_SIZE);
+    EXPECT_EQ(frame.size(), len);
+
+    std::vector<uint8_t> odd(block.begin(), block.end() - 1);
+    EXPECT_THROW(dec.decode(odd, frame, len), CodecException);
+    Pcm16Dec stereo(2);
+    std::vector<uint8_t> half(block.begin(), block.begin() + 6);
+    EXPECT_THROW(stereo.decode(half, frame, len), CodecException);
+}
+
+TEST(codec, stream_dec_conceals_with_the_last_codec) {
+    size_t len = frameSize(FrameDuration::Ms10);
+    Pcm16EncSrc enc(std::make_shared<ToneSrc>(len), EncoderPreset::Voise);
+    std::vector<uint8_t> block;
+    enc.encode(block);
+    StreamDec dec(1);
+    Frame played;
+    dec.decode(PayloadType::Pcm16, block, played, len);
+
+    // a loss repeats the frame, fading; there is no FEC to take from the next packet
+    Frame frame;
+    dec.decode(PayloadType::Opus, {}, frame, len);
+    ASSERT_EQ(frame.size(), len);
+    for (size_t i = 0; i < len; i++) {
+        ASSERT_FLOAT_EQ(frame[i], played[i] * CONCEAL_FADE);
+    }
+    enc.encode(block);
+    dec.decode(PayloadType::Pcm16, block, frame, len, true);
+    for (size_t i = 0; i < len; i++) {
+        ASSERT_FLOAT_EQ(frame[i], played[i] * CONCEAL_FADE * CONCEAL_FADE);
+    }
+
+    // the codec may change between packets
+    OpusEnc opus(EncoderPreset::Voise, 1);
+    Frame in(len);
+    opus.encode(in, block);
+    dec.decode(PayloadType::Opus, block, frame, len);
+    EXPECT_EQ(frame.size(), len);
+}
@@ -0,0 +1,94 @@
+#include "audio/dspchain.hpp"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace aud;
+
+namespace {
+
+struct Counter : DSP {
+    void process(Frame &frame) override {
+        calls++;
+        for (float &s : frame) {
+            s += 0.5f;
+        }
+    }
+    int calls = 0;
+};
+
+// counts the sweeps of the frame by the number of begin() calls
+struct Offset {
+    void begin() {
+        begins++;
+    }
+    float sample(float x) const {
+        return x - 0.25f;
+    }
+    int begins = 0;
+};
+
+Frame ramp() {
+    Frame f(FRAME_SIZE);
+    for (size_t i = 0; i < f.size(); i++) {
+        f[i] = (float)i / FRAME_SIZE * 2 - 1;
+    }
+    return f;
+}
+
+} // namespace
+
+static_assert(IsSampleStage<VolumeDSP>::value);
+static_assert(IsSampleStage<ClipDSP>::value);
+static_assert(!IsSampleStage<Counter>::value);
+
+TEST(dspchain, matches_sequential_dsps) {
+    DspChain<VolumeDSP, ClipDSP, Counter, Offset, VolumeDSP> chain;
+    chain.get<0>().set(300);
+    chain.get<4>().set(50);
+
+    VolumeDSP v1, v2;
+    ClipDSP clip;
+    Counter counter;
+    v1.set(300);
+    v2.set(50);
+
+    Frame expected = ramp();
+    v1.process(expected);
+    clip.process(expected);
+    counter.process(expected);
+    for (float &s : expected) {
+        s -= 0.25f;
+    }
+    v2.process(expected);
+
+    Frame frame = ramp();
+    chain.process(frame);
+    for (size_t i = 0; i < frame.size(); i++) {
+        ASSERT_FLOAT_EQ(frame[i], expected[i]);
+    }
+    ASSERT_EQ(chain.get<Counter>().calls, 1);
+}
+
+TEST(dspchain, fuses_per_sample_stages) {
+    DspChain<Offset, VolumeDSP, Counter, Offset> chain;
+    Frame frame = ramp();
+    chain.process(frame);
+    chain.process(frame);
+    ASSERT_EQ(chain.get<0>().begins, 2);
+    ASSERT_EQ(chain.get<3>().begins, 2);
+    ASSERT_EQ(chain.get<Counter>().calls, 2);
+    ASSERT_FLOAT_EQ(frame[0], -1.f);
+}
+
+TEST(dspchain, plugs_into_dsp_list) {
+    list<shared_ptr<DSP>> dsps;
+    auto chain = std::make_shared<DspChain<VolumeDSP, ClipDSP>>();
+    chain->get<VolumeDSP>().set(1000);
+    dsps.push_back(chain);
+    Frame frame = ramp();
+    for (auto &dsp : dsps) {
+        dsp->process(frame);
+    }
+    ASSERT_FLOAT_EQ(frame.front(), -1.f);
+    ASSERT_FLOAT_EQ(frame.back(), 1.f);
+}
@@ -0,0 +1,64 @@
+#include "audio/codec.hpp"
+#include "tone.hpp"
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+using namespace aud;
+using test::ToneSrc;
+
+TEST(dtx, gate_is_off_by_default) {
+    auto src = std::make_shared<ToneSrc>();
+    OpusEncSrc es(src, EncoderPreset::Voise);
+    std::vector<uint8_t> block;
+    src->vad = 0;
+    for (int i = 0; i < 20; i++) {
+        es.encode(block);
+        ASSERT_GT(block.size(), 2u);
+    }
+    ASSERT_EQ(es.gated(), 0u);
+}
+
+TEST(dtx, gates_silence_after_hangover) {
+    auto src = std::make_shared<ToneSrc>();
+    OpusEncSrc es(src, EncoderPreset::Voise);
+    es.setVadGate(VAD_THRESHOLD, 3);
+    std::vector<uint8_t> block;
+
+    es.encode(block);
+    ASSERT_FALSE(block.empty());
+
+    src->vad = 0.1f;
+    for (int i = 0; i < 3; i++) {
+        es.encode(block);
+        ASSERT_FALSE(block.empty()) << "hangover frame " << i;
+    }
+    for (int i = 0; i < 10; i++) {
+        es.encode(block);
+        ASSERT_TRUE(block.empty());
+    }
+    ASSERT_EQ(es.gated(), 10u);
+
+    src->vad = 0.9f;
+    es.encode(block);
+    ASSERT_FALSE(block.empty());
+}
+
+TEST(dtx, simulcast_layers_gate_together) {
+    auto src = std::make_shared<ToneSrc>();
+    OpusEncSrc es(src, EncoderPreset::Voise);
+    es.setVadGate(VAD_THRESHOLD, 0);
+    es.setSimulcast(VOISE_LOW_BITRATE);
+    std::vector<uint8_t> high, low;
+
+    es.encode(high, low);
+    ASSERT_FALSE(high.empty());
+    ASSERT_FALSE(low.empty());
+
+    src->vad = 0.1f;
+    es.encode(high, low);
+    ASSERT_TRUE(high.empty());
+    ASSERT_TRUE(low.empty());
+    ASSERT_EQ(es.gated(), 1u);
+}
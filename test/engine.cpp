@@ -0,0 +1,157 @@
+#include "audio/audio.hpp"
+#include "util.hpp"
+#include <atomic>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+using namespace aud;
+using namespace std::chrono_literals;
+
+namespace {
+
+// counts the frames, there is always room
+class CountOutput : public Output {
+  public:
+    void stop() override {}
+    void start() override {}
+    int channels() const override {
+        return 1;
+    }
+    void write(Frame &) override {
+        written++;
+    }
+    size_t writable() const override {
+        return 1;
+    }
+    size_t frameSize() const override {
+        return FRAME_SIZE;
+    }
+    std::atomic<int> written{0};
+};
+
+// one frame per service, read() throws or blocks on demand
+class TestSource : public RawSource {
+  public:
+    void start() override {
+        st = State::Active;
+    }
+    void stop() override {
+        st = State::Stopped;
+    }
+    State state() override {
+        return st;
+    }
+    void lockState() override {
+        mux.lock();
+    }
+    void unlockState() override {
+        mux.unlock();
+    }
+    void waitActive() override {}
+    bool ready() override {
+        return !served.exchange(true);
+    }
+    int channels() const override {
+        return 1;
+    }
+    void read(Frame &frame) override {
+        if (delay.count()) {
+            std::this_thread::sleep_for(delay);
+        }
+        if (throws) {
+            throw std::runtime_error("test source");
+        }
+        frame.resize(FRAME_SIZE);
+    }
+    void next() {
+        served = false;
+    }
+
+    std::atomic<State> st{State::Stopped};
+    std::atomic<bool> throws{false};
+    std::atomic<bool> served{false};
+    std::chrono::milliseconds delay{0};
+    std::mutex mux;
+};
+
+class EngineTest : public testing::Test {
+  protected:
+    static void SetUpTestSuite() {
+        test::muteLog();
+        AudioEngine::instance().start();
+    }
+    static void TearDownTestSuite() {
+        AudioEngine::instance().stop();
+    }
+};
+
+} // namespace
+
+using test::waitFor;
+
+TEST_F(EngineTest, services_the_players) {
+    auto src = std::make_shared<TestSource>();
+    auto out = std::make_shared<CountOutput>();
+    Player player(src, out);
+    player.start();
+    ASSERT_TRUE(waitFor([&] { return out->written == 1; }));
+    src->next();
+    ASSERT_TRUE(waitFor([&] { return out->written == 2; }));
+}
+
+TEST_F(EngineTest, a_throwing_source_does_not_stop_the_others) {
+    auto bad = std::make_shared<TestSource>();
+    auto good = std::make_shared<TestSource>();
+    auto badOut = std::make_shared<CountOutput>();
+    auto goodOut = std::make_shared<CountOutput>();
+    bad->throws = true;
+    Player badPlayer(bad, badOut);
+    Player goodPlayer(good, goodOut);
+    badPlayer.start();
+    goodPlayer.start();
+    ASSERT_TRUE(waitFor([&] { return bad->served.load(); }));
+    // the engine is alive and the state lock was released
+    ASSERT_TRUE(waitFor([&] { return goodOut->written == 1; }));
+    good->next();
+    ASSERT_TRUE(waitFor([&] { return goodOut->written == 2; }));
+    ASSERT_TRUE(waitFor([&] {
+        if (!bad->mux.try_lock()) {
+            return false;
+        }
+        bad->mux.unlock();
+        return true;
+    }));
+    EXPECT_EQ(badOut->written, 0);
+}
+
+TEST_F(EngineTest, remove_does_not_wait_for_another_player) {
+    auto slow = std::make_shared<TestSource>();
+    auto slowOut = std::make_shared<CountOutput>();
+    slow->delay = 300ms;
+    Player slowPlayer(slow, slowOut);
+    slowPlayer.start();
+    ASSERT_TRUE(waitFor([&] { return slow->served.load(); }));
+    // the slow read is in progress
+    auto begin = std::chrono::steady_clock::now();
+    {
+        Player player(std::make_shared<TestSource>(), std::make_shared<CountOutput>());
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - begin, 100ms);
+}
+
+TEST_F(EngineTest, calls_back_at_the_end_of_the_source) {
+    auto src = std::make_shared<TestSource>();
+    std::atomic<int> calls{0};
+    Player player(src, std::make_shared<CountOutput>());
+    player.endOfSourceCallback = [&] { calls++; };
+    player.start();
+    src->st = State::Finalized;
+    ASSERT_TRUE(waitFor([&] { return calls == 1; }));
+    std::this_thread::sleep_for(20ms);
+    EXPECT_EQ(calls, 1);
+    EXPECT_EQ(player.state(), State::Finalized);
+}
@@ -0,0 +1,134 @@
+#include "audio/feedback.hpp"
+#include <chrono>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace aud;
+
+namespace {
+
+class FakeEnc : public EncodedSource {
+  public:
+    void encode(std::vector<uint8_t> &block) override {
+        block.clear();
+    }
+    void setPacketLossPrec(int perc) override {
+        loss = perc;
+    }
+    void setBitrate(int b) override {
+        bitrate = b;
+    }
+    void setFec(bool on) override {
+        fec = on;
+    }
+    void lockState() override {}
+    void unlockState() override {}
+    void start() override {}
+    void stop() override {}
+    State state() override {
+        return State::Active;
+    }
+    void waitActive() override {}
+    bool ready() override {
+        return true;
+    }
+    int channels() const override {
+        return 1;
+    }
+
+    int loss = -1;
+    int bitrate = -1;
+    bool fec = true;
+};
+
+const std::vector<uint8_t> &report(uint8_t loss, uint32_t jitterUs = 0) {
+    static std::vector<uint8_t> out;
+    ReceiverReport rep;
+    rep.loss = loss;
+    rep.jitterUs = jitterUs;
+    rep.sentMs = 1;
+    rep.serialize(out);
+    return out;
+}
+
+} // namespace
+
+TEST(feedback, report_roundtrip) {
+    ReceiverReport rep;
+    rep.loss = 7;
+    rep.jitterUs = 12345;
+    rep.sentMs = 0xDEADBEEF;
+    rep.echoMs = 42;
+    rep.holdMs = 17;
+    std::vector<uint8_t> out;
+    rep.serialize(out);
+    ASSERT_EQ(out.size(), ReceiverReport::SIZE);
+
+    ReceiverReport back;
+    ASSERT_TRUE(ReceiverReport::parse(out, back));
+    ASSERT_EQ(back.loss, 7);
+    ASSERT_EQ(back.jitterUs, 12345u);
+    ASSERT_EQ(back.sentMs, 0xDEADBEEFu);
+    ASSERT_EQ(back.echoMs, 42u);
+    ASSERT_EQ(back.holdMs, 17u);
+
+    std::vector<uint8_t> opus = {0xFC, 0xFF, 0xFE};
+    ASSERT_FALSE(ReceiverReport::isReport(opus));
+    out.pop_back();
+    ASSERT_FALSE(ReceiverReport::isReport(out));
+}
+
+TEST(feedback, backs_off_on_loss) {
+    auto enc = std::make_shared<FakeEnc>();
+    RateController rc(enc, EncoderPreset::Voise);
+    int start = rc.bitrate();
+    ASSERT_TRUE(rc.onPacket(report(30)));
+    ASSERT_LT(rc.bitrate(), start);
+    ASSERT_EQ(enc->bitrate, rc.bitrate());
+    ASSERT_EQ(enc->loss, 30);
+    ASSERT_TRUE(enc->fec);
+
+    for (int i = 0; i < 50; i++) {
+        rc.onPacket(report(50));
+    }
+    ASSERT_EQ(rc.bitrate(), 8000);
+}
+
+TEST(feedback, grows_on_clean_link) {
+    auto enc = std::make_shared<FakeEnc>();
+    RateController rc(enc, EncoderPreset::Voise);
+    int start = rc.bitrate();
+    rc.onPacket(report(0));
+    ASSERT_GT(rc.bitrate(), start);
+    ASSERT_FALSE(enc->fec);
+    ASSERT_EQ(enc->loss, 0);
+
+    // high jitter holds it
+    int held = rc.bitrate();
+    rc.onPacket(report(0, 50000));
+    ASSERT_EQ(rc.bitrate(), held);
+
+    for (int i = 0; i < 100; i++) {
+        rc.onPacket(report(0));
+    }
+    ASSERT_EQ(rc.bitrate(), 64000);
+}
+
+TEST(feedback, measures_rtt) {
+    auto encA = std::make_shared<FakeEnc>(), encB = std::make_shared<FakeEnc>();
+    RateController a(encA, EncoderPreset::Voise), b(encB, EncoderPreset::Voise);
+    NetBuf nb;
+    std::vector<uint8_t> pack;
+
+    a.makeReport(nb, pack);
+    ASSERT_TRUE(b.onPacket(pack));
+    ASSERT_EQ(b.rtt(), 0.f);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30)); // hold time, not a part of the RTT
+    b.makeReport(nb, pack);
+    ASSERT_TRUE(a.onPacket(pack));
+    ASSERT_LT(a.rtt(), 20.f);
+    ASSERT_GE(a.rtt(), 0.f);
+}
@@ -0,0 +1,119 @@
+#include "audio/frame.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace aud;
+
+static std::atomic<size_t> allocations{0};
+
+// the plain new and delete are replaced together, the aligned ones keep their own pair
+static void *allocate(size_t size) {
+    allocations++;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// out of line: inlined into a new-expression, the free() of a new'd pointer looks mismatched
+__attribute__((noinline)) static void deallocate(void *p) noexcept {
+    std::free(p);
+}
+
+void *operator new(size_t size) {
+    return allocate(size);
+}
+
+void *operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void *p) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p) noexcept {
+    deallocate(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    deallocate(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+    deallocate(p);
+}
+
+TEST(frame, aligned_and_zeroed) {
+    Frame f(FRAME_SIZE);
+    ASSERT_EQ(f.size(), FRAME_SIZE);
+    ASSERT_EQ((uintptr_t)f.data() % CACHE_LINE_SIZE, 0u);
+    for (float s : f) {
+        ASSERT_EQ(s, 0.f);
+    }
+    f[0] = 1;
+    f.resize(1);
+    f.resize(2);
+    ASSERT_EQ(f[0], 1.f);
+    ASSERT_EQ(f[1], 0.f);
+}
+
+TEST(frame, move_transfers_block) {
+    Frame a(FRAME_SIZE);
+    a[5] = 3;
+    const float *p = a.data();
+    Frame b = std::move(a);
+    ASSERT_EQ(b.data(), p);
+    ASSERT_EQ(b[5], 3.f);
+    ASSERT_EQ(a.data(), nullptr);
+    ASSERT_TRUE(a.empty());
+
+    Frame c(FRAME_SIZE);
+    c = std::move(b);
+    ASSERT_EQ(c.data(), p);
+}
+
+TEST(frame, no_allocations_in_steady_state) {
+    {
+        Frame warm(FRAME_SIZE);
+    }
+    size_t before = allocations;
+    for (int i = 0; i < 10000; i++) {
+        Frame f(FRAME_SIZE * MAX_CHANNELS);
+        Frame g = std::move(f);
+        g.resize(FRAME_SIZE);
+    }
+    ASSERT_EQ(allocations, before);
+}
+
+TEST(frame, concurrent_acquire_release) {
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed{false};
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            std::vector<Frame> held;
+            for (int i = 0; i < 20000; i++) {
+                Frame f(8);
+                f[0] = (float)t;
+                f[7] = (float)i;
+                held.push_back(std::move(f));
+                if (held.size() > 16) {
+                    for (auto &h : held) {
+                        failed = failed || h[0] != (float)t;
+                    }
+                    held.clear();
+                }
+            }
+        });
+    }
+    for (auto &th : threads) {
+        th.join();
+    }
+    ASSERT_FALSE(failed);
+}
@@ -0,0 +1,218 @@
+#include "client.hpp"
+#include "server/mcu.hpp"
+#include "server/relay.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace chat::server;
+
+static constexpr auto FRAME_TIME = std::chrono::milliseconds(20);
+
+// encodes what a client would send, a tone or silence
+class Talker {
+  public:
+    explicit Talker(float freq, size_t frameLen = aud::FRAME_SIZE)
+        : frameLen(frameLen), freq(freq) {}
+    std::vector<uint8_t> next(float amp) {
+        frame.resize(frameLen);
+        for (auto &s : frame) {
+            s = amp * std::sin(phase);
+            phase += 2 * (float)M_PI * freq / aud::SAMPLE_RATE;
+        }
+        enc.encode(frame, pack);
+        std::vector<uint8_t> datagram(aud::MediaHeader::SIZE + pack.size());
+        header.write(datagram);
+        header.seq++;
+        header.timestamp += frameLen;
+        std::copy(pack.begin(), pack.end(), datagram.begin() + aud::MediaHeader::SIZE);
+        return datagram;
+    }
+
+  private:
+    aud::OpusEnc enc{aud::EncoderPreset::Voise, 1};
+    aud::MediaHeader header;
+    aud::Frame frame;
+    std::vector<uint8_t> pack;
+    const size_t frameLen;
+    const float freq;
+    float phase = 0;
+};
+
+
+class RoomMixTest : public testing::Test {
+  protected:
+    static void SetUpTestSuite() {
+        test::muteLog();
+    }
+    RoomMixTest() {
+        for (size_t i = 0; i < 4; i++) {
+            talkers.push_back(std::make_unique<Talker>(300 + 200 * i));
+            mix.add();
+        }
+    }
+    // a frame of every member at its amplitude, in real time for the jitter buffers
+    const std::vector<RoomMix::Output> &step(const std::vector<float> &amps) {
+        for (size_t i = 0; i < amps.size(); i++) {
+            auto pack = talkers[i]->next(amps[i]);
+            mix.push(i, pack.data(), pack.size());
+        }
+        std::this_thread::sleep_for(FRAME_TIME);
+        return mix.mix();
+    }
+
+    RoomMix mix;
+    std::vector<std::unique_ptr<Talker>> talkers;
+};
+
+TEST_F(RoomMixTest, listeners_share_one_encode) {
+    for (size_t i = 0; i < 10; i++) {
+        step({0.3, 0, 0, 0});
+    }
+    uint64_t before = mix.encoded();
+    auto &out = step({0.3, 0, 0, 0});
+    EXPECT_EQ(mix.encoded() - before, 1u);
+    EXPECT_EQ(mix.talkers(), 1u);
+    EXPECT_EQ(out[0].payload, nullptr); // nobody else to hear
+    ASSERT_NE(out[1].payload, nullptr);
+    EXPECT_FALSE(out[1].payload->empty());
+    EXPECT_EQ(out[2].payload, out[1].payload);
+    EXPECT_EQ(out[3].payload, out[1].payload);
+}
+
+TEST_F(RoomMixTest, talkers_get_minus_one) {
+    for (size_t i = 0; i < 10; i++) {
+        step({0.3, 0.3, 0, 0});
+    }
+    uint64_t before = mix.encoded();
+    auto &out = step({0.3, 0.3, 0, 0});
+    EXPECT_EQ(mix.encoded() - before, 3u);
+    EXPECT_EQ(mix.talkers(), 2u);
+    ASSERT_NE(out[0].payload, nullptr);
+    ASSERT_NE(out[1].payload, nullptr);
+    ASSERT_NE(out[2].payload, nullptr);
+    EXPECT_NE(out[0].payload, out[1].payload);
+    EXPECT_NE(out[0].payload, out[2].payload);
+    EXPECT_NE(out[1].payload, out[2].payload);
+    EXPECT_EQ(out[3].payload, out[2].payload);
+}
+
+TEST_F(RoomMixTest, silence_after_the_hangover) {
+    for (size_t i = 0; i < 10; i++) {
+        step({0.3, 0.3, 0, 0});
+    }
+    // the other talker is still heard, by the first one on its own encoder
+    for (size_t i = 0; i < 5; i++) {
+        step({0, 0.3, 0, 0});
+    }
+    EXPECT_EQ(mix.talkers(), 2u);
+    for (size_t i = 0; i < TALK_HANGOVER; i++) {
+        step({0, 0.3, 0, 0});
+    }
+    auto &out = step({0, 0.3, 0, 0});
+    EXPECT_EQ(mix.talkers(), 1u);
+    EXPECT_EQ(out[0].payload, out[2].payload);
+
+    for (size_t i = 0; i < 10; i++) {
+        step({0, 0, 0, 0});
+    }
+    uint64_t before = mix.encoded();
+    for (auto &o : step({0, 0, 0, 0})) {
+        EXPECT_EQ(o.payload, nullptr);
+    }
+    EXPECT_EQ(mix.encoded(), before);
+}
+
+TEST_F(RoomMixTest, one_stream_per_member) {
+    std::vector<aud::MediaHeader> seen;
+    auto record = [&](const RoomMix::Output &o) {
+        if (o.payload) {
+            aud::MediaPacket mp;
+            std::vector<uint8_t> datagram(o.header, o.header + aud::MediaHeader::SIZE);
+            ASSERT_TRUE(aud::MediaPacket::parse(datagram, mp));
+            seen.push_back(mp.header());
+        }
+    };
+    // the first member hears the second on its own encoder, then on the shared one
+    for (size_t i = 0; i < 10; i++) {
+        record(step({0.3, 0.3, 0, 0})[0]);
+    }
+    for (size_t i = 0; i < TALK_HANGOVER + 5; i++) {
+        record(step({0, 0.3, 0, 0})[0]);
+    }
+    ASSERT_GT(seen.size(), TALK_HANGOVER);
+    EXPECT_TRUE(seen[0].marker);
+    for (size_t i = 1; i < seen.size(); i++) {
+        EXPECT_EQ(seen[i].stream, MIX_STREAM);
+        EXPECT_FALSE(seen[i].marker);
+        EXPECT_EQ(seen[i].seq, (uint16_t)(seen[i - 1].seq + 1));
+        EXPECT_EQ(seen[i].timestamp - seen[i - 1].timestamp, aud::FRAME_SIZE);
+    }
+}
+
+TEST_F(RoomMixTest, remove_moves_the_last_member) {
+    for (size_t i = 0; i < 10; i++) {
+        step({0, 0, 0, 0.3});
+    }
+    mix.remove(0);
+    EXPECT_EQ(mix.talkers(), 1u);
+    for (size_t i = 0; i < 3; i++) {
+        step({0.3, 0, 0});
+    }
+    auto &out = step({0.3, 0, 0});
+    ASSERT_EQ(out.size(), 3u);
+    EXPECT_EQ(out[0].payload, nullptr);
+    EXPECT_NE(out[1].payload, nullptr);
+    EXPECT_EQ(out[2].payload, out[1].payload);
+}
+
+TEST_F(RoomMixTest, gathers_shorter_frames) {
+    // two 10 ms packets a mix, read as one frame
+    Talker talker(700, aud::frameSize(aud::FrameDuration::Ms10));
+    auto send = [&] {
+        for (int k = 0; k < 2; k++) {
+            auto pack = talker.next(0.3);
+            mix.push(0, pack.data(), pack.size());
+        }
+    };
+    for (size_t i = 0; i < 10; i++) {
+        send();
+        step({});
+    }
+    send();
+    auto &out = step({});
+    EXPECT_EQ(mix.talkers(), 1u);
+    EXPECT_EQ(out[0].payload, nullptr);
+    ASSERT_NE(out[1].payload, nullptr);
+    EXPECT_EQ(out[2].payload, out[1].payload);
+}
+
+TEST(McuRelay, mixes_the_room) {
+    test::muteLog();
+    Relay relay(0, 1, false, RelayMode::Mix);
+    std::thread loop([&] { relay.run(); });
+
+    test::Client a(relay.port()), b(relay.port());
+    a.join(5);
+    b.join(5);
+    ASSERT_TRUE(test::waitFor([&] { return relay.stats().members == 2; }));
+
+    Talker talker(440);
+    for (size_t i = 0; i < 20; i++) {
+        a.send(talker.next(0.3));
+        std::this_thread::sleep_for(FRAME_TIME);
+    }
+    auto datagram = b.receive();
+    aud::MediaPacket mp;
+    ASSERT_TRUE(aud::MediaPacket::parse({(const uint8_t *)datagram.data(), datagram.size()}, mp));
+    EXPECT_EQ(mp.stream(), MIX_STREAM);
+    EXPECT_FALSE(mp.payload().empty());
+    EXPECT_GT(relay.stats().encoded, 0u);
+
+    relay.stop();
+    loop.join();
+}
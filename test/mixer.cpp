@@ -0,0 +1,144 @@
+#include "audio/mixer.hpp"
+#include "util.hpp"
+#include <gtest/gtest.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+using namespace aud;
+
+namespace {
+
+constexpr float EPS = 1e-5f;
+
+// frames of a constant level
+class LevelSource : public RawSource {
+  public:
+    explicit LevelSource(float level, size_t len = FRAME_SIZE) : level(level), len(len) {}
+    void start() override {
+        st = State::Active;
+    }
+    void stop() override {
+        st = State::Stopped;
+    }
+    State state() override {
+        return st;
+    }
+    void lockState() override {
+        mux.lock();
+    }
+    void unlockState() override {
+        mux.unlock();
+    }
+    void waitActive() override {}
+    bool ready() override {
+        return isReady;
+    }
+    int channels() const override {
+        return 1;
+    }
+    void read(Frame &frame) override {
+        if (throws) {
+            throw std::runtime_error("test source");
+        }
+        frame.resize(len);
+        std::fill(frame.begin(), frame.end(), level);
+        reads++;
+    }
+
+    float level;
+    size_t len;
+    State st = State::Active;
+    bool isReady = true;
+    bool throws = false;
+    int reads = 0;
+    std::mutex mux;
+};
+
+class MixerTest : public testing::Test {
+  protected:
+    static void SetUpTestSuite() {
+        test::muteLog();
+    }
+    float read() {
+        mixer.read(frame);
+        EXPECT_EQ(frame.size(), FRAME_SIZE);
+        return frame[FRAME_SIZE / 2];
+    }
+
+    Mixer mixer;
+    Frame frame;
+};
+
+} // namespace
+
+TEST_F(MixerTest, silence_without_inputs) {
+    EXPECT_EQ(read(), 0.f);
+}
+
+TEST_F(MixerTest, sums_with_gain) {
+    mixer.add(std::make_shared<LevelSource>(0.1f));
+    size_t id = mixer.add(std::make_shared<LevelSource>(0.2f), 0.5f);
+    EXPECT_NEAR(read(), 0.2f, EPS);
+    mixer.setGain(id, 2);
+    EXPECT_NEAR(read(), 0.5f, EPS);
+    mixer.setGain(id, 0);
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    mixer.remove(id);
+    EXPECT_NEAR(read(), 0.1f, EPS);
+}
+
+TEST_F(MixerTest, skips_inputs_that_are_not_ready) {
+    auto a = std::make_shared<LevelSource>(0.1f);
+    auto b = std::make_shared<LevelSource>(0.2f);
+    mixer.add(a);
+    mixer.add(b);
+    b->isReady = false;
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    b->isReady = true;
+    b->st = State::Stopped;
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    b->st = State::Active;
+    EXPECT_NEAR(read(), 0.3f, EPS);
+}
+
+TEST_F(MixerTest, gathers_other_frame_durations) {
+    auto shorter = std::make_shared<LevelSource>(0.1f, FRAME_SIZE / 2);
+    auto longer = std::make_shared<LevelSource>(0.2f, 3 * FRAME_SIZE);
+    mixer.add(shorter);
+    mixer.add(longer);
+    for (int i = 0; i < 6; i++) {
+        EXPECT_NEAR(read(), 0.3f, EPS) << i;
+    }
+    EXPECT_EQ(shorter->reads, 12);
+    EXPECT_EQ(longer->reads, 2);
+}
+
+TEST_F(MixerTest, skips_a_throwing_input) {
+    auto bad = std::make_shared<LevelSource>(0.5f);
+    bad->throws = true;
+    mixer.add(bad);
+    mixer.add(std::make_shared<LevelSource>(0.1f));
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    // the state lock was released
+    ASSERT_TRUE(bad->mux.try_lock());
+    bad->mux.unlock();
+}
+
+TEST_F(MixerTest, limits_softly) {
+    // transparent below the knee
+    auto src = std::make_shared<LevelSource>(0.5f);
+    mixer.add(src);
+    EXPECT_NEAR(read(), 0.5f, EPS);
+    // above it the peak stays below 1 and the order of the levels is kept
+    src->level = 0.8f;
+    float a = read();
+    src->level = 3.f;
+    float b = read();
+    EXPECT_LT(a, 0.8f);
+    EXPECT_GT(a, 0.6f);
+    EXPECT_GT(b, a);
+    EXPECT_LE(b, 1.f);
+    src->level = -3.f;
+    EXPECT_NEAR(read(), -b, EPS);
+}
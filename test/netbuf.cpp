@@ -0,0 +1,250 @@
+#include "audio/audio.hpp"
+#include "audio/codec.hpp"
+#include "util.hpp"
+#include <cmath>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace aud;
+
+namespace {
+
+// PCM16 frames of a constant level tell the played packets apart exactly
+constexpr size_t LEN = frameSize(FrameDuration::Ms10);
+constexpr float EPS = 1.f / 16384;
+
+class NetBufTest : public testing::Test {
+  protected:
+    static void SetUpTestSuite() {
+        test::muteLog();
+    }
+    // timestamp 0 keeps the jitter estimate at 0, the packets are pushed at once anyway
+    void push(uint16_t seq, float level, uint32_t timestamp = 0) {
+        Frame in(LEN);
+        std::fill(in.begin(), in.end(), level);
+        enc.encode(in, payload);
+        nb.push(payload, seq, timestamp, PayloadType::Pcm16);
+    }
+    // the level of the next frame, NAN for a frame that is not the sender's audio
+    float read() {
+        nb.read(frame);
+        EXPECT_EQ(frame.size(), LEN);
+        return frame.vad == 1 ? frame[LEN / 2] : NAN;
+    }
+
+    NetBuf nb{10, 1, FrameDuration::Ms10};
+    Pcm16Enc enc{EncoderPreset::Voise, 1};
+    std::vector<uint8_t> payload;
+    Frame frame;
+};
+
+} // namespace
+
+TEST_F(NetBufTest, silence_before_the_first_packet) {
+    nb.read(frame);
+    EXPECT_EQ(frame.vad, 0.f);
+    EXPECT_EQ(frame.size(), LEN);
+}
+
+TEST_F(NetBufTest, reorders) {
+    push(0, 0.1f);
+    push(2, 0.3f);
+    push(1, 0.2f);
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    EXPECT_NEAR(read(), 0.2f, EPS);
+    EXPECT_NEAR(read(), 0.3f, EPS);
+}
+
+TEST_F(NetBufTest, conceals_a_broken_packet) {
+    push(0, 0.4f);
+    std::vector<uint8_t> odd(3);
+    nb.push(odd, 1, 0, PayloadType::Pcm16);
+    push(2, 0.2f);
+    EXPECT_NEAR(read(), 0.4f, EPS);
+    nb.read(frame);
+    ASSERT_EQ(frame.size(), LEN);
+    EXPECT_NEAR(frame[LEN / 2], 0.4f * CONCEAL_FADE, EPS);
+    EXPECT_NEAR(read(), 0.2f, EPS);
+}
+
+TEST_F(NetBufTest, late_packet_is_dropped) {
+    push(0, 0.1f);
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    push(2, 0.3f);
+    // 1 is lost, there are newer packets; PCM16 has no FEC, so it is concealed
+    EXPECT_NEAR(read(), 0.1f * CONCEAL_FADE, EPS);
+    EXPECT_NEAR(read(), 0.3f, EPS);
+    push(1, 0.2f); // too late
+    push(3, 0.4f);
+    EXPECT_NEAR(read(), 0.4f, EPS);
+}
+
+TEST_F(NetBufTest, resyncs_on_a_sequence_jump) {
+    push(0, 0.1f);
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    // the sender restarted, far outside of the window; it is buffered again from there
+    push(1000, 0.5f);
+    push(1, 0.2f); // now too late
+    push(1001, 0.6f);
+    EXPECT_NEAR(read(), 0.5f, EPS);
+    EXPECT_NEAR(read(), 0.6f, EPS);
+}
+
+TEST_F(NetBufTest, underrun_stretches_without_losing_the_packet) {
+    push(0, 0.1f);
+    push(1, 0.4f);
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    EXPECT_NEAR(read(), 0.4f, EPS);
+    size_t target = nb.targetDepth();
+    // nothing buffered: the last frame is repeated, fading
+    EXPECT_NEAR(read(), 0.4f * CONCEAL_FADE, EPS);
+    // the packet was late, not lost
+    push(2, 0.2f);
+    push(3, 0.3f);
+    EXPECT_NEAR(read(), 0.2f, EPS);
+    // and the target is raised by a frame
+    EXPECT_EQ(nb.targetDepth(), target + 1);
+    EXPECT_NEAR(read(), 0.3f, EPS);
+}
+
+// any measured jitter keeps a frame in reserve, the target is 2 below
+TEST_F(NetBufTest, compresses_above_the_target) {
+    push(0, 0.1f);
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    // a loud frame one above the target is kept
+    for (uint16_t seq = 1; seq <= 4; seq++) {
+        push(seq, seq / 10.f + 0.1f);
+    }
+    for (uint16_t seq = 1; seq <= 4; seq++) {
+        EXPECT_NEAR(read(), seq / 10.f + 0.1f, EPS);
+    }
+    EXPECT_EQ(nb.targetDepth(), 2u);
+    // two above: 5 is crossfaded into 6
+    for (uint16_t seq = 5; seq <= 9; seq++) {
+        push(seq, seq / 10.f);
+    }
+    nb.read(frame);
+    EXPECT_NEAR(frame[0], 0.5f, 0.01f);
+    EXPECT_NEAR(frame[LEN - 1], 0.6f, 0.01f);
+    EXPECT_NEAR(read(), 0.7f, EPS);
+    EXPECT_NEAR(read(), 0.8f, EPS);
+    EXPECT_NEAR(read(), 0.9f, EPS);
+}
+
+TEST_F(NetBufTest, drops_a_quiet_frame_sooner) {
+    push(0, 0.1f);
+    EXPECT_NEAR(read(), 0.1f, EPS);
+    // one above the target, the quiet frame goes into the next one
+    push(1, 0.001f);
+    push(2, 0.3f);
+    push(3, 0.4f);
+    push(4, 0.5f);
+    nb.read(frame);
+    EXPECT_NEAR(frame[0], 0.001f, 0.01f);
+    EXPECT_NEAR(frame[LEN - 1], 0.3f, 0.01f);
+    EXPECT_NEAR(read(), 0.4f, EPS);
+    EXPECT_NEAR(read(), 0.5f, EPS);
+}
+
+TEST_F(NetBufTest, stretches_a_quiet_frame_below_the_target) {
+    // the underruns raise the target
+    push(0, 0.1f);
+    read();
+    read();
+    push(1, 0.1f);
+    read();
+    read();
+
+    push(2, 0.001f);
+    EXPECT_NEAR(read(), 0.001f, EPS);
+    EXPECT_GE(nb.targetDepth(), 3u);
+    // the buffer is short and the frame is quiet: it is concealed once more instead of waiting
+    push(3, 0.4f);
+    EXPECT_NEAR(read(), 0.001f * CONCEAL_FADE, EPS);
+    EXPECT_NEAR(read(), 0.4f, EPS);
+}
+
+TEST_F(NetBufTest, target_follows_the_jitter) {
+    // the frames arrive all at once, 8 frames late for the last one
+    for (uint16_t seq = 0; seq < 8; seq++) {
+        push(seq, 0.1f, seq * LEN);
+    }
+    read();
+    EXPECT_GT(nb.jitter(), 0.f);
+    EXPECT_GT(nb.targetDepth(), 1u);
+    EXPECT_LE(nb.targetDepth(), 10u);
+}
+
+TEST_F(NetBufTest, reports_the_loss) {
+    std::vector<int> reported;
+    nb.lossCallback = [&](int perc) { reported.push_back(perc); };
+    // every 10th frame is lost, two frames ahead of the playout so it is a loss and not an underrun
+    // the loss is counted over a second, 100 frames of 10 ms
+    for (uint16_t seq = 0; seq < 110; seq++) {
+        if (seq % 10 != 5) {
+            push(seq, 0.1f);
+        }
+        if (seq >= 2) {
+            read();
+        }
+    }
+    ASSERT_EQ(reported, std::vector<int>{10});
+    EXPECT_EQ(nb.loss(), 10);
+    EXPECT_EQ(nb.recovered(), 0u); // PCM16 has no FEC
+}
+
+TEST(netbuf, recovers_from_fec) {
+    test::muteLog();
+    NetBuf nb;
+    OpusEnc enc(EncoderPreset::Voise, 1);
+    enc.setFec(true);
+    enc.setPacketLossPrec(20);
+    Frame in(FRAME_SIZE);
+    std::vector<uint8_t> payload;
+    auto push = [&](uint16_t seq) {
+        for (size_t i = 0; i < in.size(); i++) {
+            in[i] = 0.3f * std::sin(0.05f * (seq * FRAME_SIZE + i));
+        }
+        enc.encode(in, payload);
+        nb.push(payload, seq, 0);
+    };
+    Frame frame;
+    push(0);
+    push(1);
+    nb.read(frame);
+    nb.read(frame);
+    // 2 is lost while 3 is there: the frame is decoded from the FEC data in 3
+    push(3);
+    push(4);
+    nb.read(frame);
+    EXPECT_EQ(nb.recovered(), 1u);
+    EXPECT_EQ(frame.vad, 1.f);
+    EXPECT_EQ(frame.size(), FRAME_SIZE);
+    // 3 still plays after it
+    nb.read(frame);
+    EXPECT_EQ(nb.recovered(), 1u);
+    EXPECT_EQ(nb.dropped(), 0u);
+}
+
+TEST(netbuf, follows_the_frame_duration_of_the_packets) {
+    test::muteLog();
+    NetBuf nb(10, 1, FrameDuration::Ms20);
+    OpusEnc enc(EncoderPreset::Voise, 1);
+    size_t len = frameSize(FrameDuration::Ms10);
+    Frame in(len);
+    std::vector<uint8_t> payload;
+    enc.encode(in, payload);
+    Frame frame;
+    nb.read(frame);
+    EXPECT_EQ(frame.size(), FRAME_SIZE); // nothing is known yet
+    nb.push(payload, 0, 0);
+    nb.push(payload, 1, len);
+    nb.read(frame);
+    EXPECT_EQ(frame.size(), len);
+    nb.read(frame);
+    EXPECT_EQ(frame.size(), len);
+    // and so does the concealment
+    nb.read(frame);
+    EXPECT_EQ(frame.size(), len);
+}
@@ -0,0 +1,170 @@
+#include "audio/audio.hpp"
+#include "audio/codec.hpp"
+#include "audio/feedback.hpp"
+#include "audio/packet.hpp"
+#include "audio/simd.hpp"
+#include <cmath>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace aud;
+
+TEST(packet, round_trip) {
+    MediaHeader h;
+    h.marker = true;
+    h.seq = 0xBEEF;
+    h.timestamp = 0x12345678;
+    h.stream = 0xCAFEF00D;
+    std::vector<uint8_t> datagram(MediaHeader::SIZE + 3);
+    h.write(datagram);
+    datagram[12] = 1;
+    datagram[13] = 2;
+    datagram[14] = 3;
+
+    MediaPacket mp;
+    ASSERT_TRUE(MediaPacket::parse(datagram, mp));
+    EXPECT_EQ(mp.type(), PayloadType::Opus);
+    EXPECT_TRUE(mp.marker());
+    EXPECT_EQ(mp.seq(), 0xBEEF);
+    EXPECT_EQ(mp.timestamp(), 0x12345678u);
+    EXPECT_EQ(mp.stream(), 0xCAFEF00Du);
+    // a view, not a copy
+    EXPECT_EQ(mp.payload().data(), datagram.data() + MediaHeader::SIZE);
+    EXPECT_EQ(mp.payload().size(), 3u);
+    EXPECT_EQ(mp.header().seq, h.seq);
+}
+
+TEST(packet, wire_layout) {
+    MediaHeader h;
+    h.seq = 0x0102;
+    h.timestamp = 0x03040506;
+    h.stream = 0x0708090A;
+    uint8_t out[MediaHeader::SIZE];
+    h.write(out);
+    const uint8_t expected[] = {0x80, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    EXPECT_EQ(
+        std::vector<uint8_t>(out, out + sizeof(out)),
+        std::vector<uint8_t>(expected, expected + sizeof(expected))
+    );
+}
+
+TEST(packet, rejects_the_rest) {
+    MediaPacket mp;
+    std::vector<uint8_t> report;
+    ReceiverReport{}.serialize(report);
+    EXPECT_FALSE(MediaPacket::parse(report, mp));
+    std::vector<uint8_t> shortOne(MediaHeader::SIZE - 1, 0x80);
+    EXPECT_FALSE(MediaPacket::parse(shortOne, mp));
+    std::vector<uint8_t> rawOpus(40, 0x08);
+    EXPECT_FALSE(MediaPacket::parse(rawOpus, mp));
+    std::vector<uint8_t> empty;
+    EXPECT_FALSE(MediaPacket::parse(empty, mp));
+}
+
+TEST(packet, netbuf_takes_media_only) {
+    NetBuf nb;
+    std::vector<uint8_t> report;
+    ReceiverReport{}.serialize(report);
+    EXPECT_FALSE(nb.push(report));
+
+    std::vector<uint8_t> datagram(MediaHeader::SIZE + 1);
+    MediaHeader{}.write(datagram);
+    EXPECT_TRUE(nb.push(datagram));
+}
+
+TEST(packet, bundle_round_trip) {
+    uint8_t buf[64];
+    Bundle b(buf);
+    MediaHeader h;
+    h.stream = 1;
+    std::vector<uint8_t> payload = {1, 2, 3};
+    ASSERT_TRUE(b.add(h, payload));
+    h.stream = 2;
+    h.seq = 5;
+    ASSERT_TRUE(b.add(h, {}));
+    EXPECT_EQ(b.count(), 2u);
+    EXPECT_EQ(b.datagram().size(), 1 + 2 * (Bundle::ENTRY_OVERHEAD + MediaHeader::SIZE) + 3);
+    // no room for another one
+    std::vector<uint8_t> large(20);
+    EXPECT_FALSE(b.add(h, large));
+
+    auto datagram = b.datagram();
+    EXPECT_TRUE(Bundle::isBundle(datagram));
+    MediaPacket mp;
+    EXPECT_FALSE(MediaPacket::parse(datagram, mp));
+    Bundle::Reader reader(datagram);
+    ASSERT_TRUE(reader.next(mp));
+    EXPECT_EQ(mp.stream(), 1u);
+    EXPECT_EQ(std::vector<uint8_t>(mp.payload().begin(), mp.payload().end()), payload);
+    ASSERT_TRUE(reader.next(mp));
+    EXPECT_EQ(mp.stream(), 2u);
+    EXPECT_EQ(mp.seq(), 5);
+    EXPECT_TRUE(mp.payload().empty());
+    EXPECT_FALSE(reader.next(mp));
+}
+
+TEST(packet, bundle_truncated) {
+    uint8_t buf[64];
+    Bundle b(buf);
+    std::vector<uint8_t> payload(4);
+    ASSERT_TRUE(b.add(MediaHeader{}, payload));
+    ASSERT_TRUE(b.add(MediaHeader{}, payload));
+    auto datagram = b.datagram();
+    Bundle::Reader reader(datagram.first(datagram.size() - 1));
+    MediaPacket mp;
+    EXPECT_TRUE(reader.next(mp));
+    EXPECT_FALSE(reader.next(mp));
+}
+
+TEST(packet, netbuf_unpacks_bundles) {
+    NetBuf nb;
+    uint8_t buf[MAX_ENCODER_BLOCK_SIZE * 3];
+    Bundle b(buf);
+    OpusEnc enc(EncoderPreset::Voise, 1);
+    Frame silence(FRAME_SIZE);
+    std::vector<uint8_t> payload;
+    enc.encode(silence, payload);
+    MediaHeader h;
+    for (uint16_t seq = 0; seq < 3; seq++) {
+        h.seq = seq;
+        h.timestamp = seq * FRAME_SIZE;
+        ASSERT_TRUE(b.add(h, payload));
+    }
+    EXPECT_TRUE(nb.push(b.datagram()));
+    Frame frame;
+    nb.read(frame);
+    EXPECT_EQ(frame.vad, 1.f);
+
+    Bundle none(buf);
+    EXPECT_FALSE(nb.push(none.datagram()));
+}
+
+TEST(packet, netbuf_decodes_by_payload_type) {
+    NetBuf nb;
+    AdpcmEnc enc(EncoderPreset::Voise, 1);
+    Frame in(FRAME_SIZE);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = 0.25f * std::sin(2 * (float)M_PI * 440 * i / SAMPLE_RATE);
+    }
+    std::vector<uint8_t> payload;
+    MediaHeader h;
+    h.type = PayloadType::Adpcm;
+    std::vector<uint8_t> datagram;
+    for (uint16_t seq = 0; seq < 2; seq++) {
+        enc.encode(in, payload);
+        h.seq = seq;
+        h.timestamp = seq * FRAME_SIZE;
+        datagram.resize(MediaHeader::SIZE + payload.size());
+        h.write(datagram);
+        std::copy(payload.begin(), payload.end(), datagram.begin() + MediaHeader::SIZE);
+        ASSERT_TRUE(nb.push(datagram));
+    }
+    Frame frame;
+    nb.read(frame);
+    EXPECT_EQ(frame.vad, 1.f);
+    EXPECT_GT(simd::rms(frame.data(), frame.size()), 0.05f);
+
+    datagram[1] = 0x7F; // no such codec
+    EXPECT_FALSE(nb.push(datagram));
+}
@@ -0,0 +1,183 @@
+#include "audio/feedback.hpp"
+#include "audio/packet.hpp"
+#include "client.hpp"
+#include "server/relay.hpp"
+#include "util.hpp"
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace chat::server;
+using test::Client;
+
+// by the number of workers
+class RelayTest : public testing::TestWithParam<size_t> {
+  protected:
+    static void SetUpTestSuite() {
+        test::muteLog();
+    }
+    void SetUp() override {
+        relay = std::make_unique<Relay>(0, GetParam());
+        loop = std::thread([this] { relay->run(); });
+    }
+    void TearDown() override {
+        relay->stop();
+        loop.join();
+    }
+    // the relay learns the users from what they send
+    void join(Client &c) {
+        c.send("hi");
+        users++;
+        waitFor(users, 1);
+    }
+    void waitFor(size_t members, size_t rooms) {
+        ASSERT_TRUE(test::waitFor([&] {
+            auto stats = relay->stats();
+            return stats.members == members && stats.rooms == rooms;
+        }));
+    }
+
+    std::unique_ptr<Relay> relay;
+    std::thread loop;
+    size_t users = 0;
+};
+
+TEST_P(RelayTest, forwards_to_everyone_else) {
+    Client a(relay->port()), b(relay->port()), c(relay->port());
+    join(a);
+    join(b);
+    EXPECT_EQ(a.receive(), "hi"); // from b
+    join(c);
+    EXPECT_EQ(a.receive(), "hi");
+    EXPECT_EQ(b.receive(), "hi");
+
+    a.send("voice");
+    EXPECT_EQ(b.receive(), "voice");
+    EXPECT_EQ(c.receive(), "voice");
+    EXPECT_EQ(a.receive(), "");
+}
+
+// a media datagram of the layer, the payload tells it
+static std::string layered(aud::Layer layer) {
+    std::vector<uint8_t> pack(aud::MediaHeader::SIZE + 1);
+    aud::MediaHeader h;
+    h.layer = layer;
+    h.write(pack);
+    pack.back() = layer == aud::Layer::Low ? 'L' : 'H';
+    return std::string(pack.begin(), pack.end());
+}
+
+TEST_P(RelayTest, simulcast_layers) {
+    Client a(relay->port()), b(relay->port()), c(relay->port());
+    join(a);
+    join(b);
+    join(c);
+    while (a.receive() != "" || b.receive() != "" || c.receive() != "") {
+    }
+
+    // b is losing half of what it gets
+    std::vector<uint8_t> report;
+    aud::ReceiverReport rep;
+    rep.loss = 50;
+    rep.serialize(report);
+    b.send(std::string(report.begin(), report.end()));
+    // no simulcast yet, everyone hears it
+    EXPECT_EQ(a.receive().size(), report.size());
+    EXPECT_EQ(c.receive().size(), report.size());
+    ASSERT_TRUE(test::waitFor([&] { return relay->stats().lowLayer == 1; }));
+
+    a.send(layered(aud::Layer::High));
+    a.send(layered(aud::Layer::Low));
+    EXPECT_EQ(b.receive().back(), 'L');
+    EXPECT_EQ(b.receive(), "");
+    EXPECT_EQ(c.receive().back(), 'H');
+    EXPECT_EQ(c.receive(), "");
+
+    // now that a simulcasts, the reports of b do not reach it
+    b.send(std::string(report.begin(), report.end()));
+    EXPECT_EQ(a.receive(), "");
+    // the single layer senders still reach everyone
+    c.send(layered(aud::Layer::Single));
+    EXPECT_EQ(a.receive().back(), 'H');
+    EXPECT_EQ(b.receive().back(), 'H');
+}
+
+TEST_P(RelayTest, bursts) {
+    const size_t burst = 100; // the client socket buffer holds them all
+    Client a(relay->port()), b(relay->port()), c(relay->port());
+    join(a);
+    join(b);
+    join(c);
+    while (a.receive() != "" || b.receive() != "" || c.receive() != "") {
+    }
+
+    for (size_t i = 0; i < burst; i++) {
+        a.send("a" + std::to_string(i));
+        b.send("b" + std::to_string(i));
+    }
+    size_t fromA = 0, fromB = 0;
+    for (std::string msg; !(msg = c.receive()).empty();) {
+        (msg[0] == 'a' ? fromA : fromB)++;
+    }
+    EXPECT_EQ(fromA, burst);
+    EXPECT_EQ(fromB, burst);
+
+    auto stats = relay->stats();
+    EXPECT_EQ(stats.received, 2 * burst + 3);
+    EXPECT_EQ(stats.sent, 4 * burst + 3);
+}
+
+TEST_P(RelayTest, rooms) {
+    // enough users to land on every worker
+    const size_t perRoom = 8;
+    std::vector<std::unique_ptr<Client>> red, blue;
+    for (size_t i = 0; i < perRoom; i++) {
+        red.push_back(std::make_unique<Client>(relay->port()));
+        blue.push_back(std::make_unique<Client>(relay->port()));
+        red.back()->join(1);
+        blue.back()->join(2);
+    }
+    waitFor(2 * perRoom, 2);
+
+    red[0]->send("red");
+    blue[0]->send("blue");
+    for (size_t i = 1; i < perRoom; i++) {
+        EXPECT_EQ(red[i]->receive(), "red") << i;
+        EXPECT_EQ(blue[i]->receive(), "blue") << i;
+    }
+    EXPECT_EQ(red[0]->receive(), "");
+    EXPECT_EQ(blue[0]->receive(), "");
+    EXPECT_EQ(red[1]->receive(), "");
+    EXPECT_EQ(relay->stats().rooms, 2u);
+}
+
+TEST_P(RelayTest, leaving_a_room) {
+    Client a(relay->port()), b(relay->port());
+    join(a);
+    join(b);
+    EXPECT_EQ(a.receive(), "hi");
+    b.join(7);
+    waitFor(2, 2);
+    a.send("anyone?");
+    EXPECT_EQ(b.receive(), "");
+    a.join(7);
+    waitFor(2, 1);
+    a.send("here");
+    EXPECT_EQ(b.receive(), "here");
+}
+
+TEST_P(RelayTest, forgets_idle_users) {
+    Client a(relay->port()), b(relay->port());
+    join(a);
+    join(b);
+    b.join(3);
+    std::this_thread::sleep_for(USER_TIMEOUT + std::chrono::milliseconds(300));
+    auto stats = relay->stats();
+    EXPECT_EQ(stats.users, 0u);
+    EXPECT_EQ(stats.members, 0u);
+    EXPECT_EQ(stats.rooms, 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(workers, RelayTest, testing::Values(1, 4));
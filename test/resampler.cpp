@@ -0,0 +1,100 @@
+#include "audio/resampler.hpp"
+#include <cmath>
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace aud;
+
+static std::vector<float> tone(float freq, int rate, size_t n, float amp = 0.5f) {
+    std::vector<float> v(n);
+    for (size_t i = 0; i < n; i++) {
+        v[i] = amp * std::sin(2 * (float)M_PI * freq * i / rate);
+    }
+    return v;
+}
+
+static std::vector<float> run(Resampler &rs, const std::vector<float> &in) {
+    std::vector<float> out(rs.maxOutput(in.size()));
+    out.resize(rs.process(in.data(), in.size(), out.data()));
+    return out;
+}
+
+static float rmsFrom(const std::vector<float> &v, size_t from) {
+    double s = 0;
+    for (size_t i = from; i < v.size(); i++) {
+        s += v[i] * v[i];
+    }
+    return (float)std::sqrt(s / (v.size() - from));
+}
+
+TEST(resampler, output_rate) {
+    for (auto [in, out] :
+         {std::pair{44100, 48000}, {48000, 44100}, {16000, 48000}, {48000, 16000}}) {
+        Resampler rs(in, out);
+        auto res = run(rs, tone(440, in, in));
+        ASSERT_NEAR((double)res.size(), out, 2) << in << " -> " << out;
+    }
+}
+
+TEST(resampler, keeps_passband_tone) {
+    Resampler rs(44100, 48000);
+    auto out = run(rs, tone(1000, 44100, 44100));
+    // after the filter delay the tone keeps its level
+    ASSERT_NEAR(rmsFrom(out, 1000), 0.5f / std::sqrt(2.f), 2e-3);
+}
+
+TEST(resampler, removes_aliases) {
+    Resampler rs(48000, 16000);
+    auto out = run(rs, tone(10000, 48000, 48000)); // above the new Nyquist frequency
+    ASSERT_LT(rmsFrom(out, 500), 0.005f);
+}
+
+TEST(resampler, streaming_matches_one_pass) {
+    auto in = tone(700, 44100, 10000);
+    Resampler whole(44100, 48000), parts(44100, 48000);
+    auto ref = run(whole, in);
+
+    std::vector<float> got(parts.maxOutput(in.size()) + 64);
+    size_t produced = 0;
+    size_t sizes[] = {1, 7, 300, 441, 1000, 13};
+    for (size_t i = 0, k = 0; i < in.size(); k++) {
+        size_t n = std::min(sizes[k % 6], in.size() - i);
+        produced += parts.process(in.data() + i, n, got.data() + produced);
+        i += n;
+    }
+    ASSERT_EQ(produced, ref.size());
+    for (size_t i = 0; i < produced; i++) {
+        ASSERT_FLOAT_EQ(got[i], ref[i]);
+    }
+}
+
+TEST(resampler, stereo_channels_are_independent) {
+    auto l = tone(500, 48000, 4800), r = tone(900, 48000, 4800, 0.2f);
+    std::vector<float> in(2 * l.size());
+    for (size_t i = 0; i < l.size(); i++) {
+        in[2 * i] = l[i];
+        in[2 * i + 1] = r[i];
+    }
+    Resampler stereo(48000, 44100, 2), mono(48000, 44100);
+    std::vector<float> out(2 * stereo.maxOutput(l.size()));
+    size_t n = stereo.process(in.data(), l.size(), out.data());
+    auto ref = run(mono, r);
+    ASSERT_EQ(n, ref.size());
+    for (size_t i = 0; i < n; i++) {
+        ASSERT_FLOAT_EQ(out[2 * i + 1], ref[i]);
+    }
+}
+
+TEST(resampler, dsp_changes_frame_size) {
+    ResamplerDSP dsp(48000, 44100);
+    size_t total = 0;
+    for (int i = 0; i < 50; i++) {
+        Frame frame(FRAME_SIZE);
+        frame.vad = 0.25f;
+        dsp.process(frame);
+        ASSERT_NEAR((double)frame.size(), 882, 2);
+        ASSERT_EQ(frame.vad, 0.25f);
+        total += frame.size();
+    }
+    ASSERT_NEAR((double)total, 50 * 882, 2);
+}
@@ -0,0 +1,181 @@
+#include "audio/ring.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+using aud::SampleRing;
+using aud::SpscRing;
+
+TEST(spsc_ring, fifo) {
+    SpscRing<int> r(4);
+    int v;
+    ASSERT_FALSE(r.pop(v));
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(r.push(i));
+    }
+    ASSERT_EQ(r.size(), 3);
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(r.pop(v));
+        ASSERT_EQ(v, i);
+    }
+    ASSERT_FALSE(r.pop(v));
+}
+
+TEST(spsc_ring, overflow_drops_oldest) {
+    SpscRing<int> r(3);
+    for (int i = 0; i < 3; i++) {
+        ASSERT_TRUE(r.push(i));
+    }
+    ASSERT_FALSE(r.push(3));
+    ASSERT_FALSE(r.push(4));
+    ASSERT_EQ(r.dropped(), 2);
+    int v;
+    for (int i = 2; i < 5; i++) {
+        ASSERT_TRUE(r.pop(v));
+        ASSERT_EQ(v, i);
+    }
+    ASSERT_FALSE(r.pop(v));
+}
+
+TEST(spsc_ring, copies_the_used_bytes) {
+    struct Item {
+        uint16_t size;
+        uint8_t data[100];
+    };
+    SpscRing<Item> r(2);
+    Item in{3, {1, 2, 3, 4, 5}};
+    ASSERT_TRUE(r.push(in, offsetof(Item, data) + in.size));
+    Item out;
+    std::fill(std::begin(out.data), std::end(out.data), 0xff);
+    ASSERT_TRUE(r.pop(out));
+    EXPECT_EQ(out.size, 3);
+    EXPECT_EQ(out.data[2], 3);
+    EXPECT_EQ(out.data[99], 0xff); // not copied
+}
+
+TEST(spsc_ring, concurrent_order) {
+    struct Item {
+        uint64_t n;
+        uint64_t check[7];
+    };
+    constexpr uint64_t COUNT = 200000;
+    SpscRing<Item> r(16);
+    std::thread producer([&r] {
+        for (uint64_t i = 1; i <= COUNT; i++) {
+            Item it{i, {}};
+            std::fill(std::begin(it.check), std::end(it.check), i * 3);
+            r.push(it);
+        }
+    });
+
+    uint64_t last = 0, got = 0;
+    Item it;
+    while (last < COUNT) {
+        if (!r.pop(it)) {
+            std::this_thread::yield();
+            continue;
+        }
+        ASSERT_GT(it.n, last);
+        for (uint64_t c : it.check) {
+            ASSERT_EQ(c, it.n * 3);
+        }
+        last = it.n;
+        got++;
+    }
+    producer.join();
+    ASSERT_EQ(got + r.dropped(), COUNT);
+}
+
+TEST(sample_ring, partial_transfers) {
+    SampleRing r(8);
+    std::vector<float> in = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    std::vector<float> out(10);
+    ASSERT_EQ(r.read(out.data(), 4), 0u);
+    // what fits
+    ASSERT_EQ(r.write(in.data(), 10), 8u);
+    ASSERT_EQ(r.readable(), 8u);
+    ASSERT_EQ(r.writable(), 0u);
+    ASSERT_EQ(r.write(in.data(), 1), 0u);
+    // what is there
+    ASSERT_EQ(r.read(out.data(), 3), 3u);
+    ASSERT_EQ(r.writable(), 3u);
+    ASSERT_EQ(r.read(out.data() + 3, 10), 5u);
+    ASSERT_EQ(
+        std::vector<float>(out.begin(), out.begin() + 8),
+        std::vector<float>(in.begin(), in.begin() + 8)
+    );
+    ASSERT_EQ(r.readable(), 0u);
+}
+
+TEST(sample_ring, wraps_around) {
+    SampleRing r(5);
+    float next = 0, expect = 0;
+    std::vector<float> buf(5);
+    // transfers of 3 move the ends across the boundary at every other step
+    for (int i = 0; i < 20; i++) {
+        for (float &v : buf) {
+            v = next++;
+        }
+        ASSERT_EQ(r.write(buf.data(), 3), 3u);
+        next -= 2;
+        ASSERT_EQ(r.read(buf.data(), 5), 3u);
+        for (size_t k = 0; k < 3; k++) {
+            ASSERT_EQ(buf[k], expect++);
+        }
+    }
+    // a write split by the end of the buffer, read in two parts
+    float in[4] = {10, 11, 12, 13};
+    ASSERT_EQ(r.write(in, 4), 4u);
+    float out[4];
+    ASSERT_EQ(r.read(out, 1), 1u);
+    ASSERT_EQ(r.read(out + 1, 3), 3u);
+    ASSERT_TRUE(std::equal(in, in + 4, out));
+}
+
+TEST(sample_ring, clear_drops_the_queued) {
+    SampleRing r(4);
+    float in[3] = {1, 2, 3};
+    r.write(in, 3);
+    r.clear();
+    ASSERT_EQ(r.readable(), 0u);
+    ASSERT_EQ(r.writable(), 4u);
+    float out[3];
+    ASSERT_EQ(r.read(out, 3), 0u);
+}
+
+TEST(sample_ring, concurrent_order) {
+    constexpr size_t COUNT = 200000;
+    SampleRing r(64);
+    std::thread producer([&r] {
+        float buf[7];
+        size_t n = 0;
+        while (n < COUNT) {
+            size_t len = std::min<size_t>(7, COUNT - n);
+            for (size_t i = 0; i < len; i++) {
+                buf[i] = (float)(n + i);
+            }
+            size_t written = r.write(buf, len);
+            n += written;
+            if (!written) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    size_t got = 0;
+    float buf[5];
+    while (got < COUNT) {
+        size_t n = r.read(buf, 5);
+        if (!n) {
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < n; i++) {
+            ASSERT_EQ(buf[i], (float)(got + i));
+        }
+        got += n;
+    }
+    producer.join();
+}
@@ -0,0 +1,131 @@
+#include "audio/simd.hpp"
+#include <cmath>
+#include <cstdint>
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace aud;
+
+// odd size to cover the scalar tails
+static constexpr size_t N = 963;
+
+static std::vector<float> signal(float amp) {
+    std::vector<float> v(N);
+    for (size_t i = 0; i < N; i++) {
+        v[i] = amp * std::sin(i * 0.05f) * (i % 7 == 0 ? -1.f : 1.f);
+    }
+    return v;
+}
+
+TEST(simd, variants_match_scalar) {
+    const simd::Kernels &ref = simd::scalar();
+    auto a = signal(0.8f), b = signal(1.5f), ramp = signal(1);
+    for (const simd::Kernels *k : simd::supported()) {
+        SCOPED_TRACE(k->name);
+
+        auto x = a, y = a;
+        ref.gain(x.data(), N, 0.3f);
+        k->gain(y.data(), N, 0.3f);
+        for (size_t i = 0; i < N; i++) {
+            ASSERT_FLOAT_EQ(x[i], y[i]);
+        }
+
+        x = a, y = a;
+        ref.mixAcc(x.data(), b.data(), N, 0.7f);
+        k->mixAcc(y.data(), b.data(), N, 0.7f);
+        for (size_t i = 0; i < N; i++) {
+            ASSERT_NEAR(x[i], y[i], 1e-6);
+        }
+
+        x = a, y = a;
+        ref.crossfade(x.data(), b.data(), ramp.data(), N);
+        k->crossfade(y.data(), b.data(), ramp.data(), N);
+        for (size_t i = 0; i < N; i++) {
+            ASSERT_NEAR(x[i], y[i], 1e-6);
+        }
+
+        std::vector<int16_t> s1(N), s2(N);
+        ref.toS16(b.data(), s1.data(), N);
+        k->toS16(b.data(), s2.data(), N);
+        ASSERT_EQ(s1, s2);
+
+        ref.fromS16(s1.data(), x.data(), N);
+        k->fromS16(s1.data(), y.data(), N);
+        ASSERT_EQ(x, y);
+
+        ASSERT_FLOAT_EQ(ref.peak(b.data(), N), k->peak(b.data(), N));
+        ASSERT_NEAR(ref.rms(b.data(), N), k->rms(b.data(), N), 1e-5);
+        ASSERT_NEAR(ref.dot(a.data(), b.data(), N), k->dot(a.data(), b.data(), N), 1e-3);
+    }
+}
+
+TEST(simd, s16_saturates) {
+    float in[] = {2.f, -2.f, 1.f, -1.f, 0.f, 0.5f, 1e9f, -1e9f};
+    int16_t out[8];
+    for (const simd::Kernels *k : simd::supported()) {
+        SCOPED_TRACE(k->name);
+        k->toS16(in, out, 8);
+        ASSERT_EQ(out[0], 32767);
+        ASSERT_EQ(out[1], -32768);
+        ASSERT_EQ(out[2], 32767);
+        ASSERT_EQ(out[3], -32767);
+        ASSERT_EQ(out[4], 0);
+        ASSERT_EQ(out[6], 32767);
+        ASSERT_EQ(out[7], -32768);
+    }
+}
+
+TEST(simd, adpcm_variants_match_scalar) {
+    const size_t n = 120; // per lane
+    std::vector<int16_t> in(n * simd::ADPCM_LANES);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = (int16_t)(20000 * std::sin(i * 0.07f) + (i % 5 == 0 ? 3000 : 0));
+    }
+    const simd::Kernels &ref = simd::scalar();
+    simd::AdpcmState refEnc, refDec;
+    std::vector<uint8_t> refCodes(in.size() / 2);
+    std::vector<int16_t> refOut(in.size());
+    // two frames, the state carries over
+    for (int frame = 0; frame < 2; frame++) {
+        ref.adpcmEncode(in.data(), n, refEnc, refCodes.data());
+        ref.adpcmDecode(refCodes.data(), n, refDec, refOut.data());
+    }
+    for (const simd::Kernels *k : simd::supported()) {
+        SCOPED_TRACE(k->name);
+        simd::AdpcmState enc, dec;
+        std::vector<uint8_t> codes(in.size() / 2);
+        std::vector<int16_t> out(in.size());
+        for (int frame = 0; frame < 2; frame++) {
+            k->adpcmEncode(in.data(), n, enc, codes.data());
+            k->adpcmDecode(codes.data(), n, dec, out.data());
+        }
+        ASSERT_EQ(codes, refCodes);
+        ASSERT_EQ(out, refOut);
+        for (size_t b = 0; b < simd::ADPCM_LANES; b++) {
+            ASSERT_EQ(enc.pred[b], dec.pred[b]);
+            ASSERT_EQ(enc.index[b], dec.index[b]);
+        }
+    }
+}
+
+TEST(simd, adpcm_follows_the_signal) {
+    const size_t n = 240;
+    std::vector<int16_t> in(n * simd::ADPCM_LANES), out(in.size());
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = (int16_t)(10000 * std::sin(i * 0.05f));
+    }
+    std::vector<uint8_t> codes(in.size() / 2);
+    simd::AdpcmState enc, dec;
+    simd::adpcmEncode(in.data(), n, enc, codes.data());
+    simd::adpcmDecode(codes.data(), n, dec, out.data());
+    // past the start of every lane, where the step adapts from its smallest
+    double err = 0, sig = 0;
+    for (size_t b = 0; b < simd::ADPCM_LANES; b++) {
+        for (size_t t = n / 2; t < n; t++) {
+            double d = out[b * n + t] - in[b * n + t];
+            err += d * d;
+            sig += (double)in[b * n + t] * in[b * n + t];
+        }
+    }
+    EXPECT_GT(10 * std::log10(sig / err), 20); // dB
+}
@@ -0,0 +1,161 @@
+#include "audio/packet.hpp"
+#include "client.hpp"
+#include "server/relay.hpp"
+#include "server/speakers.hpp"
+#include "util.hpp"
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace chat::server;
+
+// a media datagram with a SILK 20 ms payload of size bytes
+static std::vector<uint8_t> packet(size_t size) {
+    std::vector<uint8_t> pack(aud::MediaHeader::SIZE + size, 0x55);
+    aud::MediaHeader{}.write(pack);
+    pack[aud::MediaHeader::SIZE] = 1 << 3;
+    return pack;
+}
+
+class SpeakerTest : public testing::Test {
+  protected:
+    void init(size_t seats, size_t members) {
+        sel = std::make_unique<SpeakerSelector>(seats);
+        for (size_t i = 0; i < members; i++) {
+            sel->add();
+        }
+    }
+    // a few frames of every sender at its packet size, 0 sends nothing
+    std::vector<bool> send(const std::vector<size_t> &sizes, size_t frames = 5) {
+        std::vector<bool> admitted(sizes.size());
+        for (size_t f = 0; f < frames; f++) {
+            now += std::chrono::milliseconds(20);
+            for (size_t i = 0; i < sizes.size(); i++) {
+                if (sizes[i] > 0) {
+                    auto pack = packet(sizes[i]);
+                    admitted[i] = sel->admit(i, pack.data(), pack.size(), now);
+                }
+            }
+        }
+        return admitted;
+    }
+
+    std::unique_ptr<SpeakerSelector> sel;
+    Clock::time_point now = Clock::now();
+};
+
+TEST(OpusDuration, from_the_toc) {
+    uint8_t silk20[] = {1 << 3};
+    EXPECT_EQ(opusDurationUs(silk20, 1), 20000u);
+    uint8_t hybrid10x2[] = {12 << 3 | 1};
+    EXPECT_EQ(opusDurationUs(hybrid10x2, 1), 20000u);
+    uint8_t celt20x3[] = {31 << 3 | 3, 3};
+    EXPECT_EQ(opusDurationUs(celt20x3, 2), 60000u);
+    uint8_t tooLong[] = {31 << 3 | 3, 63};
+    EXPECT_EQ(opusDurationUs(tooLong, 2), 0u);
+    EXPECT_EQ(opusDurationUs(nullptr, 0), 0u);
+}
+
+TEST_F(SpeakerTest, loudest_take_the_seats) {
+    init(2, 4);
+    auto admitted = send({60, 60, 10, 0});
+    EXPECT_TRUE(admitted[0]);
+    EXPECT_TRUE(admitted[1]);
+    EXPECT_FALSE(admitted[2]); // silence is not speech
+    EXPECT_EQ(sel->speakers(), 2u);
+
+    admitted = send({60, 60, 60, 0});
+    EXPECT_FALSE(admitted[2]); // not louder enough
+    admitted = send({10, 60, 60, 0}, 20);
+    EXPECT_TRUE(admitted[2]);
+    EXPECT_FALSE(sel->isSpeaker(0));
+}
+
+TEST_F(SpeakerTest, hysteresis) {
+    init(1, 2);
+    send({60, 0});
+    EXPECT_FALSE(send({60, 80})[1]);
+    EXPECT_TRUE(sel->isSpeaker(0));
+    EXPECT_TRUE(send({60, 100})[1]);
+    EXPECT_FALSE(sel->isSpeaker(0));
+}
+
+TEST_F(SpeakerTest, idle_speaker_loses_the_seat) {
+    init(1, 2);
+    send({60, 0});
+    now += SpeakerSelector::IDLE;
+    EXPECT_TRUE(send({0, 40}, 3)[1]);
+    EXPECT_FALSE(sel->isSpeaker(0));
+}
+
+TEST_F(SpeakerTest, remove_moves_the_seat) {
+    init(2, 3);
+    send({60, 0, 60});
+    sel->remove(0);
+    EXPECT_EQ(sel->speakers(), 1u);
+    EXPECT_TRUE(sel->isSpeaker(0));
+    EXPECT_FALSE(sel->isSpeaker(1));
+    EXPECT_TRUE(send({60, 60})[1]);
+    EXPECT_EQ(sel->speakers(), 2u);
+}
+
+TEST_F(SpeakerTest, control_is_forwarded) {
+    init(1, 2);
+    send({60, 0});
+    std::vector<uint8_t> join;
+    RoomJoin{1}.serialize(join);
+    EXPECT_TRUE(sel->admit(1, join.data(), join.size(), now));
+    EXPECT_FALSE(sel->isSpeaker(1));
+    std::vector<uint8_t> raw(60, 1 << 3); // no header
+    EXPECT_FALSE(sel->admit(1, raw.data(), raw.size(), now));
+}
+
+TEST_F(SpeakerTest, bundles_count_every_frame) {
+    init(1, 2);
+    send({60, 0});
+    // 3 loud frames a bundle, 60 ms apart
+    uint8_t buf[512];
+    std::vector<uint8_t> payload(100, 0x55);
+    payload[0] = 1 << 3;
+    bool admitted = false;
+    for (int i = 0; i < 5; i++) {
+        aud::Bundle b(buf);
+        for (int f = 0; f < 3; f++) {
+            ASSERT_TRUE(b.add(aud::MediaHeader{}, payload));
+        }
+        now += std::chrono::milliseconds(60);
+        auto datagram = b.datagram();
+        admitted = sel->admit(1, datagram.data(), datagram.size(), now);
+    }
+    EXPECT_TRUE(admitted);
+    EXPECT_TRUE(sel->isSpeaker(1));
+}
+
+TEST(TopKRelay, forwards_the_loudest) {
+    test::muteLog();
+    Relay relay(0, 1, false, RelayMode::TopK, 1);
+    std::thread loop([&] { relay.run(); });
+
+    test::Client a(relay.port()), b(relay.port()), c(relay.port());
+    a.join(1);
+    b.join(1);
+    c.join(1);
+    ASSERT_TRUE(test::waitFor([&] { return relay.stats().members == 3; }));
+
+    auto loud = packet(80), quiet = packet(10);
+    for (size_t i = 0; i < 5; i++) {
+        a.send(loud);
+        b.send(quiet);
+    }
+    size_t fromLoud = 0;
+    for (std::string msg; !(msg = c.receive()).empty();) {
+        EXPECT_EQ(msg.size(), loud.size()) << "a quiet sender is forwarded";
+        fromLoud += msg.size() == loud.size();
+    }
+    EXPECT_EQ(fromLoud, 5u);
+
+    relay.stop();
+    loop.join();
+}
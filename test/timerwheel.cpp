@@ -0,0 +1,97 @@
+#include "server/timerwheel.hpp"
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+using namespace chat::server;
+using namespace std::chrono;
+using Wheel = TimerWheel<int>;
+
+static const Wheel::Clock::time_point T0{};
+
+TEST(timerwheel, fires_at_the_deadline) {
+    Wheel w(milliseconds(10), T0);
+    w.schedule(T0 + milliseconds(50), 1);
+    w.schedule(T0 + milliseconds(20), 2);
+    std::vector<int> fired;
+    auto collect = [&](int v) { fired.push_back(v); };
+
+    w.advance(T0 + milliseconds(19), collect);
+    EXPECT_TRUE(fired.empty());
+    w.advance(T0 + milliseconds(20), collect);
+    EXPECT_EQ(fired, std::vector<int>{2});
+    w.advance(T0 + milliseconds(49), collect);
+    EXPECT_EQ(fired.size(), 1u);
+    w.advance(T0 + milliseconds(55), collect);
+    EXPECT_EQ(fired, (std::vector<int>{2, 1}));
+    EXPECT_EQ(w.size(), 0u);
+}
+
+TEST(timerwheel, past_deadline_fires_next) {
+    Wheel w(milliseconds(10), T0);
+    w.advance(T0 + seconds(1), [](int) {});
+    int fired = 0;
+    w.schedule(T0 + milliseconds(500), 1);
+    w.advance(T0 + seconds(1), [&](int) { fired++; });
+    EXPECT_EQ(fired, 0);
+    w.advance(T0 + milliseconds(1010), [&](int) { fired++; });
+    EXPECT_EQ(fired, 1);
+}
+
+// deadlines over all the levels, scheduled at random moments, fire in order and on time
+TEST(timerwheel, cascades_in_order) {
+    const auto tick = milliseconds(1);
+    Wheel w(tick, T0);
+    std::mt19937 rng(1);
+    std::vector<int64_t> due; // ms
+    auto now = T0;
+    int64_t last = -1;
+    size_t fired = 0;
+    auto check = [&](int i) {
+        int64_t nowMs = duration_cast<milliseconds>(now - T0).count();
+        EXPECT_EQ(due[i], nowMs) << i;
+        EXPECT_GE(due[i], last);
+        last = due[i];
+        fired++;
+    };
+    for (int i = 0; i < 2000; i++) {
+        int64_t nowMs = duration_cast<milliseconds>(now - T0).count();
+        int64_t delay = 1 + rng() % (i % 4 == 0 ? 5000000 : 300);
+        due.push_back(nowMs + delay);
+        w.schedule(now + milliseconds(delay), i);
+        // step tick by tick now and then, so every deadline is hit exactly
+        for (int s = 0; s < 3; s++) {
+            now += tick;
+            w.advance(now, check);
+        }
+    }
+    // the rest tick by tick would take long, check the order only
+    last = -1;
+    auto rest = [&](int i) {
+        EXPECT_GE(due[i], last);
+        EXPECT_LE(due[i], duration_cast<milliseconds>(now - T0).count());
+        last = due[i];
+        fired++;
+    };
+    while (w.size() > 0) {
+        now += milliseconds(997);
+        w.advance(now, rest);
+    }
+    EXPECT_EQ(fired, due.size());
+}
+
+TEST(timerwheel, reschedule_from_fire) {
+    Wheel w(milliseconds(10), T0);
+    w.schedule(T0 + milliseconds(100), 0);
+    int rounds = 0;
+    auto now = T0;
+    for (int i = 0; i < 100; i++) {
+        now += milliseconds(10);
+        w.advance(now, [&](int) {
+            rounds++;
+            w.schedule(now + milliseconds(100), 0);
+        });
+    }
+    EXPECT_EQ(rounds, 10);
+    EXPECT_EQ(w.size(), 1u);
+}
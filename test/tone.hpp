@@ -0,0 +1,45 @@
+#pragma once
+
+#include "audio/core.hpp"
+#include <cmath>
+#include <cstddef>
+
+namespace test {
+
+// An endless 440 Hz mono tone in frames of frameLen, always active and ready.
+class ToneSrc : public aud::RawSource {
+  public:
+    explicit ToneSrc(size_t frameLen = aud::FRAME_SIZE) : frameLen(frameLen) {}
+    // the sample t of the tone
+    static float at(size_t t) {
+        return 0.5f * std::sin(2 * (float)M_PI * 440 * t / aud::SAMPLE_RATE);
+    }
+    void read(aud::Frame &frame) override {
+        frame.resize(frameLen);
+        for (size_t i = 0; i < frameLen; i++, t++) {
+            frame[i] = at(t);
+        }
+        frame.vad = vad;
+    }
+    void lockState() override {}
+    void unlockState() override {}
+    void start() override {}
+    void stop() override {}
+    aud::State state() override {
+        return aud::State::Active;
+    }
+    void waitActive() override {}
+    bool ready() override {
+        return true;
+    }
+    int channels() const override {
+        return 1;
+    }
+    float vad = 1;
+
+  private:
+    const size_t frameLen;
+    size_t t = 0;
+};
+
+} // namespace test
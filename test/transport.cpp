@@ -0,0 +1,264 @@
+#include "audio/codec.hpp"
+#include "audio/feedback.hpp"
+#include "audio/transport.hpp"
+#include "log.hpp"
+#include <atomic>
+#include <boost/asio/ip/udp.hpp>
+#include <chrono>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+
+using namespace aud;
+using boost::asio::ip::udp;
+
+namespace {
+
+// the other end, a plain blocking socket
+class Peer {
+  public:
+    Peer() : sock(io, udp::endpoint(boost::asio::ip::address_v4::loopback(), 0)) {
+        timeval tv{2, 0};
+        setsockopt(sock.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    udp::endpoint endpoint() const {
+        return sock.local_endpoint();
+    }
+    void send(const std::vector<uint8_t> &datagram, uint16_t port) {
+        sock.send_to(
+            boost::asio::buffer(datagram),
+            udp::endpoint(boost::asio::ip::address_v4::loopback(), port)
+        );
+    }
+    std::vector<uint8_t> receive() {
+        std::vector<uint8_t> buf(MAX_DATAGRAM_SIZE);
+        buf.resize(sock.receive(boost::asio::buffer(buf)));
+        return buf;
+    }
+
+  private:
+    boost::asio::io_context io;
+    udp::socket sock;
+};
+
+std::vector<uint8_t> media(uint32_t stream, uint16_t seq) {
+    static OpusEnc enc(EncoderPreset::Voise, 1);
+    Frame frame(FRAME_SIZE);
+    std::vector<uint8_t> payload;
+    enc.encode(frame, payload);
+    MediaHeader h;
+    h.seq = seq;
+    h.timestamp = seq * FRAME_SIZE;
+    h.stream = stream;
+    std::vector<uint8_t> datagram(MediaHeader::SIZE + payload.size());
+    h.write(datagram);
+    std::copy(payload.begin(), payload.end(), datagram.begin() + MediaHeader::SIZE);
+    return datagram;
+}
+
+template <typename F> bool waitFor(F &&done) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!done()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+class TransportTest : public testing::Test {
+  protected:
+    static void SetUpTestSuite() {
+        chat::global_logger.setFilter([](auto...) { return false; });
+        chat::global_logger.setOutput(&std::cerr);
+    }
+};
+
+} // namespace
+
+TEST_F(TransportTest, sends_from_the_queue) {
+    Peer peer;
+    MediaTransport t(peer.endpoint());
+    t.start();
+    MediaHeader h;
+    h.seq = 7;
+    h.stream = 42;
+    std::vector<uint8_t> payload = {1, 2, 3};
+    ASSERT_TRUE(t.send(h, payload));
+
+    auto got = peer.receive();
+    MediaPacket mp;
+    ASSERT_TRUE(MediaPacket::parse(got, mp));
+    EXPECT_EQ(mp.seq(), 7);
+    EXPECT_EQ(mp.stream(), 42u);
+    EXPECT_EQ(std::vector<uint8_t>(mp.payload().begin(), mp.payload().end()), payload);
+}
+
+TEST_F(TransportTest, dispatches_by_stream) {
+    Peer peer;
+    MediaTransport t(peer.endpoint());
+    auto known = std::make_shared<NetBuf>();
+    t.addStream(1, known);
+    std::vector<shared_ptr<NetBuf>> created;
+    std::atomic<size_t> newStreams{0};
+    t.onStream = [&](uint32_t stream) {
+        created.push_back(std::make_shared<NetBuf>());
+        newStreams++;
+        return stream == 3 ? nullptr : created.back();
+    };
+    std::atomic<size_t> controls{0};
+    t.onControl = [&](span<const uint8_t> datagram) {
+        EXPECT_TRUE(ReceiverReport::isReport(datagram));
+        controls++;
+    };
+    t.start();
+
+    std::vector<uint8_t> report;
+    ReceiverReport{}.serialize(report);
+    for (uint16_t seq = 0; seq < 3; seq++) {
+        peer.send(media(1, seq), t.localPort());
+        peer.send(media(2, seq), t.localPort());
+        peer.send(media(3, seq), t.localPort());
+    }
+    peer.send(report, t.localPort());
+    ASSERT_TRUE(waitFor([&] { return t.received() == 10; }));
+    t.stop();
+
+    // stream 3 is asked for on every datagram, as it is refused
+    EXPECT_EQ(newStreams, 4u);
+    EXPECT_EQ(controls, 1u);
+    EXPECT_EQ(t.dropped(), 3u);
+    Frame frame;
+    known->read(frame);
+    EXPECT_EQ(frame.vad, 1.f); // a packet, not the silence before the first one
+    created[0]->read(frame);
+    EXPECT_EQ(frame.vad, 1.f);
+}
+
+TEST_F(TransportTest, restarts) {
+    Peer peer;
+    MediaTransport t(peer.endpoint());
+    auto nb = std::make_shared<NetBuf>();
+    t.addStream(5, nb);
+    t.start();
+    t.stop();
+    t.start();
+    peer.send(media(5, 0), t.localPort());
+    ASSERT_TRUE(waitFor([&] { return t.received() == 1; }));
+    auto datagram = media(5, 1);
+    ASSERT_TRUE(t.send(datagram));
+    EXPECT_EQ(peer.receive(), datagram);
+}
+
+TEST_F(TransportTest, aggregates_frames) {
+    Peer peer;
+    MediaTransport t(peer.endpoint());
+    t.setAggregation(3);
+    t.start();
+    std::vector<uint8_t> payload = {1, 2, 3};
+    MediaHeader h;
+    for (uint16_t seq = 0; seq < 3; seq++) {
+        h.seq = seq;
+        h.stream = 1;
+        ASSERT_TRUE(t.send(h, payload));
+        h.stream = 2; // rides along
+        ASSERT_TRUE(t.send(h, payload));
+    }
+    auto got = peer.receive();
+    ASSERT_TRUE(Bundle::isBundle(got));
+    Bundle::Reader reader(got);
+    MediaPacket mp;
+    size_t packets = 0;
+    while (reader.next(mp)) {
+        EXPECT_EQ(mp.seq(), packets / 2);
+        EXPECT_EQ(mp.stream(), packets % 2 + 1);
+        packets++;
+    }
+    EXPECT_EQ(packets, 5u); // the last one of stream 2 opens the next bundle
+
+    // which is sent on its own after the window, without a bundle around it
+    got = peer.receive();
+    ASSERT_TRUE(MediaPacket::parse(got, mp));
+    EXPECT_EQ(mp.stream(), 2u);
+    EXPECT_EQ(mp.seq(), 2);
+}
+
+TEST_F(TransportTest, unpacks_bundles) {
+    Peer peer;
+    MediaTransport t(peer.endpoint());
+    auto first = std::make_shared<NetBuf>();
+    auto second = std::make_shared<NetBuf>();
+    t.addStream(1, first);
+    t.addStream(2, second);
+    t.start();
+
+    std::vector<uint8_t> datagram(MAX_DATAGRAM_SIZE);
+    Bundle b(datagram);
+    for (uint16_t seq = 0; seq < 2; seq++) {
+        for (uint32_t stream = 1; stream <= 2; stream++) {
+            auto one = media(stream, seq);
+            MediaPacket mp;
+            ASSERT_TRUE(MediaPacket::parse(one, mp));
+            ASSERT_TRUE(b.add(mp.header(), mp.payload()));
+        }
+    }
+    datagram.resize(b.datagram().size());
+    peer.send(datagram, t.localPort());
+    ASSERT_TRUE(waitFor([&] { return t.received() == 1; }));
+    t.stop();
+
+    EXPECT_EQ(t.dropped(), 0u);
+    Frame frame;
+    first->read(frame);
+    EXPECT_EQ(frame.vad, 1.f);
+    second->read(frame);
+    EXPECT_EQ(frame.vad, 1.f);
+}
+
+TEST_F(TransportTest, drops_what_the_remote_did_not_send) {
+    Peer peer, stranger;
+    MediaTransport t(peer.endpoint());
+    auto nb = std::make_shared<NetBuf>();
+    t.addStream(1, nb);
+    t.start();
+    stranger.send(media(1, 0), t.localPort());
+    peer.send(media(1, 1), t.localPort());
+    ASSERT_TRUE(waitFor([&] { return t.received() == 2; }));
+    t.stop();
+    EXPECT_EQ(t.dropped(), 1u);
+}
+
+TEST_F(TransportTest, expires_idle_streams) {
+    Peer peer;
+    MediaTransport t(peer.endpoint());
+    t.setStreamTimeout(std::chrono::milliseconds(50));
+    t.addStream(1, std::make_shared<NetBuf>());
+    t.onStream = [](uint32_t) { return std::make_shared<NetBuf>(); };
+    std::atomic<uint32_t> ended{0};
+    t.onStreamEnd = [&](uint32_t stream, shared_ptr<NetBuf> nb) {
+        EXPECT_NE(nb, nullptr);
+        ended = stream;
+    };
+    t.start();
+    peer.send(media(1, 0), t.localPort());
+    peer.send(media(2, 0), t.localPort());
+    ASSERT_TRUE(waitFor([&] { return ended == 2; }));
+    t.stop();
+
+    // the stream of addStream stays, the ended one is asked for again
+    size_t asked = 0;
+    t.onStream = [&](uint32_t) {
+        asked++;
+        return std::make_shared<NetBuf>();
+    };
+    t.start();
+    peer.send(media(1, 1), t.localPort());
+    peer.send(media(2, 1), t.localPort());
+    ASSERT_TRUE(waitFor([&] { return t.received() == 4; }));
+    t.stop();
+    EXPECT_EQ(asked, 1u);
+}
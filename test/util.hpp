@@ -0,0 +1,29 @@
+#pragma once
+
+#include "log.hpp"
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+namespace test {
+
+// the code under test logs, the tests do not want to read it
+inline void muteLog() {
+    chat::global_logger.setFilter([](auto...) { return false; });
+    chat::global_logger.setOutput(&std::cerr);
+}
+
+// polls the condition until it holds or the timeout passes, returns whether it held
+template <class F>
+bool waitFor(F cond, std::chrono::milliseconds timeout = std::chrono::seconds(1)) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (!cond()) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+} // namespace test